@@ -0,0 +1,295 @@
+#include "../src/chibidit.h"
+
+/* ========================== Headless benchmark ============================
+ *
+ * Runs the editor without a terminal: the screen size is fixed, the frames
+ * built by refreshScreen() go to a sink that only counts the bytes, and the
+ * keystrokes are written to a non blocking pipe read by processKeyPress(),
+ * exactly as they would be read from the terminal.
+ *
+ * For every file size given on the command line (default 1000 and 100000
+ * lines) a C-like file is generated and the latency of load, scroll (with
+ * and without wrap), jump, type, paste, save and search is reported as
+ * percentiles, in milliseconds. Then a single line of 64 MB is loaded,
+ * edited at its end and scrolled. A key latency includes the refreshScreen()
+ * that follows it, as in the editor main loop. */
+
+struct EditorConf EC;
+
+#define BENCH_ROWS 50
+#define BENCH_COLS 120
+
+static int keys[2];             /* Keystrokes pipe, read and write side. */
+static size_t frame_bytes;      /* Bytes emitted by refreshScreen(). */
+static unsigned long frames;
+
+typedef struct samples {
+    double *v;
+    int len, cap;
+} samples;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sink(const char *s, int len) {
+    (void)s;
+    frame_bytes += len;
+    frames++;
+}
+
+static void addSample(samples *s, double v) {
+    if (s->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->v = realloc(s->v, sizeof(double) * s->cap);
+    }
+    s->v[s->len++] = v;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(samples *s, double p) {
+    int idx = (int)(p * (s->len - 1) + 0.5);
+    return s->v[idx];
+}
+
+static void report(long lines, const char *op, samples *s) {
+    qsort(s->v, s->len, sizeof(double), cmpDouble);
+    printf("%-10ld %-8s %6d %10.3f %10.3f %10.3f %10.3f\n", lines, op, s->len,
+            percentile(s, 0.5) * 1000, percentile(s, 0.9) * 1000,
+            percentile(s, 0.99) * 1000, s->v[s->len - 1] * 1000);
+    free(s->v);
+    memset(s, 0, sizeof(*s));
+}
+
+// Feed one keystroke (or escape sequence) and draw the next frame, returns
+// the elapsed time.
+static double key(const char *seq, int len) {
+    if (write(keys[1], seq, len) != len) {
+        perror("Writing keystrokes");
+        exit(1);
+    }
+    double start = now();
+    processKeyPress(keys[0]);
+    refreshScreen();
+    return now() - start;
+}
+
+#define KEY(s) key(s, sizeof(s) - 1)
+
+static void genFile(const char *path, long lines) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("Creating benchmark file");
+        exit(1);
+    }
+    for (long j = 0; j < lines; j++) {
+        switch (j % 8) {
+        case 0: fprintf(fp, "/* Block %ld of the generated file. */\n", j); break;
+        case 1: fprintf(fp, "static int value_%ld = %ld;\n", j, j * 7); break;
+        case 2: fprintf(fp, "int func_%ld(char *s, int len) {\n", j); break;
+        case 3: fprintf(fp, "\tif (len > %ld && s[0] == 'x')\n", j % 100); break;
+        case 4: fprintf(fp, "\t\treturn strlen(\"string %ld\");\n", j); break;
+        case 5: fprintf(fp, "\treturn len; // done\n"); break;
+        case 6: fprintf(fp, "}\n"); break;
+        case 7: fprintf(fp, "\n"); break;
+        }
+    }
+    fclose(fp);
+}
+
+// Close every buffer and open 'path' in a fresh one.
+static void reopen(const char *path) {
+    for (int j = 0; j < EC.numbufs; j++)
+        freeBuffer(EC.bufs[j]);
+    EC.numbufs = 0;
+    EC.view->buf = EC.buf = NULL;
+    openBuffer((char *)path);
+}
+
+// Show the row at the top of the view, with the cursor on it.
+static void showRow(long row) {
+    EC.view->row_offset = row;
+    EC.view->cy = 0;
+    EC.view->cx = 0;
+    EC.view->col_offset = 0;
+}
+
+static void bench(long lines) {
+    char path[64], savepath[80];
+    samples s = {0};
+
+    snprintf(path, sizeof(path), "/tmp/chibidit-bench-%ld.c", lines);
+    snprintf(savepath, sizeof(savepath), "%s.saved", path);
+    genFile(path, lines);
+
+    // Load
+    int loads = lines >= 1000000 ? 1 : lines >= 100000 ? 3 : 20;
+    for (int j = 0; j < loads; j++) {
+        double start = now();
+        reopen(path);
+        addSample(&s, now() - start);
+    }
+    report(lines, "load", &s);
+
+    // Scroll: line by line, then page by page.
+    showRow(0);
+    refreshScreen();
+    for (int j = 0; j < 500; j++)
+        addSample(&s, KEY("j"));
+    for (int j = 0; j < 200; j++)
+        addSample(&s, KEY("\x1b[6~"));
+    report(lines, "scroll", &s);
+
+    // Jump: to the last and first line, to a percentage and a line number.
+    for (int j = 0; j < 50; j++) {
+        char seq[32];
+        addSample(&s, KEY("G"));
+        addSample(&s, KEY("gg"));
+        int len = snprintf(seq, sizeof(seq), "%d%%", 1 + j * 2);
+        addSample(&s, key(seq, len));
+        len = snprintf(seq, sizeof(seq), "%ldG", 1 + lines * j / 50);
+        addSample(&s, key(seq, len));
+        addSample(&s, KEY("\x04"));
+    }
+    report(lines, "jump", &s);
+
+    // The same in wrap mode, narrow enough for some rows to wrap.
+    showRow(0);
+    KEY("\x17z");
+    EC.view->screencols = 40;
+    refreshScreen();
+    for (int j = 0; j < 500; j++)
+        addSample(&s, KEY("j"));
+    for (int j = 0; j < 200; j++)
+        addSample(&s, KEY("\x1b[6~"));
+    EC.view->screencols = BENCH_COLS;
+    KEY("\x17z");
+    report(lines, "wrap", &s);
+
+    // Type in the middle of the file.
+    showRow(lines / 2);
+    KEY("i");
+    for (int j = 0; j < 1000; j++)
+        addSample(&s, key(&"abcdefghij"[j % 10], 1));
+    KEY("\x1b");
+    report(lines, "type", &s);
+
+    // Paste: a burst of 100 lines of text, every sample is one paste.
+    showRow(lines / 3);
+    KEY("i");
+    for (int j = 0; j < 10; j++) {
+        double start = now();
+        for (int k = 0; k < 100; k++) {
+            for (const char *p = "int pasted = 1; /* pasted text */"; *p; p++)
+                key(p, 1);
+            KEY("\r");
+        }
+        addSample(&s, now() - start);
+    }
+    KEY("\x1b");
+    report(lines, "paste", &s);
+
+    // Save
+    free(EC.buf->filename);
+    EC.buf->filename = strdup(savepath);
+    for (int j = 0; j < 5; j++) {
+        double start = now();
+        save();
+        addSample(&s, now() - start);
+    }
+    report(lines, "save", &s);
+
+    // Search: a word near the end of the file, and one that is not there.
+    for (int j = 0; j < 10; j++) {
+        // The prompt reads the keys by itself, so they are all queued at
+        // once: the time includes the refresh after every key of the query.
+        char seq[32];
+        int len = snprintf(seq, sizeof(seq),
+                j % 2 ? "\x06" "func_%ld(\r" : "\x06" "nomatch%ld\r",
+                j % 2 ? lines - 6 : (long)j);
+        showRow(0);
+        addSample(&s, key(seq, len));
+    }
+    report(lines, "search", &s);
+
+    unlink(path);
+    unlink(savepath);
+}
+
+// A single line of minified JSON of about 'bytes' bytes: load it, seek its
+// end and type there, then scroll it horizontally.
+static void benchLong(long bytes) {
+    char path[64];
+    samples s = {0};
+
+    snprintf(path, sizeof(path), "/tmp/chibidit-bench-long-%ld.json", bytes);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("Creating benchmark file");
+        exit(1);
+    }
+    fputc('[', fp);
+    for (long n = 0, j = 0; n < bytes; j++)
+        n += fprintf(fp, "{\"id\":%ld,\"name\":\"item %ld\",\"v\":%ld.5},",
+                j, j, j % 97);
+    fprintf(fp, "{}]\n");
+    fclose(fp);
+
+    double start = now();
+    reopen(path);
+    addSample(&s, now() - start);
+    report(bytes, "longload", &s);
+
+    showRow(0);
+    refreshScreen();
+    addSample(&s, KEY("\x1b[F"));
+    KEY("i");
+    for (int j = 0; j < 200; j++)
+        addSample(&s, key(&"abcdefghij"[j % 10], 1));
+    KEY("\x1b");
+    report(bytes, "longtype", &s);
+
+    addSample(&s, KEY("\x1b[H"));
+    for (int j = 0; j < 500; j++)
+        addSample(&s, KEY("l"));
+    report(bytes, "longmove", &s);
+    unlink(path);
+}
+
+int main(int argc, char **argv) {
+    if (pipe(keys) == -1 || fcntl(keys[0], F_SETFL, O_NONBLOCK) == -1) {
+        perror("Creating keystrokes pipe");
+        exit(1);
+    }
+    initViews();
+    EC.screen_sink = sink;
+    EC.screenrows = BENCH_ROWS - 1;
+    EC.screencols = BENCH_COLS;
+    layoutViews();
+    EC.mode = NORMAL;
+
+    printf("%-10s %-8s %6s %10s %10s %10s %10s\n",
+            "lines", "op", "n", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+    if (argc < 2) {
+        bench(1000);
+        bench(100000);
+    } else {
+        for (int j = 1; j < argc; j++)
+            bench(atol(argv[j]));
+    }
+    benchLong(64 * 1024 * 1024);
+
+    struct rowStats st;
+    rowStatsGet(&st);
+    printf("\nframes: %lu, %.1f bytes/frame\n", frames,
+            frames ? (double)frame_bytes / frames : 0);
+    printf("rows: %zu bytes live, %zu wasted, %llu allocs\n",
+            st.live, st.wasted, st.allocs);
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include "chibidit.h"
+
+/* ========================= Shared row memory pool =========================
+ *
+ * The chars, render and hl arrays of every row, of every open buffer, are
+ * allocated here instead of calling malloc(3) directly. Requests are rounded
+ * up to a power of two size class and freed blocks are kept in a per class
+ * free list shared by all the buffers, so the memory released by editing or
+ * closing one file is recycled as is by the others instead of fragmenting
+ * the heap with many differently sized small blocks.
+ *
+ * Blocks of the small classes are carved out of big slabs, so that loading
+ * or editing a file does not translate into millions of small mallocs.
+ * Rounding up to the class size also gives every block some slack, so that
+ * a row can grow in place for a while before it must move.
+ *
+ * When a file is loaded, its rows are allocated with a bump pointer from an
+ * arena owned by the buffer instead: the blocks are packed back to back and
+ * all the arena is released at once when the buffer is closed. A block of
+ * the arena that is freed or grows out of its size is just left unused.
+ *
+ * Every block is prefixed by a small header that remembers where it comes
+ * from, its capacity and the size in use, for the statistics.
+ *
+ * A block may be shared by several rows, or by rows and registers, see
+ * rowShare(): the header counts its other owners, the last one frees it and
+ * the first one that changes it gets a copy. rowRealloc() always returns a
+ * block of its own, the code that writes in place a block it did not just
+ * reallocate calls rowOwn() first. An arena is freed with the last of its
+ * owners as well, the buffer and the registers holding blocks of it. */
+
+#define POOL_MIN_SHIFT 4    /* Smallest class is 16 bytes. */
+#define POOL_SLAB_SHIFT 12  /* Classes up to 4 KB are carved from slabs. */
+#define POOL_MAX_SHIFT 16   /* Largest pooled class is 64 KB. */
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_LARGE 0xfe     /* Block allocated directly with malloc. */
+#define POOL_ARENA 0xff     /* Block allocated from a buffer arena. */
+
+#define SLAB_SIZE (256 * 1024)
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+// The header is 16 bytes, and so are all the block sizes, so that every
+// block is suitably aligned for the arrays of chars and ints of the rows.
+typedef struct poolHeader {
+    struct {
+        uint16_t cls;       /* Size class index, POOL_LARGE or POOL_ARENA. */
+        uint16_t refs;      /* Owners of the block besides the first one. */
+        uint32_t used;      /* Bytes requested by the last (re)allocation. */
+        uint64_t size;      /* Usable size of the block. */
+    } h;
+} poolHeader;
+
+typedef struct poolFree {
+    struct poolFree *next;
+} poolFree;
+
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size;
+    size_t used;
+    poolHeader data[];
+} arenaChunk;
+
+struct rowArena {
+    arenaChunk *chunks;
+    int refs;           /* Owners of the arena. */
+};
+
+static poolFree *freelist[POOL_CLASSES];
+static char *slab_ptr, *slab_end;   /* Free space of the current slab. */
+static struct rowArena *cur_arena;  /* Arena used by rowAlloc(), if any. */
+static struct rowStats stats;
+
+static int poolClass(size_t size) {
+    int cls = 0;
+    while (((size_t)1 << (cls + POOL_MIN_SHIFT)) < size) {
+        cls++;
+        if (cls >= POOL_CLASSES)
+            return POOL_LARGE;
+    }
+    return cls;
+}
+
+static void *poolMalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    stats.reserved += size;
+    return p;
+}
+
+// Carve a block of 'size' bytes, header included, out of the current slab.
+static poolHeader *slabAlloc(size_t size) {
+    if (slab_end - slab_ptr < (ptrdiff_t)size) {
+        // The tail of the old slab is too small to be used, it is lost.
+        slab_ptr = poolMalloc(SLAB_SIZE);
+        slab_end = slab_ptr + SLAB_SIZE;
+    }
+    poolHeader *h = (poolHeader *)slab_ptr;
+    slab_ptr += size;
+    return h;
+}
+
+static poolHeader *arenaAlloc(struct rowArena *arena, size_t size) {
+    arenaChunk *c = arena->chunks;
+
+    // Keep every block aligned as the header.
+    size = (size + sizeof(poolHeader) - 1) / sizeof(poolHeader) * sizeof(poolHeader);
+    if (c == NULL || c->size - c->used < size) {
+        size_t csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        c = poolMalloc(sizeof(*c) + csize);
+        c->size = csize;
+        c->used = 0;
+        c->next = arena->chunks;
+        arena->chunks = c;
+    }
+    poolHeader *h = (poolHeader *)((char *)c->data + c->used);
+    c->used += size;
+    h->h.size = size - sizeof(poolHeader);
+    return h;
+}
+
+void *rowAlloc(size_t size) {
+    poolHeader *h;
+    int cls;
+
+    if (cur_arena) {
+        h = arenaAlloc(cur_arena, sizeof(*h) + size);
+        cls = POOL_ARENA;
+    } else if ((cls = poolClass(size)) == POOL_LARGE) {
+        h = poolMalloc(sizeof(*h) + size);
+        h->h.size = size;
+    } else {
+        size_t csize = (size_t)1 << (cls + POOL_MIN_SHIFT);
+        if (freelist[cls]) {
+            h = (poolHeader *)freelist[cls];
+            freelist[cls] = freelist[cls]->next;
+        } else if (cls + POOL_MIN_SHIFT <= POOL_SLAB_SHIFT) {
+            h = slabAlloc(sizeof(*h) + csize);
+        } else {
+            h = poolMalloc(sizeof(*h) + csize);
+        }
+        h->h.size = csize;
+    }
+    h->h.cls = cls;
+    h->h.refs = 0;
+    h->h.used = size;
+    stats.live += size;
+    stats.allocs++;
+    return h + 1;
+}
+
+void *rowRealloc(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return rowAlloc(size);
+
+    poolHeader *h = (poolHeader *)ptr - 1;
+    // The block is already large enough: grow or shrink in place, unless
+    // others see it.
+    if (size <= h->h.size && h->h.refs == 0) {
+        stats.live += size;
+        stats.live -= h->h.used;
+        h->h.used = size;
+        return ptr;
+    }
+
+    void *new = rowAlloc(size);
+    memcpy(new, ptr, h->h.used < size ? h->h.used : size);
+    rowFree(ptr);
+    return new;
+}
+
+// Add an owner to the block, that is freed once all of them freed it.
+// Returns the block, or a copy when it has too many owners.
+void *rowShare(void *ptr) {
+    if (ptr == NULL)
+        return NULL;
+
+    poolHeader *h = (poolHeader *)ptr - 1;
+    if (h->h.refs == UINT16_MAX) {
+        void *copy = rowAlloc(h->h.used);
+        memcpy(copy, ptr, h->h.used);
+        return copy;
+    }
+    h->h.refs++;
+    return ptr;
+}
+
+// Make the block safe to change in place: a shared block is copied, the
+// others keep it. Returns the block to use instead of 'ptr'.
+void *rowOwn(void *ptr) {
+    if (ptr == NULL || ((poolHeader *)ptr - 1)->h.refs == 0)
+        return ptr;
+
+    poolHeader *h = (poolHeader *)ptr - 1;
+    void *copy = rowAlloc(h->h.used);
+    memcpy(copy, ptr, h->h.used);
+    h->h.refs--;
+    return copy;
+}
+
+void rowFree(void *ptr) {
+    if (ptr == NULL)
+        return;
+
+    poolHeader *h = (poolHeader *)ptr - 1;
+    if (h->h.refs) {
+        h->h.refs--;
+        return;
+    }
+    stats.live -= h->h.used;
+    stats.frees++;
+    if (h->h.cls == POOL_LARGE) {
+        stats.reserved -= sizeof(*h) + h->h.size;
+        free(h);
+    } else if (h->h.cls != POOL_ARENA) {
+        // Blocks of the arena stay where they are until the arena is
+        // released, the others go back to the free list of their class.
+        int cls = h->h.cls;
+        poolFree *f = (poolFree *)h;
+        f->next = freelist[cls];
+        freelist[cls] = f;
+    }
+}
+
+struct rowArena *rowArenaNew(void) {
+    struct rowArena *arena = malloc(sizeof(*arena));
+    if (arena == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    arena->chunks = NULL;
+    arena->refs = 1;
+    return arena;
+}
+
+// Add an owner to the arena, it is released by the last rowArenaFree().
+struct rowArena *rowArenaRetain(struct rowArena *arena) {
+    if (arena)
+        arena->refs++;
+    return arena;
+}
+
+// Allocate the following rows from 'arena', or from the shared pool again
+// when NULL.
+void rowArenaUse(struct rowArena *arena) {
+    cur_arena = arena;
+}
+
+// Release all the memory of the arena at once, once its last owner is done
+// with it. The rows allocated from it must not be used anymore.
+void rowArenaFree(struct rowArena *arena) {
+    if (arena == NULL)
+        return;
+    if (cur_arena == arena)
+        cur_arena = NULL;
+    if (--arena->refs > 0)
+        return;
+    while (arena->chunks) {
+        arenaChunk *c = arena->chunks;
+        arena->chunks = c->next;
+        stats.reserved -= sizeof(*c) + c->size;
+        free(c);
+    }
+    free(arena);
+}
+
+void rowStatsGet(struct rowStats *st) {
+    *st = stats;
+    st->wasted = stats.reserved - stats.live;
+}
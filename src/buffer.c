@@ -0,0 +1,115 @@
+#include "chibidit.h"
+
+Ebuf *newBuffer(void) {
+    Ebuf *buf = malloc(sizeof(*buf));
+    if (buf == NULL) {
+        perror("Allocating buffer");
+        exit(1);
+    }
+    memset(buf, 0, sizeof(*buf));
+    return buf;
+}
+
+void freeBuffer(Ebuf *buf) {
+    unwatchFile(buf);
+    // The undo group may keep chars of the arena.
+    undoFree(buf);
+    for (int j = 0; j < buf->numrows; j++)
+        freeRow(&buf->row[j]);
+    free(buf->row);
+    rowArenaFree(buf->arena);
+    wrapFree(buf);
+    foldFree(buf);
+    motionFree(buf);
+    coldFree(buf);
+    pagerFree(buf);
+    free(buf->filename);
+    free(buf);
+}
+
+// Open 'filename' in a new buffer and make it the current one.
+int openBuffer(char *filename) {
+    Ebuf *buf = newBuffer();
+
+    EC.bufs = realloc(EC.bufs, sizeof(Ebuf *) * (EC.numbufs + 1));
+    EC.bufs[EC.numbufs++] = buf;
+    switchBuffer(EC.numbufs - 1);
+    if (filename == NULL)
+        return 0;
+    selectSyntaxHighlight(filename);
+    int err = editorOpen(filename);
+    watchFile(buf);
+    return err;
+}
+
+// Show the buffer at index 'idx' in the current view. Rows are left
+// untouched, only the cursor of the view is saved into the buffer we
+// are leaving and restored from the one we are entering.
+void switchBuffer(int idx) {
+    Eview *view = EC.view;
+
+    if (idx < 0 || idx >= EC.numbufs)
+        return;
+    if (view->buf) {
+        view->buf->cx = view->cx;
+        view->buf->cy = view->cy;
+        view->buf->row_offset = view->row_offset;
+        view->buf->col_offset = view->col_offset;
+    }
+    EC.curbuf = idx;
+    EC.buf = view->buf = EC.bufs[idx];
+    view->cx = EC.buf->cx;
+    view->cy = EC.buf->cy;
+    view->row_offset = EC.buf->row_offset;
+    view->col_offset = EC.buf->col_offset;
+    view->skip = 0;
+}
+
+void nextBuffer(int dir) {
+    if (EC.numbufs < 2)
+        return;
+    switchBuffer((EC.curbuf + dir + EC.numbufs) % EC.numbufs);
+    setStatusMsg("[%d/%d] %s", EC.curbuf + 1, EC.numbufs,
+            EC.buf->filename ? EC.buf->filename : "[No Name]");
+}
+
+int anyBufferDirty(void) {
+    for (int j = 0; j < EC.numbufs; j++)
+        if (EC.bufs[j]->dirty)
+            return 1;
+    return 0;
+}
+
+static void formatBytes(char *buf, size_t len, size_t bytes) {
+    if (bytes >= 1024 * 1024 * 1024)
+        snprintf(buf, len, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+    else if (bytes >= 1024 * 1024)
+        snprintf(buf, len, "%.1fM", bytes / (1024.0 * 1024));
+    else if (bytes >= 1024)
+        snprintf(buf, len, "%.1fK", bytes / 1024.0);
+    else
+        snprintf(buf, len, "%zu", bytes);
+}
+
+// Show the current file and the row allocator statistics. The allocation
+// rate is the one since the previous call.
+void showBufferInfo(void) {
+    static unsigned long long last_allocs;
+    static struct timespec last;
+    struct rowStats st;
+    struct timespec now;
+    char live[16], wasted[16];
+
+    rowStatsGet(&st);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+    double rate = elapsed > 0 ? (st.allocs - last_allocs) / elapsed : 0;
+    last_allocs = st.allocs;
+    last = now;
+
+    formatBytes(live, sizeof(live), st.live);
+    formatBytes(wasted, sizeof(wasted), st.wasted);
+    setStatusMsg("\"%.20s\" %d lines | rows: %s live, %s wasted, %.0f allocs/s",
+            EC.buf->filename ? EC.buf->filename : "[No Name]",
+            EC.buf->numrows, live, wasted, rate);
+}
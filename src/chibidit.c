@@ -2,34 +2,97 @@
 
 struct EditorConf EC;
 
-void initEditor(void) {
-    EC.cx = 0;
-    EC.cy = 0;
-    EC.row_offset = 0;
-    EC.col_offset = 0;
-    EC.numrows = 0;
-    EC.row = NULL;
-    EC.dirty = 0;
-    EC.filename = NULL;
+void initEditor(int headless) {
+    initViews();
+    EC.buf = NULL;
+    EC.bufs = NULL;
+    EC.numbufs = 0;
+    EC.curbuf = 0;
+    if (headless) {
+        // No terminal: the views keep some size, they are never drawn.
+        EC.screenrows = 24 - 1;
+        EC.screencols = 80;
+        layoutViews();
+        return;
+    }
     updateWindowSize();
     signal(SIGWINCH, handleSigWinCh);
 }
 
+static void usage(void) {
+    fprintf(stderr, "Usage: chibidit [-fRS] [-s script] [-t tracefile] "
+            "[file ... | -]\n");
+    exit(1);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: chibidit <filename>\n");
-        exit(1);
+    int opt, follow = 0, spill = 0, huge = 0;
+    char *script = NULL;
+
+    while ((opt = getopt(argc, argv, "fRs:St:")) != -1) {
+        switch (opt) {
+        case 'f': // Follow the files as they grow.
+            follow = 1;
+            break;
+        case 'R': // Show huge files read only.
+            huge = 1;
+            break;
+        case 's': // Run the commands of a script, without a terminal.
+            script = optarg;
+            break;
+        case 'S': // Spill the standard input to a temporary file.
+            spill = 1;
+            break;
+        case 't': // Dump the profile of every frame.
+            if (profTrace(optarg) == -1) {
+                perror("Opening trace file");
+                exit(1);
+            }
+            break;
+        default:
+            usage();
+        }
     }
 
-    initEditor();
-    selectSyntaxHighlight(argv[1]);
-    editorOpen(argv[1]);
+    // The file '-' is the standard input, the keys come from the terminal.
+    for (int j = optind; j < argc; j++) {
+        if (strcmp(argv[j], "-") == 0) {
+            if (script)
+                usage();
+            streamOpen(spill);
+            break;
+        }
+    }
+    // A script never draws, nor needs the highlight.
+    if (script)
+        EC.batch = 1;
+    initEditor(script != NULL);
+    if (optind == argc) {
+        openBuffer(NULL);
+    } else {
+        for (int j = optind; j < argc; j++) {
+            if (strcmp(argv[j], "-") == 0) {
+                streamBuffer();
+                continue;
+            }
+            if (huge) {
+                pagerOpen(argv[j]);
+                continue;
+            }
+            openBuffer(argv[j]);
+            if (follow)
+                followFile(EC.buf, 1);
+        }
+        switchBuffer(0);
+    }
+    if (script)
+        return runScript(script) ? 1 : 0;
     enableRawMode(STDIN_FILENO);
 
     while(1) {
         refreshScreen();
         processKeyPress(STDIN_FILENO);
     }
-    
+
     return 0;
 }
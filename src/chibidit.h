@@ -1,7 +1,9 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +12,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -29,6 +32,18 @@
 #define HL_NUMBER 7
 #define HL_MATCH 8       // Serch match.
 
+#define HL_OC_DEFERRED 2 // Open comment state of a row not highlighted yet.
+
+// Lexer state before a byte. It is stored for every byte of the row in the
+// gap buffer, so that its highlight can be resumed from anywhere.
+#define HLS_DQUOTE 1        /* Inside a "" string. */
+#define HLS_SQUOTE 2        /* Inside a '' string. */
+#define HLS_COMMENT 4       /* Inside a multi-line comment. */
+#define HLS_LINE_COMMENT 8  /* Inside a single line comment. */
+#define HLS_SEP 16          /* Previous byte is a separator. */
+#define HLS_NUMBER 32       /* Previous byte is part of a number. */
+#define HLS_NONE 0xff       /* Inside a token, can't resume from here. */
+
 #define HL_HIGHLIGHT_STRINGS (1<<0)
 #define HL_HIGHLIGHT_NUMBERS (1<<1)
 
@@ -58,25 +73,126 @@ typedef struct Erow {
     char *chars;        /* Row content. */
     char *render;       /* Row content "rendered" for screen (for TABs) */
     unsigned char *hl;  /* Syntax highlight type for each character in render. */
+    int *cols;          /* Screen column of each byte of chars, size + 1
+                           entries. NULL for ASCII rows without TABs, where
+                           the column is just the byte offset. */
+    int *rx;            /* Offset in render of each byte of chars. Shares
+                           the allocation of cols, and is the same array
+                           for ASCII rows. NULL when cols is NULL. */
     int hl_oc;          /* Row had open comment at end in last syntax highlight
                            check. */
+    struct rowGap *gap; /* Set while the row is edited in the gap buffer,
+                           chars, render, hl and cols are not valid then.
+                           See src/gap.c */
+    struct rowLong *lr; /* Set for rows longer than LONG_ROW_SIZE, that have
+                           no render, hl and cols. See src/long.c */
 } Erow;
 
-struct EditorConf {
-    int cx, cy;         /* Cursor x and y position in characters */
-    int row_offset;     /* Offset of row displayed */
-    int col_offset;     /* Offset of colunm displayed */
-    int screenrows;     /* Number of rows that we can show at display */
-    int screencols;     /* Number of columns that we can show at display */
+// A buffer owns the rows of one open file. Buffers are independent of the
+// views that display them, so switching the buffer shown in a view only
+// swaps pointers and keeps all the rendered and highlighted rows as is.
+typedef struct Ebuf {
     int numrows;        /* Number of rows */
-    int rawmode;        /* Is terminal raw mode enabled ? */
     Erow *row;
     int dirty;          /* File modified but not saved. */
     char *filename;     /* Currently open filename. */
+    struct editorSyntax *syntax;    /* Current syntax highlight, or NULL. */
+    int cx, cy;         /* Cursor saved when the buffer was hidden. */
+    int row_offset, col_offset;
+    struct rowArena *arena;     /* Memory of the rows loaded from file. */
+    struct wrapIndex *wrap;     /* Screen lines of the rows, for the views
+                                   in wrap mode. See src/wrap.c */
+    int rowcap;         /* Rows that 'row' can hold. */
+    off_t loaded;       /* Bytes of the file read into the rows, or
+                           written by the last save. */
+    struct timespec mtime;  /* Modification time of the file then. */
+    int partial;        /* The last row read had no newline. */
+    int follow;         /* Append what is written to the file ? See
+                           src/follow.c */
+    int wd;             /* inotify watch of the file, 0 if none. See
+                           src/watch.c */
+    int modified;       /* The watch reported a change. */
+    int changed;        /* The file changed on disk since read. */
+    int stream;         /* Rows read from the standard input ? See
+                           src/stream.c */
+    int window;         /* The rows are a window over a larger document,
+                           read only. */
+    long long above;    /* Lines of the document above the rows, */
+    long long below;    /* and below them, */
+    int counting;       /* that are still being counted. */
+    int above_oc;       /* The lines above end in an open comment. */
+    struct pager *pager;    /* Index of a huge file, see src/pager.c */
+    struct undoGroup *undo; /* Last change made at once, see src/undo.c */
+    struct folds *folds;    /* Folded rows, see src/fold.c */
+    struct bracketIndex *brackets;  /* Depths of the brackets, see
+                                       src/motion.c */
+    struct coldRows *cold;  /* Compressed rows of a huge file, see
+                               src/cold.c */
+} Ebuf;
+
+// Line numbers shown by a view: absolute, relative to the cursor line, or
+// both, the cursor line having then its absolute number.
+#define NUMBER_ABSOLUTE 1
+#define NUMBER_RELATIVE 2
+
+// A view is a window over a buffer with its own cursor and scroll offsets.
+// Several views may display the same buffer, in that case they share the
+// buffer rows, and so the rendered and highlighted content as well.
+typedef struct Eview {
+    Ebuf *buf;          /* Buffer displayed in this view. */
+    int cx;             /* Cursor offset in the chars of the row */
+    int cy;             /* Cursor row in the view */
+    int row_offset;     /* Offset of row displayed */
+    int col_offset;     /* First screen column displayed */
+    int wrap;           /* Are the rows wrapped instead of scrolled ? */
+    int skip;           /* Lines of the first row above the view, when
+                           wrapping. */
+    int number;         /* Line numbers shown, see NUMBER_*. */
+    int gutter;         /* Columns of the line numbers, just before the
+                           column 'left'. */
+    int top, left;      /* Screen position of the view, zero-based. */
+    int screenrows;     /* Number of rows that we can show in the view */
+    int screencols;     /* Number of columns that we can show in the view */
+} Eview;
+
+// Views are arranged on the screen by a binary tree of splits. Leaves
+// hold a view, inner nodes split their area between the two children,
+// either stacked (HSPLIT) or side by side (VSPLIT).
+#define LAYOUT_VIEW 0
+#define LAYOUT_HSPLIT 1
+#define LAYOUT_VSPLIT 2
+
+typedef struct Elayout {
+    int type;
+    struct Elayout *parent;
+    struct Elayout *child[2];
+    Eview *view;        /* Only for LAYOUT_VIEW nodes. */
+    int top, left;      /* Screen area covered by this node. */
+    int rows, cols;
+} Elayout;
+
+struct EditorConf {
+    Ebuf *buf;          /* Current buffer, always equal to view->buf. */
+    Eview *view;        /* Current view. */
+    Ebuf **bufs;        /* All the open buffers. */
+    int numbufs;        /* Number of open buffers. */
+    int curbuf;         /* Index of the current buffer in bufs. */
+    Elayout *layout;    /* Root of the views layout tree. */
+    int screenrows;     /* Number of rows available for the views */
+    int screencols;     /* Number of columns available for the views */
+    int rawmode;        /* Is terminal raw mode enabled ? */
     char statusmsg[80];
     time_t statusmsg_time;
-    struct editorSyntax *syntax;    /* Current syntax highlight, or NULL. */
     int mode;           /* Editor Mode, Normal/Insert/Visualize */
+    int vrow, vcol;     /* Anchor of the visual selection, row and chars
+                           offset. See src/visual.c */
+    void (*screen_sink)(const char *s, int len);   /* Where refreshScreen()
+                                                      output goes instead of
+                                                      stdout, if not NULL. */
+    int profiling;      /* Are the hot paths timed ? See src/prof.c */
+    int batch;          /* Replaying keys or running a script: the screen
+                           is not refreshed and the highlight is deferred.
+                           See src/macro.c and runScript(). */
 };
 
 extern struct EditorConf EC;
@@ -84,6 +200,10 @@ extern struct EditorConf EC;
 enum EDITOR_MODO {
     NORMAL,
     INSERT,
+    PROMPT,     /* Reading a line on the status bar, keys are not remapped. */
+    VISUAL,         /* Selecting characters, */
+    VISUAL_LINE,    /* whole lines, */
+    VISUAL_BLOCK,   /* or a block of columns. */
 };
 
 // -------------------------------------------------------------
@@ -94,13 +214,20 @@ enum KEY_ACTIONS {
     CTRL_C = 3,         /* Ctrl-c */
     CTRL_D = 4,         /* Ctrl-d */
     CTRL_F = 6,         /* Ctrl-f */
+    CTRL_G = 7,         /* Ctrl-g */
     CTRL_H = 8,         /* Ctrl-h */
     TAB = 9,            /* Tab */
     CTRL_L = 12,        /* Ctrl+l */
     ENTER = 13,         /* Enter */
+    CTRL_N = 14,        /* Ctrl-n */
+    CTRL_P = 16,        /* Ctrl-p */
     CTRL_Q = 17,        /* Ctrl-q */
+    CTRL_R = 18,        /* Ctrl-r */
     CTRL_S = 19,        /* Ctrl-s */
+    CTRL_T = 20,        /* Ctrl-t */
     CTRL_U = 21,        /* Ctrl-u */
+    CTRL_V = 22,        /* Ctrl-v */
+    CTRL_W = 23,        /* Ctrl-w */
     ESC = 27,           /* Escape */
     BACKSPACE =  127,   /* Backspace */
 
@@ -135,11 +262,63 @@ struct abuf {
 };
 
 
+//
+// src/alloc.c
+//
+struct rowStats {
+    size_t live;        /* Bytes in use by rows. */
+    size_t reserved;    /* Bytes obtained from the system. */
+    size_t wasted;      /* Reserved but not in use: headers, slack, free. */
+    unsigned long long allocs, frees;
+};
+
+void *rowAlloc(size_t size);
+void *rowRealloc(void *ptr, size_t size);
+void rowFree(void *ptr);
+void *rowShare(void *ptr);
+void *rowOwn(void *ptr);
+struct rowArena *rowArenaNew(void);
+struct rowArena *rowArenaRetain(struct rowArena *arena);
+void rowArenaUse(struct rowArena *arena);
+void rowArenaFree(struct rowArena *arena);
+void rowStatsGet(struct rowStats *st);
+
+//
+// src/buffer.c
+//
+Ebuf *newBuffer(void);
+void freeBuffer(Ebuf *buf);
+int openBuffer(char *filename);
+void switchBuffer(int idx);
+void nextBuffer(int dir);
+int anyBufferDirty(void);
+void showBufferInfo(void);
+
+//
+// src/window.c
+//
+void initViews(void);
+void layoutViews(void);
+void updateGutters(void);
+void splitView(int type);
+void closeView(void);
+void nextView(void);
+void scrollCursor(Eview *view);
+void clampCursor(Eview *view);
+void gotoRow(Eview *view, int at);
+void gotoLine(Eview *view, long long at);
+void shiftViews(Ebuf *buf, int delta);
+void scrollRows(Eview *view, int rows, int top);
+
 //
 // src/edit.c
 //
 void updateRow(Erow *row);
+void updateRows(int *rows, int n);
+void rowRestore(Erow *row);
 void rowDelChar(Erow *row, int at);
+void rowInit(Erow *row, int idx, const char *s, size_t len);
+void rowInitChars(Erow *row, int idx, char *chars, int size);
 void insertRow(int at, char *s, size_t len);
 void rowInsertChar(Erow *row, int at, int c);
 void insertNewLine(void);
@@ -147,9 +326,19 @@ void delAtChar(void);
 void delChar(void);
 void rowAppendString(Erow *row, char *s, size_t len);
 void freeRow(Erow *row);
+void spliceRows(int at, int n, Erow *rows, int m);
+int insertLines(int at, const char *s, size_t len);
+void delRows(int at, int n);
 void delRow(int at);
-char *rowsToString(int *buflen);
+char *rowsToString(size_t *buflen);
 void insertChar(int c);
+int rowCol(Erow *row, int at);
+int rowRender(Erow *row, int at);
+int rowOffsetAtCol(Erow *row, int col);
+int rowNextChar(Erow *row, int at);
+int rowPrevChar(Erow *row, int at);
+int rowByte(Erow *row, int at);
+int rowDecode(Erow *row, int at, int *cp);
 
 //
 // src/events.c
@@ -172,6 +361,7 @@ void abFree(struct abuf *ab);
 //
 int editorOpen(char *filename);
 int save(void);
+int saveAs(char *filename);
 void atExit(void);
 int readKey(int fd);
 int enableRawMode(int fd);
@@ -179,9 +369,244 @@ void disableRawMode(int fd);
 int getCursorPosition(int ifd, int ofd, int *rows, int *cols);
 int getWindowSize(int ifd, int ofd, int *rows, int *cols);
 
+//
+// src/gap.c
+//
+void rowGapInsert(Erow *row, int at, const char *s, int len);
+void rowGapDelete(Erow *row, int at, int len);
+void rowGapFree(Erow *row);
+void rowGapHighlight(Erow *row);
+int rowGapOpenComment(Erow *row);
+int rowGapByte(Erow *row, int at);
+int rowGapHl(Erow *row, int at);
+int rowGapCol(Erow *row, int at);
+int rowGapDecode(Erow *row, int at, int *cp);
+void rowCommit(void);
+void rowCommitIfLeft(void);
+
+//
+// src/long.c
+//
+#define LONG_ROW_SIZE (256 * 1024)  /* Longer rows are rendered lazily. */
+
+void rowLongUpdate(Erow *row);
+void rowLongFree(Erow *row);
+int rowLongCol(Erow *row, int at);
+int rowLongOffsetAtCol(Erow *row, int col);
+unsigned char *rowLongHighlight(Ebuf *buf, Erow *row, int from, int to);
+int rowLongOpenComment(Erow *row);
+void rowLongInsert(Erow *row, int at, const char *s, int len);
+void rowLongDelete(Erow *row, int at, int len);
+
+//
+// src/wrap.c
+//
+int wrapHeight(Eview *view, Erow *row);
+int wrapLine(Eview *view, int at);
+void wrapRowChanged(Erow *row);
+void wrapRowsChanged(Ebuf *buf, int at, int n, int m);
+void wrapFree(Ebuf *buf);
+void wrapCursor(Eview *view, int *y, int *x);
+void wrapScroll(Eview *view);
+void wrapPage(Eview *view, int lines);
+void wrapToggle(void);
+
+//
+// src/fold.c
+//
+int foldActive(Eview *view);
+int foldLine(Eview *view, int at);
+int foldRow(Eview *view, int line);
+int foldShut(Eview *view, int at);
+void foldScroll(Eview *view);
+void foldReveal(Ebuf *buf, int at);
+void foldRowsChanged(Ebuf *buf, int at, int n, int m);
+void foldFree(Ebuf *buf);
+int foldCreate(int from, int to);
+void foldCommand(int key, long long count);
+
+//
+// src/motion.c
+//
+int bracketFind(Ebuf *buf, int c, int *row, int *at, int limit);
+void motionRowChanged(Erow *row);
+void motionRowsChanged(Ebuf *buf, int at);
+void motionFree(Ebuf *buf);
+void motionFind(int key, int c, long long count);
+void motionCommand(int key, long long count);
+
+//
+// src/cold.c
+//
+struct coldStats {
+    size_t raw;         /* Bytes of the rows frozen in blocks, */
+    size_t zipped;      /* compressed. */
+    size_t hot;         /* Bytes of the blocks thawed. */
+    unsigned long long hits, misses;    /* Blocks found thawed or not. */
+};
+
+void coldEnable(Ebuf *buf, off_t size);
+Erow *rowAt(Ebuf *buf, int at);
+void coldThaw(Ebuf *buf, int from, int to);
+void coldView(Eview *view);
+const char *coldPeek(Ebuf *buf, int at);
+void coldRowChanged(Erow *row);
+void coldRowsChanged(Ebuf *buf, int at, int n, int m);
+void coldLoaded(Ebuf *buf);
+void coldPoll(void);
+void coldFree(Ebuf *buf);
+void coldStatsGet(struct coldStats *st);
+
+//
+// src/follow.c
+//
+void followAppend(Ebuf *buf, char *s, int len);
+int followUpdate(Ebuf *buf);
+void followFile(Ebuf *buf, int on);
+void followToggle(void);
+
+//
+// src/watch.c
+//
+void watchFile(Ebuf *buf);
+void unwatchFile(Ebuf *buf);
+void watchStat(Ebuf *buf, struct stat *st);
+int watchPoll(void);
+
+//
+// src/stream.c
+//
+void streamOpen(int spill);
+void streamBuffer(void);
+void streamScroll(void);
+void streamPoll(int fd);
+
+//
+// src/pager.c
+//
+void pagerOpen(char *filename);
+void pagerFree(Ebuf *buf);
+void pagerLoad(Ebuf *buf, long long line);
+void pagerScroll(void);
+long long pagerLines(Ebuf *buf);
+long long pagerFind(Ebuf *buf, const char *query, int dir);
+void pagerPoll(int fd);
+
+//
+// src/reload.c
+//
+int reloadBuffer(Ebuf *buf);
+uint64_t hashBytes(const char *s, int len);
+
+//
+// src/find.c
+//
+void find(int fd);
+
+//
+// src/command.c
+//
+int runCommand(char *cmd);
+int runScript(const char *path);
+void command(int fd);
+
+//
+// src/replace.c
+//
+long long replace(int from, int to, const char *pat, const char *rep, int global);
+
+//
+// src/undo.c
+//
+void undoFree(Ebuf *buf);
+void undoBegin(void);
+void undoSave(int at, int n, int m, Erow *old);
+void undoEnd(void);
+int undo(int redo);
+
+//
+// src/visual.c
+//
+void visualMode(int mode);
+void visualBounds(int *r0, int *c0, int *r1, int *c1);
+int visualColumns(Eview *view, int filerow, int *from, int *to);
+void yank(int name, int type, int r0, int c0, int r1, int c1, int del);
+void put(int name, int before);
+
+//
+// src/lines.c
+//
+#define SORT_REVERSE 1   /* Sort in the reverse order, */
+#define SORT_NUMERIC 2   /* by the first number, */
+#define SORT_UNIQUE 4    /* and drop the rows with the same key. */
+
+int filterRows(int from, int to, const char *keep);
+int matchRows(int from, int to, const char *pat, int invert, char *match);
+int sortRows(int from, int to, int flags, int field, int column);
+int uniqRows(int from, int to);
+
+//
+// src/macro.c
+//
+void macroRecord(int name);
+int macroRecording(void);
+void macroKey(int key);
+int macroNextKey(int *key);
+void macroReplay(int fd, int name, long long count);
+
+//
+// src/pool.c
+//
+int poolThreads(void);
+void poolRun(int ntasks, void (*fn)(void *arg, int task), void *arg);
+
+//
+// src/prof.c
+//
+enum PROF_SECTIONS {
+    PROF_INPUT,         /* Decoding a key in readKey(). */
+    PROF_HIGHLIGHT,     /* Syntax highlight of the rows. */
+    PROF_RENDER,        /* Building the screen in refreshScreen(). */
+    PROF_WRITE,         /* Writing it to the terminal. */
+    PROF_SECTIONS
+};
+
+enum PROF_COUNTERS {
+    PROF_ROWS,          /* Rows highlighted. */
+    PROF_BYTES,         /* Bytes written to the terminal. */
+    PROF_COUNTERS
+};
+
+// Probes for the hot paths, they do nothing but a test when not profiling.
+#define PROF_START(t) double t = EC.profiling ? profNow() : 0
+#define PROF_STOP(sec, t) do { if (EC.profiling) profAdd(sec, t); } while (0)
+#define PROF_COUNT(cnt, n) do { if (EC.profiling) profCount(cnt, n); } while (0)
+
+double profNow(void);
+void profAdd(int sec, double start);
+void profCount(int cnt, unsigned long n);
+void profFrameEnd(void);
+void profToggleOverlay(void);
+int profTrace(char *filename);
+int profOverlay(char *buf, int len);
+
+//
+// src/utf8.c
+//
+int utf8Width(int cp);
+int utf8Decode(const char *s, int len, int *cp);
+
 //
 // src/syntax.c
 //
+int highlightSpan(struct editorSyntax *syntax, const char *s, int i, int len,
+        unsigned char *hl, unsigned char *st, int state, int converge);
+int rowHasOpenComment(Erow *row);
+int rowIsCode(Erow *row, int at);
+int lineOpenComment(struct editorSyntax *syntax, const char *s, int len,
+        int oc);
+void highlightRow(Erow *row);
 void updateSyntaxHighLight(Erow *row);
+void syntaxFlush(void);
 int syntaxToColor(int hl);
 void selectSyntaxHighlight(char *filename);
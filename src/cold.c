@@ -0,0 +1,644 @@
+#include "chibidit.h"
+
+/* ============================== Cold rows ==============================
+ *
+ * Most of the rows of a huge file are loaded once and never looked at
+ * again. The rows of the buffers of files of at least COLD_MIN_SIZE bytes
+ * that are far from every view and from the last edit are frozen: their
+ * chars are compressed by blocks of consecutive rows, and their chars,
+ * render, hl and cols freed. A frozen row keeps its size and its open
+ * comment state, that the highlight of the row after it needs, and has a
+ * NULL chars without being in the gap buffer.
+ *
+ * Rows are frozen while the file is loaded, and then by coldPoll() when
+ * waiting for keys, a few blocks at a time. The code that reads rows that
+ * may be far from the views gets them with rowAt(), that thaws the block
+ * of the row: its chars are decompressed, and rendered and highlighted
+ * again. A thawed block keeps its compressed copy, so that it is frozen
+ * again for free once it is the least recently used and the thawed blocks
+ * take more than COLD_CACHE bytes. Changing a row dissolves its block for
+ * good, inserting or deleting rows dissolves the block they split and
+ * moves the blocks after them.
+ *
+ * Search and save read the frozen rows with coldPeek() instead, that
+ * decompresses their block in a scratch buffer without thawing it.
+ *
+ * The compression is LZ4 like, but simpler: every sequence is a token with
+ * the number of literals in the high nibble and the length of the match,
+ * minus 4, in the low one, each followed by more length bytes if 15, the
+ * literals, and the offset of the match on two bytes. The last sequence
+ * has only literals. */
+
+#define COLD_MIN_SIZE (64 * 1024 * 1024)   /* Smaller files stay hot. */
+#define COLD_BLOCK_SIZE (64 * 1024)         /* Bytes of the rows of a block, */
+#define COLD_BLOCK_ROWS 1024                /* and rows, at most. */
+#define COLD_MARGIN 1000        /* Rows kept hot around views and edits. */
+#define COLD_CACHE (32 * 1024 * 1024)       /* Bytes of the blocks thawed. */
+#define COLD_POLL_SIZE (4 * 1024 * 1024)    /* Bytes frozen by a poll. */
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      /* The input always ends with literals. */
+#define LZ_MAX_OFFSET 65535
+
+struct coldBlock {
+    int first;          /* First row of the block. */
+    int numrows;
+    size_t size;        /* Bytes of the chars, with a null term for each
+                           row. */
+    size_t zsize;       /* Bytes of the compressed data. */
+    char *data;
+    int hot;            /* Are the rows thawed ? */
+    struct coldBlock *prev, *next;  /* Thawed blocks of all the buffers,
+                                       most recently used first. */
+    Ebuf *buf;
+};
+
+struct coldRows {
+    struct coldBlock **blocks;  /* Sorted by first row. */
+    int numblocks, cap;
+    int scan;           /* Row where the next poll starts. */
+    int idle;           /* Did the last poll freeze nothing ? */
+    int last;           /* Row changed last, -1 if none. */
+    int loaded;         /* First row loaded not frozen yet, */
+    size_t pending;     /* and bytes of the rows after it. */
+};
+
+static struct coldBlock *lru_head, *lru_tail;
+static struct coldStats stats;
+
+// A block decompressed to read its rows, and the offsets of the rows.
+static struct {
+    struct coldBlock *block;
+    char *data;
+    size_t cap;
+    int *offs;
+    int offcap;
+} peek;
+
+static char *raw, *zip;         /* Scratch to compress a block. */
+static size_t rawcap, zipcap;
+
+/* ---------------------------- Compression ---------------------------- */
+
+static size_t lzBound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static uint32_t lzRead32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned char *lzLength(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+// Write a sequence of 'litlen' literals and a match of 'mlen' bytes at
+// 'off' bytes back, no match if 'mlen' is 0.
+static unsigned char *lzSequence(unsigned char *op, const unsigned char *lit,
+        size_t litlen, size_t off, size_t mlen) {
+    unsigned char *token = op++;
+
+    *token = (litlen < 15 ? litlen : 15) << 4;
+    if (litlen >= 15)
+        op = lzLength(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (mlen == 0)
+        return op;
+    *op++ = off & 0xff;
+    *op++ = off >> 8;
+    mlen -= LZ_MIN_MATCH;
+    *token |= mlen < 15 ? mlen : 15;
+    if (mlen >= 15)
+        op = lzLength(op, mlen - 15);
+    return op;
+}
+
+// Compress the 'n' bytes of 'src' in 'dst', of lzBound(n) bytes at least.
+// Returns the compressed size.
+static size_t lzCompress(const char *src, size_t n, char *dst) {
+    static uint32_t table[1 << LZ_HASH_BITS];
+    const unsigned char *base = (const unsigned char *)src, *ip = base;
+    const unsigned char *anchor = base, *end = base + n;
+    unsigned char *op = (unsigned char *)dst;
+
+    memset(table, 0, sizeof(table));
+    if (n >= LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+        // Matches end before the last literals.
+        const unsigned char *limit = end - LZ_LAST_LITERALS;
+
+        while (ip + LZ_MIN_MATCH <= limit) {
+            uint32_t v = lzRead32(ip);
+            uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+            const unsigned char *ref = base + table[h];
+
+            table[h] = ip - base;
+            if (ref < ip && ip - ref <= LZ_MAX_OFFSET && lzRead32(ref) == v) {
+                size_t len = LZ_MIN_MATCH;
+                while (ip + len < limit && ip[len] == ref[len])
+                    len++;
+                op = lzSequence(op, anchor, ip - anchor, ip - ref, len);
+                ip += len;
+                anchor = ip;
+            } else {
+                ip++;
+            }
+        }
+    }
+    op = lzSequence(op, anchor, end - anchor, 0, 0);
+    return op - (unsigned char *)dst;
+}
+
+// Decompress the 'n' bytes of 'src', made by lzCompress(), in 'dst'.
+static void lzDecompress(const char *src, size_t n, char *dst) {
+    const unsigned char *ip = (const unsigned char *)src, *end = ip + n;
+    unsigned char *op = (unsigned char *)dst;
+
+    while (ip < end) {
+        int token = *ip++;
+        size_t len = token >> 4, off;
+
+        if (len == 15)
+            do len += *ip; while (*ip++ == 255);
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip >= end)
+            break;
+
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        len = token & 15;
+        if (len == 15)
+            do len += *ip; while (*ip++ == 255);
+        len += LZ_MIN_MATCH;
+        if (off >= len) {
+            memcpy(op, op - off, len);
+            op += len;
+        } else {
+            // The match overlaps the bytes it writes.
+            for (const unsigned char *ref = op - off; len--; )
+                *op++ = *ref++;
+        }
+    }
+}
+
+/* ------------------------------- Blocks ------------------------------ */
+
+static void *grow(void *p, size_t *cap, size_t size) {
+    if (size <= *cap)
+        return p;
+    *cap = size * 2;
+    if ((p = realloc(p, *cap)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+// Index of the first block of 'c' that ends after the row 'at'.
+static int blockSearch(struct coldRows *c, int at) {
+    int lo = 0, hi = c->numblocks;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (c->blocks[mid]->first + c->blocks[mid]->numrows <= at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void lruUnlink(struct coldBlock *b) {
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        lru_head = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    else
+        lru_tail = b->prev;
+    b->prev = b->next = NULL;
+}
+
+static void lruPush(struct coldBlock *b) {
+    b->prev = NULL;
+    b->next = lru_head;
+    if (lru_head)
+        lru_head->prev = b;
+    else
+        lru_tail = b;
+    lru_head = b;
+}
+
+// Can the row be frozen ? Rows in the gap buffer, long rows and rows whose
+// highlight is deferred must stay as they are.
+static int frozenOk(Erow *row) {
+    return row->chars && row->gap == NULL && row->lr == NULL &&
+        row->hl_oc != HL_OC_DEFERRED;
+}
+
+// Decompress the block in the peek scratch.
+static void unpack(struct coldBlock *b) {
+    int off = 0;
+
+    if (peek.block == b)
+        return;
+    peek.data = grow(peek.data, &peek.cap, b->size);
+    if (b->numrows > peek.offcap) {
+        peek.offcap = b->numrows;
+        peek.offs = realloc(peek.offs, sizeof(int) * peek.offcap);
+        if (peek.offs == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    lzDecompress(b->data, b->zsize, peek.data);
+    for (int j = 0; j < b->numrows; j++) {
+        peek.offs[j] = off;
+        off += b->buf->row[b->first + j].size + 1;
+    }
+    peek.block = b;
+}
+
+// Free the chars and all that derives from them of the rows of the block.
+static void chill(struct coldBlock *b) {
+    for (int j = 0; j < b->numrows; j++) {
+        Erow *row = &b->buf->row[b->first + j];
+        rowFree(row->chars);
+        rowFree(row->render);
+        rowFree(row->hl);
+        rowFree(row->cols);
+        row->chars = row->render = NULL;
+        row->hl = NULL;
+        row->cols = row->rx = NULL;
+        row->rsize = 0;
+    }
+    if (b->hot) {
+        b->hot = 0;
+        stats.hot -= b->size;
+        lruUnlink(b);
+    }
+}
+
+// Restore the rows of a frozen block, and put it first in the LRU.
+static void thaw(struct coldBlock *b) {
+    Ebuf *cur = EC.buf;
+
+    unpack(b);
+    // Highlighting a row looks at the buffer of the row.
+    EC.buf = b->buf;
+    for (int j = 0; j < b->numrows; j++) {
+        Erow *row = &b->buf->row[b->first + j];
+        row->chars = rowAlloc(row->size + 1);
+        memcpy(row->chars, peek.data + peek.offs[j], row->size + 1);
+        rowRestore(row);
+    }
+    EC.buf = cur;
+    b->hot = 1;
+    stats.hot += b->size;
+    lruPush(b);
+}
+
+// Freeze the rows 'from' to 'to' (excluded) of 'buf' in a new block.
+static void freeze(Ebuf *buf, int from, int to) {
+    struct coldRows *c = buf->cold;
+    struct coldBlock *b;
+    size_t size = 0;
+    int k;
+
+    for (int j = from; j < to; j++)
+        size += buf->row[j].size + 1;
+    raw = grow(raw, &rawcap, size);
+    zip = grow(zip, &zipcap, lzBound(size));
+    size = 0;
+    for (int j = from; j < to; j++) {
+        memcpy(raw + size, buf->row[j].chars, buf->row[j].size);
+        size += buf->row[j].size;
+        raw[size++] = '\0';
+    }
+
+    if ((b = calloc(1, sizeof(*b))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    b->first = from;
+    b->numrows = to - from;
+    b->size = size;
+    b->zsize = lzCompress(raw, size, zip);
+    b->buf = buf;
+    if ((b->data = malloc(b->zsize)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memcpy(b->data, zip, b->zsize);
+    chill(b);
+
+    if (c->numblocks == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 64;
+        c->blocks = realloc(c->blocks, sizeof(*c->blocks) * c->cap);
+        if (c->blocks == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    k = blockSearch(c, from);
+    memmove(c->blocks + k + 1, c->blocks + k, sizeof(*c->blocks) * (c->numblocks - k));
+    c->blocks[k] = b;
+    c->numblocks++;
+    stats.raw += b->size;
+    stats.zipped += b->zsize;
+}
+
+// Remove the block 'k' of 'buf', the rows of a frozen one stay frozen.
+static void drop(Ebuf *buf, int k) {
+    struct coldRows *c = buf->cold;
+    struct coldBlock *b = c->blocks[k];
+
+    if (b->hot) {
+        lruUnlink(b);
+        stats.hot -= b->size;
+    }
+    if (peek.block == b)
+        peek.block = NULL;
+    stats.raw -= b->size;
+    stats.zipped -= b->zsize;
+    free(b->data);
+    free(b);
+    memmove(c->blocks + k, c->blocks + k + 1,
+            sizeof(*c->blocks) * (c->numblocks - k - 1));
+    c->numblocks--;
+    c->idle = 0;
+}
+
+// Remove the block 'k' of 'buf', its rows are thawed for good.
+static void dissolve(Ebuf *buf, int k) {
+    if (!buf->cold->blocks[k]->hot)
+        thaw(buf->cold->blocks[k]);
+    drop(buf, k);
+}
+
+// Are the rows 'from' to 'to' (excluded) of 'buf' near a view of it, or is
+// it wrapped in one ? The wrap index needs the columns of all the rows.
+static int nearView(Elayout *node, Ebuf *buf, int from, int to) {
+    if (node->type != LAYOUT_VIEW)
+        return nearView(node->child[0], buf, from, to) ||
+            nearView(node->child[1], buf, from, to);
+    Eview *view = node->view;
+    if (view->buf != buf)
+        return 0;
+    return view->wrap || (from < view->row_offset + view->screenrows + COLD_MARGIN &&
+            to > view->row_offset - COLD_MARGIN);
+}
+
+// Must the rows 'from' to 'to' (excluded) of 'buf' stay hot ? The rows near
+// the views, the last edit, and where a hidden buffer is shown again.
+static int keepHot(Ebuf *buf, int from, int to) {
+    struct coldRows *c = buf->cold;
+
+    if (c->last != -1 && from < c->last + COLD_MARGIN && to > c->last - COLD_MARGIN)
+        return 1;
+    if (from < buf->row_offset + EC.screenrows + COLD_MARGIN &&
+            to > buf->row_offset - COLD_MARGIN)
+        return 1;
+    return nearView(EC.layout, buf, from, to);
+}
+
+/* ------------------------------- API --------------------------------- */
+
+// Keep the cold rows of 'buf' compressed, see the top of this file. Only
+// the files of COLD_MIN_SIZE bytes at least are worth it.
+void coldEnable(Ebuf *buf, off_t size) {
+    if (buf->cold || size < COLD_MIN_SIZE || buf->window || buf->stream)
+        return;
+    if ((buf->cold = calloc(1, sizeof(*buf->cold))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    buf->cold->last = -1;
+    buf->cold->loaded = COLD_MARGIN;
+}
+
+// The row 'at' of 'buf', thawed if frozen.
+Erow *rowAt(Ebuf *buf, int at) {
+    Erow *row = &buf->row[at];
+
+    if (buf->cold && row->chars == NULL && row->gap == NULL)
+        coldThaw(buf, at, at + 1);
+    return row;
+}
+
+// Thaw the rows 'from' to 'to' (excluded) of 'buf'.
+void coldThaw(Ebuf *buf, int from, int to) {
+    struct coldRows *c = buf->cold;
+
+    if (c == NULL)
+        return;
+    for (int k = blockSearch(c, from);
+            k < c->numblocks && c->blocks[k]->first < to; k++) {
+        struct coldBlock *b = c->blocks[k];
+        if (b->hot) {
+            stats.hits++;
+            lruUnlink(b);
+            lruPush(b);
+        } else {
+            stats.misses++;
+            thaw(b);
+        }
+    }
+}
+
+// Thaw the rows shown in the view, and the ones around them that moving
+// the cursor by one reaches.
+void coldView(Eview *view) {
+    if (view->buf == NULL || view->buf->cold == NULL)
+        return;
+    view->buf->cold->idle = 0;
+    coldThaw(view->buf, view->row_offset - 1, view->row_offset + view->screenrows + 1);
+}
+
+// The NULL terminated chars of the row 'at' of 'buf', read from its block
+// if it is frozen. They are valid until the next call.
+const char *coldPeek(Ebuf *buf, int at) {
+    Erow *row = &buf->row[at];
+    struct coldRows *c = buf->cold;
+    struct coldBlock *b;
+
+    if (c == NULL || row->chars || row->gap)
+        return row->chars;
+    b = c->blocks[blockSearch(c, at)];
+    unpack(b);
+    return peek.data + peek.offs[at - b->first];
+}
+
+// The chars of the row of the current buffer changed, its block is stale.
+void coldRowChanged(Erow *row) {
+    struct coldRows *c = EC.buf->cold;
+    int k;
+
+    if (c == NULL)
+        return;
+    c->last = row->idx;
+    c->idle = 0;
+    k = blockSearch(c, row->idx);
+    if (k < c->numblocks && c->blocks[k]->first <= row->idx)
+        dissolve(EC.buf, k);
+}
+
+// The 'n' rows from 'at' of 'buf' are about to be replaced by 'm' rows:
+// the blocks of the rows replaced, or split if none, are dissolved and the
+// ones after them moved. The rows replaced that are still frozen are not
+// needed, their blocks are just dropped.
+void coldRowsChanged(Ebuf *buf, int at, int n, int m) {
+    struct coldRows *c = buf->cold;
+    int k;
+
+    if (c == NULL)
+        return;
+    c->last = at;
+    c->idle = 0;
+    k = blockSearch(c, at);
+    while (k < c->numblocks && c->blocks[k]->first < at + n) {
+        struct coldBlock *b = c->blocks[k];
+        if (!b->hot && b->first >= at && b->first + b->numrows <= at + n)
+            drop(buf, k);
+        else
+            dissolve(buf, k);
+    }
+    for (; k < c->numblocks; k++)
+        c->blocks[k]->first += m - n;
+}
+
+// A row was appended to 'buf' while loading it: the rows loaded are frozen
+// as soon as they fill a block, but the first ones.
+void coldLoaded(Ebuf *buf) {
+    struct coldRows *c = buf->cold;
+    Erow *row;
+
+    if (c == NULL)
+        return;
+    // Loading is not editing.
+    c->last = -1;
+    if (buf->numrows <= c->loaded)
+        return;
+    row = &buf->row[buf->numrows - 1];
+    if (!frozenOk(row)) {
+        if (c->loaded < buf->numrows - 1)
+            freeze(buf, c->loaded, buf->numrows - 1);
+        c->loaded = buf->numrows;
+        c->pending = 0;
+        return;
+    }
+    c->pending += row->size + 1;
+    if (buf->numrows - c->loaded >= COLD_BLOCK_ROWS || c->pending >= COLD_BLOCK_SIZE) {
+        freeze(buf, c->loaded, buf->numrows);
+        c->loaded = buf->numrows;
+        c->pending = 0;
+    }
+}
+
+// Freeze the rows of 'buf' that can be from the row where the last poll
+// stopped, around the buffer at most once, and up to 'budget' bytes.
+// Returns the bytes frozen.
+static size_t coldScan(Ebuf *buf, size_t budget) {
+    struct coldRows *c = buf->cold;
+    size_t done = 0;
+    int r = c->scan, seen = 0, frozen = 0;
+
+    while (seen < buf->numrows && done < budget) {
+        int k, end, to;
+        size_t size = 0;
+
+        if (r >= buf->numrows)
+            r = 0;
+        k = blockSearch(c, r);
+        if (k < c->numblocks && c->blocks[k]->first <= r) {
+            // Skip the rows already in a block.
+            int next = c->blocks[k]->first + c->blocks[k]->numrows;
+            seen += next - r;
+            r = next;
+            continue;
+        }
+        end = k < c->numblocks ? c->blocks[k]->first : buf->numrows;
+        for (to = r; to < end && to - r < COLD_BLOCK_ROWS && size < COLD_BLOCK_SIZE &&
+                frozenOk(&buf->row[to]) && !keepHot(buf, to, to + 1); to++)
+            size += buf->row[to].size + 1;
+        if (to == r) {
+            seen++;
+            r++;
+            continue;
+        }
+        freeze(buf, r, to);
+        frozen = 1;
+        seen += to - r;
+        done += size;
+        r = to;
+    }
+    c->scan = r;
+    c->idle = !frozen && seen >= buf->numrows;
+    return done;
+}
+
+// Called while waiting for keys: thawed blocks are frozen again, the least
+// recently used first, until they fit COLD_CACHE, then more rows of the
+// buffers are frozen, COLD_POLL_SIZE bytes at most.
+void coldPoll(void) {
+    size_t budget = COLD_POLL_SIZE;
+
+    for (struct coldBlock *b = lru_tail, *prev;
+            b && stats.hot > COLD_CACHE; b = prev) {
+        prev = b->prev;
+        if (keepHot(b->buf, b->first, b->first + b->numrows))
+            continue;
+        int ok = 1;
+        for (int j = 0; j < b->numrows && ok; j++)
+            ok = frozenOk(&b->buf->row[b->first + j]);
+        if (ok)
+            chill(b);
+        else
+            dissolve(b->buf, blockSearch(b->buf->cold, b->first));
+    }
+    for (int j = 0; j < EC.numbufs && budget; j++) {
+        Ebuf *buf = EC.bufs[j];
+        if (buf->cold && !buf->cold->idle) {
+            size_t done = coldScan(buf, budget);
+            budget -= done < budget ? done : budget;
+        }
+    }
+}
+
+void coldFree(Ebuf *buf) {
+    struct coldRows *c = buf->cold;
+
+    if (c == NULL)
+        return;
+    for (int k = 0; k < c->numblocks; k++) {
+        struct coldBlock *b = c->blocks[k];
+        if (b->hot) {
+            lruUnlink(b);
+            stats.hot -= b->size;
+        }
+        if (peek.block == b)
+            peek.block = NULL;
+        stats.raw -= b->size;
+        stats.zipped -= b->zsize;
+        free(b->data);
+        free(b);
+    }
+    free(c->blocks);
+    free(c);
+    buf->cold = NULL;
+}
+
+void coldStatsGet(struct coldStats *st) {
+    *st = stats;
+}
@@ -0,0 +1,582 @@
+#include "chibidit.h"
+
+/* ============================== Command line ==============================
+ *
+ * ':' reads an ex command on the status line. A range of lines comes first,
+ * then the name of the command, that may be abbreviated, a '!' that forces
+ * it, and its argument:
+ *
+ *   :N                     go to the line N
+ *   :w[!] [file]           write the buffer, to 'file' if given
+ *   :q[!]                  quit, even if some buffer is modified with '!'
+ *   :wq[!] [file], :x      write the buffer and quit
+ *   :[range]s/pat/rep/[g]  replace 'pat' by 'rep'
+ *   :[range]d              delete the lines
+ *   :[range]g/pat/cmd      run 'cmd' on the lines matching 'pat', on the
+ *                          other ones with 'g!' or 'v'
+ *   :[range]sort[!] [n][u][kN|cN]
+ *                          sort the lines, in the reverse order with '!':
+ *                          'n' by their first number, 'u' keeps one line
+ *                          by key, 'kN' and 'cN' start the key at the
+ *                          field or the column N
+ *   :[range]uniq           delete the lines equal to any line before them
+ *   :[line]r file          read 'file' after the line, at the top for 0
+ *   :[range]fo[ld]         fold the lines, see src/fold.c
+ *   :u[ndo], :red[o]       undo the last change made at once, redo it
+ *   :se[t] [no]nu[mber] [no]rnu|[no]relativenumber
+ *                          show or hide the line numbers in the view,
+ *                          relative to the cursor line with 'rnu'
+ *
+ * The same commands run without a terminal with 'chibidit -s script': see
+ * runScript(). */
+
+#define COMMAND_LEN 256
+
+enum {
+    CMD_WRITE,
+    CMD_QUIT,
+    CMD_WQ,
+    CMD_XIT,
+    CMD_SUBSTITUTE,
+    CMD_DELETE,
+    CMD_GLOBAL,
+    CMD_VGLOBAL,
+    CMD_SORT,
+    CMD_READ,
+    CMD_UNIQ,
+    CMD_FOLD,
+    CMD_SET,
+    CMD_UNDO,
+    CMD_REDO,
+    CMD_NONE = -1,
+};
+
+static const struct {
+    const char *name;
+    int min;            /* Shortest abbreviation. */
+} commands[] = {
+    [CMD_WRITE] = {"write", 1},
+    [CMD_QUIT] = {"quit", 1},
+    [CMD_WQ] = {"wq", 2},
+    [CMD_XIT] = {"xit", 1},
+    [CMD_SUBSTITUTE] = {"substitute", 1},
+    [CMD_DELETE] = {"delete", 1},
+    [CMD_GLOBAL] = {"global", 1},
+    [CMD_VGLOBAL] = {"vglobal", 1},
+    [CMD_SORT] = {"sort", 3},
+    [CMD_READ] = {"read", 1},
+    [CMD_UNIQ] = {"uniq", 3},
+    [CMD_FOLD] = {"fold", 2},
+    [CMD_SET] = {"set", 2},
+    [CMD_UNDO] = {"undo", 1},
+    [CMD_REDO] = {"redo", 3},
+};
+
+#define LINE_ZERO -2     /* Line 0, before the first one, as in ':0r'. */
+
+// Parse a line number at '*s': a number, '.' for the current line 'cur' or
+// '$' for the last one. Returns the line of the document from 0, that is the
+// row unless the rows are a window over it, LINE_ZERO for the line 0, or -1
+// if there is none.
+static long long parseLine(char **s, long long cur) {
+    Ebuf *buf = EC.buf;
+
+    if (**s == '.') {
+        (*s)++;
+        return cur;
+    }
+    if (**s == '$') {
+        (*s)++;
+        return buf->above + buf->numrows + buf->below - 1;
+    }
+    if (!isdigit((unsigned char)**s))
+        return -1;
+    long long line = strtoll(*s, s, 10);
+    return line > 0 ? line - 1 : LINE_ZERO;
+}
+
+// Parse the name of a command at '*s'. Returns its index in 'commands',
+// or CMD_NONE if there is no name. Sets '*s' to NULL if the name is not
+// one of a command.
+static int parseName(char **s) {
+    int len = 0;
+
+    while (isalpha((unsigned char)(*s)[len]))
+        len++;
+    if (len == 0)
+        return CMD_NONE;
+    for (unsigned int j = 0; j < sizeof(commands) / sizeof(commands[0]); j++) {
+        if (len >= commands[j].min && len <= (int)strlen(commands[j].name) &&
+                strncmp(*s, commands[j].name, len) == 0) {
+            *s += len;
+            return j;
+        }
+    }
+    *s = NULL;
+    return CMD_NONE;
+}
+
+// Split the next field of 's/pattern/replacement/flags' ending with the
+// delimiter 'delim' at '*s', and unescape the delimiters in it.
+static char *parseField(char **s, char delim) {
+    char *field = *s, *d = *s;
+
+    while (**s && **s != delim) {
+        if (**s == '\\' && (*s)[1] == delim)
+            (*s)++;
+        *d++ = *(*s)++;
+    }
+    if (**s)
+        (*s)++;
+    *d = '\0';
+    return field;
+}
+
+// Is the delimiter 'delim' of a pattern valid ?
+static int isDelimiter(char delim) {
+    return delim != '\0' && !isalnum((unsigned char)delim) && delim != '\\' &&
+        delim != ' ' && delim != '"';
+}
+
+static int writable(void) {
+    if (!EC.buf->window)
+        return 1;
+    setStatusMsg("The buffer is read only");
+    return 0;
+}
+
+// Quit, unless a buffer is modified and 'force' is not set.
+static int quit(int force) {
+    if (!force && anyBufferDirty()) {
+        setStatusMsg("No write since last change (add ! to override)");
+        return -1;
+    }
+    exit(0);
+}
+
+// Insert the lines of the file 'filename' after the row 'at' of the current
+// buffer, as a change that can be undone.
+static int readFile(int at, const char *filename) {
+    Ebuf *buf = EC.buf;
+    char *data = NULL;
+    size_t len = 0, cap = 0, nread;
+    FILE *fp;
+
+    if (*filename == '\0') {
+        setStatusMsg("Usage: [line]r file");
+        return -1;
+    }
+    if ((fp = fopen(filename, "r")) == NULL) {
+        setStatusMsg("Can't open %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 65536;
+            if ((data = realloc(data, cap)) == NULL) {
+                perror("Out of memory");
+                exit(1);
+            }
+        }
+        nread = fread(data + len, 1, cap - len, fp);
+        len += nread;
+    } while (nread);
+    fclose(fp);
+
+    if (at > buf->numrows)
+        at = buf->numrows;
+    undoBegin();
+    int n = insertLines(at, data, len);
+    undoSave(at, 0, n, NULL);
+    // The row after them may start with another open comment state.
+    if (at + n < buf->numrows)
+        updateSyntaxHighLight(&buf->row[at + n]);
+    buf->dirty++;
+    undoEnd();
+    free(data);
+    setStatusMsg("\"%s\" %d lines read", filename, n);
+    return 0;
+}
+
+static int exec(char *cmd, long long cur, int global);
+
+// Set the options of the current view named in 'args', separated by blanks.
+static int setOptions(char *args) {
+    static const struct {
+        const char *name, *abbrev;
+        int flag;
+    } options[] = {
+        {"number", "nu", NUMBER_ABSOLUTE},
+        {"relativenumber", "rnu", NUMBER_RELATIVE},
+    };
+    Eview *view = EC.view;
+
+    for (char *s = strtok(args, " "); s; s = strtok(NULL, " ")) {
+        int on = strncmp(s, "no", 2) != 0, j;
+        char *name = on ? s : s + 2;
+
+        for (j = 0; j < (int)(sizeof(options) / sizeof(options[0])); j++)
+            if (!strcmp(name, options[j].name) ||
+                    !strcmp(name, options[j].abbrev))
+                break;
+        if (j == sizeof(options) / sizeof(options[0])) {
+            setStatusMsg("Unknown option: %s", s);
+            return -1;
+        }
+        view->number = on ? view->number | options[j].flag :
+            view->number & ~options[j].flag;
+    }
+    // The text of the view moves by the width of the numbers.
+    layoutViews();
+    return 0;
+}
+
+// Run 'cmd' on the lines [from, to] that contain 'pat', or on the other ones
+// if 'invert' is set. Deleting them is done at once, any other command runs
+// on every line from the last one up, as a single change for undo.
+static int runGlobal(long long from, long long to, const char *pat, char *cmd,
+        int invert) {
+    Ebuf *buf = EC.buf;
+    int n, matches = 0, err = 0;
+    char *match, *s = cmd;
+
+    if (*pat == '\0') {
+        setStatusMsg("Empty pattern");
+        return -1;
+    }
+    if (to >= buf->numrows)
+        to = buf->numrows - 1;
+    if (from > to)
+        return 0;
+    // The frozen rows of the range are thawed, see src/cold.c
+    coldThaw(buf, from, to + 1);
+    n = to - from + 1;
+    if ((match = malloc(n)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    if ((matches = matchRows(from, to, pat, invert, match)) == 0) {
+        free(match);
+        setStatusMsg("Pattern not found: %s", pat);
+        return 0;
+    }
+
+    while (*s == ' ')
+        s++;
+    if (parseName(&s) == CMD_DELETE && s && *s == '\0') {
+        if (!writable()) {
+            free(match);
+            return -1;
+        }
+        // The cursor goes to the line after the last one deleted.
+        int last = n - 1;
+        while (match[last] == 0)
+            last--;
+        for (int j = 0; j < n; j++)
+            match[j] = !match[j];
+        filterRows(from, to, match);
+        free(match);
+        gotoRow(EC.view, from + last + 1 - matches);
+        setStatusMsg("%d fewer lines", matches);
+        return 0;
+    }
+
+    // Every command gets a copy, it is split in place.
+    int len = strlen(cmd);
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    undoBegin();
+    for (int j = n - 1; j >= 0 && err == 0; j--) {
+        if (!match[j])
+            continue;
+        memcpy(copy, cmd, len + 1);
+        err = exec(copy, from + j, 1);
+    }
+    undoEnd();
+    free(copy);
+    free(match);
+    if (err == 0)
+        setStatusMsg("%d lines matched", matches);
+    return err;
+}
+
+// Run the command 'cmd' with the line 'cur' as the current one. 'global' is
+// set if it runs for ':g'.
+static int exec(char *cmd, long long cur, int global) {
+    Ebuf *buf = EC.buf;
+    long long from, to;
+    int ranged = 1, name, force = 0;
+    char *s = cmd;
+
+    while (*s == ' ' || *s == ':')
+        s++;
+    if (*s == '%') {
+        s++;
+        from = 0;
+        to = buf->above + buf->numrows + buf->below - 1;
+    } else if ((from = parseLine(&s, cur)) != -1) {
+        to = from;
+        if (*s == ',' && (s++, to = parseLine(&s, cur)) == -1) {
+            setStatusMsg("Invalid range: %s", cmd);
+            return -1;
+        }
+    } else {
+        from = to = cur;
+        ranged = 0;
+    }
+    // Only ':0r' reads before the first line, the line 0 is the first one
+    // for the other commands.
+    int top = to == LINE_ZERO;
+    if (from == LINE_ZERO)
+        from = 0;
+    if (to == LINE_ZERO)
+        to = 0;
+    if (from > to) {
+        long long t = from;
+        from = to;
+        to = t;
+    }
+
+    while (*s == ' ')
+        s++;
+    if ((name = parseName(&s)) != CMD_NONE && *s == '!') {
+        s++;
+        force = 1;
+    }
+    if (s == NULL) {
+        setStatusMsg("Not an editor command: %s", cmd);
+        return -1;
+    }
+    char *arg = s;
+    while (*arg == ' ')
+        arg++;
+
+    switch (name) {
+    case CMD_NONE:
+        if (*s != '\0')
+            break;
+        // Just a line number: go there.
+        gotoLine(EC.view, to);
+        return 0;
+    case CMD_WRITE:
+        return saveAs(*arg ? arg : NULL) ? -1 : 0;
+    case CMD_QUIT:
+        return quit(force);
+    case CMD_WQ:
+    case CMD_XIT:
+        if ((name == CMD_WQ || buf->dirty) && saveAs(*arg ? arg : NULL))
+            return -1;
+        return quit(force);
+    case CMD_SUBSTITUTE: { // s/pattern/replacement/[g]
+        char delim = *s;
+        if (!isDelimiter(delim)) {
+            setStatusMsg("Usage: s/pattern/replacement/[g]");
+            return -1;
+        }
+        if (!writable())
+            return -1;
+        s++;
+        char *pat = parseField(&s, delim);
+        char *rep = parseField(&s, delim);
+        if (to >= buf->numrows)
+            to = buf->numrows - 1;
+        if (from > buf->numrows)
+            from = buf->numrows;
+        coldThaw(buf, from, to + 1);
+        return replace(from, to, pat, rep, strchr(s, 'g') != NULL) == -1 ? -1 : 0;
+    }
+    case CMD_DELETE: {
+        if (!writable())
+            return -1;
+        if (from >= buf->numrows) {
+            setStatusMsg("Invalid range: %s", cmd);
+            return -1;
+        }
+        if (to >= buf->numrows)
+            to = buf->numrows - 1;
+        coldThaw(buf, from, to + 1);
+        char *keep = calloc(to - from + 1, 1);
+        if (keep == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        int n = filterRows(from, to, keep);
+        free(keep);
+        gotoRow(EC.view, from);
+        setStatusMsg("%d fewer lines", n);
+        return 0;
+    }
+    case CMD_GLOBAL:
+    case CMD_VGLOBAL: { // g/pattern/command
+        char delim = *s;
+        if (global) {
+            setStatusMsg("Cannot nest :g");
+            return -1;
+        }
+        if (!isDelimiter(delim)) {
+            setStatusMsg("Usage: g/pattern/command");
+            return -1;
+        }
+        if (!ranged) {
+            from = 0;
+            to = buf->above + buf->numrows + buf->below - 1;
+        }
+        s++;
+        char *pat = parseField(&s, delim);
+        return runGlobal(from, to, pat, s, force || name == CMD_VGLOBAL);
+    }
+    case CMD_SORT:
+    case CMD_UNIQ: {
+        int flags = force ? SORT_REVERSE : 0, field = 0, column = 0, n;
+        for (s = arg; name == CMD_SORT && *s; s++) {
+            if (*s == 'n') {
+                flags |= SORT_NUMERIC;
+            } else if (*s == 'u') {
+                flags |= SORT_UNIQUE;
+            } else if ((*s == 'k' || *s == 'c') && isdigit((unsigned char)s[1])) {
+                int *at = *s == 'k' ? &field : &column;
+                *at = strtol(s + 1, &s, 10);
+                s--;
+            } else if (*s != ' ') {
+                setStatusMsg("Usage: sort[!] [n][u][kN|cN]");
+                return -1;
+            }
+        }
+        if (*s != '\0') {
+            setStatusMsg("Trailing characters: %s", s);
+            return -1;
+        }
+        if (!writable())
+            return -1;
+        if (!ranged) {
+            from = 0;
+            to = buf->numrows - 1;
+        } else if (from >= buf->numrows) {
+            setStatusMsg("Invalid range: %s", cmd);
+            return -1;
+        }
+        if (to >= buf->numrows)
+            to = buf->numrows - 1;
+        if (from >= to)
+            return 0;
+        coldThaw(buf, from, to + 1);
+        if (name == CMD_UNIQ) {
+            n = uniqRows(from, to);
+            gotoRow(EC.view, from);
+            setStatusMsg("%d duplicate lines deleted", n);
+            return 0;
+        }
+        n = sortRows(from, to, flags, field, column);
+        gotoRow(EC.view, from);
+        if (n)
+            setStatusMsg("%lld lines sorted, %d duplicates deleted",
+                    to - from + 1, n);
+        else
+            setStatusMsg("%lld lines sorted", to - from + 1);
+        return 0;
+    }
+    case CMD_READ:
+        if (!writable())
+            return -1;
+        return readFile(top || buf->numrows == 0 ? 0 : to + 1, arg);
+    case CMD_FOLD:
+        from -= buf->above;
+        to -= buf->above;
+        if (to >= buf->numrows)
+            to = buf->numrows - 1;
+        if (from < 0 || from > to) {
+            setStatusMsg("Invalid range: %s", cmd);
+            return -1;
+        }
+        if (foldCreate(from, to))
+            return -1;
+        gotoRow(EC.view, EC.view->row_offset + EC.view->cy);
+        return 0;
+    case CMD_SET:
+        return setOptions(arg);
+    case CMD_UNDO:
+    case CMD_REDO:
+        return undo(name == CMD_REDO);
+    }
+    setStatusMsg("Not an editor command: %s", cmd);
+    return -1;
+}
+
+// Run the command 'cmd', as typed after ':'. The range of lines comes first:
+// '%' for all of them, or one or two line numbers, the current one if none.
+// Returns 0 on success, -1 on error.
+int runCommand(char *cmd) {
+    return exec(cmd, EC.buf->above + EC.view->row_offset + EC.view->cy, 0);
+}
+
+// Run the commands of the file 'path', '-' for the standard input, one by
+// line, on the current buffer: 'chibidit -s script' does so instead of
+// reading keys from the terminal. Empty lines and the ones starting with '"'
+// are skipped. Stops at the first command that fails, telling why on stderr.
+// Returns 0 if all of them ran, -1 otherwise.
+int runScript(const char *path) {
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int lineno = 0, err = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Opening script %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (err == 0 && (linelen = getline(&line, &linecap, fp)) != -1) {
+        lineno++;
+        while (linelen && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            line[--linelen] = '\0';
+        char *s = line;
+        while (*s == ' ' || *s == '\t')
+            s++;
+        if (*s == '\0' || *s == '"')
+            continue;
+        if ((err = runCommand(s)) == -1)
+            fprintf(stderr, "%s:%d: %s\n", path, lineno, EC.statusmsg);
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    return err;
+}
+
+// Read a command typed on the status line after ':', and run it. ESC
+// cancels it, as a backspace on an empty line.
+void command(int fd) {
+    char cmd[COMMAND_LEN + 1] = {0};
+    int len = 0;
+
+    // Keys must not be remapped as in normal mode while typing the command.
+    EC.mode = PROMPT;
+    while (1) {
+        setStatusMsg(":%s", cmd);
+        refreshScreen();
+
+        int c = readKey(fd);
+        if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
+            if (len == 0)
+                break;
+            cmd[--len] = '\0';
+        } else if (c == ESC) {
+            len = 0;
+            break;
+        } else if (c == ENTER) {
+            break;
+        } else if (c >= 0 && c < 256 && (isprint(c) || c >= 0x80)) {
+            if (len < COMMAND_LEN) {
+                cmd[len++] = c;
+                cmd[len] = '\0';
+            }
+        }
+    }
+    EC.mode = NORMAL;
+    setStatusMsg("");
+    if (len)
+        runCommand(cmd);
+}
@@ -1,102 +1,325 @@
 #include "chibidit.h"
 
-void updateRow(Erow *row) {
-    unsigned int tabs = 0, nonprint = 0;
-    int j, idx;
+// Render the chars of a row, that is then highlighted.
+static void renderRow(Erow *row) {
+    unsigned int tabs = 0, multibyte = 0;
+    int j, idx, col;
+
+    // Long rows are rendered and highlighted lazily, when drawn.
+    if (row->size > LONG_ROW_SIZE) {
+        rowLongUpdate(row);
+        return;
+    }
+    rowLongFree(row);
 
-    free(row->render);
-    for (j = 0; j < row->size; j++)
+    for (j = 0; j < row->size; j++) {
         if (row->chars[j] == TAB)
             tabs++;
+        else if ((unsigned char)row->chars[j] >= 0x80)
+            multibyte++;
+    }
 
-    unsigned long long allocsize =
-        (unsigned long long) row->size + tabs * 8 + nonprint * 9 + 1;
-    if (allocsize > UINT32_MAX) {
-        printf("Some line of the edited file is too long for chibidit\n");
-        exit(1);
+    // The render and index blocks are reused in place as long as they
+    // are large enough.
+    row->render = rowRealloc(row->render, row->size + tabs * 8 + 1);
+
+    // Fast path: every byte of an ASCII row without TABs is one column.
+    if (tabs == 0 && multibyte == 0) {
+        rowFree(row->cols);
+        row->cols = row->rx = NULL;
+        memcpy(row->render, row->chars, row->size);
+        row->rsize = row->size;
+        row->render[row->size] = '\0';
+        return;
     }
 
-    row->render = malloc(row->size + tabs * 8 + nonprint * 9 + 1);
+    // Rows with multi-byte characters need a separate render offsets index,
+    // otherwise render offsets are just the columns.
+    if (multibyte) {
+        row->cols = rowRealloc(row->cols, sizeof(int) * (row->size + 1) * 2);
+        row->rx = row->cols + row->size + 1;
+    } else {
+        row->cols = rowRealloc(row->cols, sizeof(int) * (row->size + 1));
+        row->rx = row->cols;
+    }
     idx = 0;
-    for (j = 0; j < row->size; j++) {
+    col = 0;
+    for (j = 0; j < row->size;) {
         if (row->chars[j] == TAB) {
+            row->rx[j] = idx;
+            row->cols[j++] = col;
             row->render[idx++] = ' ';
-            while ((idx + 1) % 8 != 0)
+            col++;
+            while ((col + 1) % 8 != 0) {
                 row->render[idx++] = ' ';
+                col++;
+            }
         } else {
-            row->render[idx++] = row->chars[j];
+            int cp, n = utf8Decode(row->chars + j, row->size - j, &cp);
+            int width = cp < 0 ? 1 : utf8Width(cp);
+            while (n--) {
+                row->rx[j] = idx;
+                row->cols[j] = col;
+                row->render[idx++] = row->chars[j++];
+            }
+            col += width;
         }
     }
+    row->rx[row->size] = idx;
+    row->cols[row->size] = col;
     row->rsize = idx;
     row->render[idx] = '\0';
+}
 
+void updateRow(Erow *row) {
+    // Committing the row in the gap buffer updates it.
+    if (row->gap) {
+        rowCommit();
+        return;
+    }
+    renderRow(row);
     updateSyntaxHighLight(row);
+    wrapRowChanged(row);
+    coldRowChanged(row);
+}
+
+// Render and highlight again the chars of a row thawed, see src/cold.c
+void rowRestore(Erow *row) {
+    renderRow(row);
+    highlightRow(row);
+}
+
+static int cmpInt(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Update the 'n' rows of the current buffer at the indexes 'rows', whose
+// chars were all changed at once. They are all rendered, then highlighted
+// in a single pass from the top: a row highlighted again because the open
+// comment state of the row before it changed already sees the new chars.
+// 'rows' is sorted.
+void updateRows(int *rows, int n) {
+    int sorted = 1;
+
+    rowCommit();
+    for (int j = 0; j < n; j++) {
+        renderRow(&EC.buf->row[rows[j]]);
+        wrapRowChanged(&EC.buf->row[rows[j]]);
+        coldRowChanged(&EC.buf->row[rows[j]]);
+        sorted &= j == 0 || rows[j - 1] <= rows[j];
+    }
+    // Highlighting a row reads the highlight of the row before it.
+    if (!sorted)
+        qsort(rows, n, sizeof(int), cmpInt);
+    for (int j = 0; j < n; j++)
+        updateSyntaxHighLight(&EC.buf->row[rows[j]]);
+}
+
+// Screen column of the byte at offset 'at' of the row, when the cursor is
+// after the end of the row every extra position is one column.
+int rowCol(Erow *row, int at) {
+    if (row->gap)
+        return rowGapCol(row, at);
+    if (row->lr)
+        return rowLongCol(row, at);
+    if (row->cols == NULL)
+        return at;
+    if (at > row->size)
+        return row->cols[row->size] + at - row->size;
+    return row->cols[at];
+}
+
+// Offset in render of the byte at offset 'at' of the row. The highlight of
+// the row in the gap buffer is indexed by chars.
+int rowRender(Erow *row, int at) {
+    if (row->rx == NULL || row->gap)
+        return at;
+    if (at > row->size)
+        return row->rx[row->size] + at - row->size;
+    return row->rx[at];
+}
+
+// Offset of the first character of the row starting at or after the screen
+// column 'col'.
+int rowOffsetAtCol(Erow *row, int col) {
+    int lo = 0, hi = row->size;
+
+    if (row->lr) {
+        // Seek the chunk of a long row, a binary search would index it all.
+        lo = rowLongOffsetAtCol(row, col);
+        if (lo >= row->size)
+            return lo;
+    } else if (row->cols == NULL && row->gap == NULL) {
+        return col;
+    } else if (col > rowCol(row, row->size)) {
+        return row->size + col - rowCol(row, row->size);
+    } else {
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (rowCol(row, mid) < col)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    // Don't split a character, or a character and its combining marks.
+    if (lo > 0 && rowNextChar(row, rowPrevChar(row, lo)) != lo)
+        lo = rowNextChar(row, rowPrevChar(row, lo));
+    return lo;
+}
+
+// Decode the character at offset 'at', the row may be in the gap buffer.
+int rowDecode(Erow *row, int at, int *cp) {
+    if (row->gap)
+        return rowGapDecode(row, at, cp);
+    return utf8Decode(row->chars + at, row->size - at, cp);
+}
+
+int rowByte(Erow *row, int at) {
+    if (row->gap)
+        return rowGapByte(row, at);
+    return (unsigned char)row->chars[at];
+}
+
+// Offset of the character following the one at 'at'. Zero width code points
+// (combining marks) are kept together with the character they follow.
+int rowNextChar(Erow *row, int at) {
+    int cp;
+
+    if (at >= row->size)
+        return at + 1;
+    at += rowDecode(row, at, &cp);
+    while (at < row->size) {
+        int n = rowDecode(row, at, &cp);
+        if (cp < 0 || utf8Width(cp) != 0)
+            break;
+        at += n;
+    }
+    return at;
+}
+
+// Offset of the character preceding the one at 'at'.
+int rowPrevChar(Erow *row, int at) {
+    int cp;
+
+    if (at <= 0)
+        return 0;
+    if (at > row->size)
+        return at - 1;
+    while (at > 0) {
+        // Walk back over the continuation bytes, and check that the lead
+        // byte we found really decodes up to 'at'.
+        int start = at - 1;
+        while (start > 0 && at - start < 4 && (rowByte(row, start) & 0xc0) == 0x80)
+            start--;
+        if (start + rowDecode(row, start, &cp) != at) {
+            start = at - 1;
+            cp = -1;
+        }
+        at = start;
+        if (cp < 0 || utf8Width(cp) != 0)
+            break;
+    }
+    return at;
 }
 
-// Delete the character at offset 'at' from the specified row.
+// Delete the character at offset 'at' from the specified row, that is all the
+// bytes of its UTF-8 sequence.
 void rowDelChar(Erow *row, int at) {
     if (row->size <= at)
         return;
-    memmove(row->chars + at, row->chars + at + 1, row->size - at);
-    updateRow(row);
-    row->size--;
-    EC.dirty++;
+    if (row->lr)
+        rowLongDelete(row, at, rowNextChar(row, at) - at);
+    else
+        rowGapDelete(row, at, rowNextChar(row, at) - at);
+    EC.buf->dirty++;
+}
+
+// Set up a row with a copy of the 'len' bytes of 's'. It is rendered and
+// highlighted by updateRow().
+void rowInit(Erow *row, int idx, const char *s, size_t len) {
+    char *chars = rowAlloc(len + 1);
+
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+    rowInitChars(row, idx, chars, len);
+}
+
+// Set up a row with the null terminated 'chars' of 'size' bytes, that now
+// belong to it.
+void rowInitChars(Erow *row, int idx, char *chars, int size) {
+    row->size = size;
+    row->chars = chars;
+    row->hl = NULL;
+    row->hl_oc = 0;
+    row->render = NULL;
+    row->cols = NULL;
+    row->rx = NULL;
+    row->gap = NULL;
+    row->lr = NULL;
+    row->rsize = 0;
+    row->idx = idx;
 }
 
 void insertRow(int at, char *s, size_t len) {
-    if (at > EC.numrows) return;
-    EC.row = realloc(EC.row, sizeof(Erow) * (EC.numrows + 1));
-    if (at != EC.numrows) {
-        memmove(EC.row + at + 1, EC.row + at, sizeof(EC.row[0]) * (EC.numrows - at));
-        for (int j = at + 1; j <= EC.numrows; j++)
-            EC.row[j].idx++;
+    if (at > EC.buf->numrows) return;
+    rowCommit();
+    // Before the rows move, the block split may have to be thawed.
+    coldRowsChanged(EC.buf, at, 0, 1);
+    // Grow geometrically, rows are appended one by one when loading.
+    if (EC.buf->numrows + 1 > EC.buf->rowcap) {
+        EC.buf->rowcap = EC.buf->rowcap ? EC.buf->rowcap * 2 : 16;
+        EC.buf->row = realloc(EC.buf->row, sizeof(Erow) * EC.buf->rowcap);
+        if (EC.buf->row == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
     }
+    if (at != EC.buf->numrows) {
+        memmove(EC.buf->row + at + 1, EC.buf->row + at,
+                sizeof(EC.buf->row[0]) * (EC.buf->numrows - at));
+        for (int j = at + 1; j <= EC.buf->numrows; j++)
+            EC.buf->row[j].idx++;
+    }
+    wrapRowsChanged(EC.buf, at, 0, 1);
+    motionRowsChanged(EC.buf, at);
+    foldRowsChanged(EC.buf, at, 0, 1);
+
+    rowInit(EC.buf->row + at, at, s, len);
+    updateRow(EC.buf->row + at);
+    EC.buf->numrows++;
+    EC.buf->dirty++;
+}
 
-    EC.row[at].size = len;
-    EC.row[at].chars = malloc(len + 1);
-    memcpy(EC.row[at].chars, s, len + 1);
-    EC.row[at].hl = NULL;
-    EC.row[at].hl_oc = 0;
-    EC.row[at].render = NULL;
-    EC.row[at].rsize = 0;
-    EC.row[at].idx = at;
-    updateRow(EC.row + at);
-    EC.numrows++;
-    EC.dirty++;
+static void rowInsert(Erow *row, int at, const char *s, int len) {
+    if (row->lr)
+        rowLongInsert(row, at, s, len);
+    else
+        rowGapInsert(row, at, s, len);
 }
 
-// Insert a character at the specified position in a row, moving the remaining
-// chars on the right if needed.
+// Insert a character at the specified position in a row. The row is edited
+// in the gap buffer, so the chars on the right don't move.
 void rowInsertChar(Erow *row, int at, int c) {
-    if (at > row->size) {
-        // Pad the string with spaces if the insert location is outside the
-        // current length by more than a single character.
-        int padlen = at - row->size;
-        // In the next line +2 means: new char and null term.
-        row->chars = realloc(row->chars, row->size + padlen + 2);
-        memset(row->chars + row->size, ' ', padlen);
-        row->chars[row->size + padlen + 1] = '\0';
-        row->size += padlen + 1;
-    } else {
-        // If we are in the middle of the string just make space for 1 new
-        // char plus the (already existing) null term.
-        row->chars = realloc(row->chars, row->size + 2);
-        memmove(row->chars + at + 1, row->chars + at, row->size - at + 1);
-        row->size++;
-    }
-    row->chars[at] = c;
-    updateRow(row);
-    EC.dirty++;
+    char ch = c;
+
+    // Pad the string with spaces if the insert location is outside the
+    // current length by more than a single character.
+    while (row->size < at)
+        rowInsert(row, row->size, " ", 1);
+    rowInsert(row, at, &ch, 1);
+    EC.buf->dirty++;
 }
 
 void insertNewLine(void) {
-    int filerow = EC.row_offset + EC.cy;
-    int filecol = EC.col_offset + EC.cx;
+    int filerow = EC.view->row_offset + EC.view->cy;
+    int filecol = EC.view->cx;
 
-    Erow *row = (filerow >= EC.numrows) ? NULL : &EC.row[filerow];
+    rowCommit();
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : &EC.buf->row[filerow];
 
     if (!row) {
-        if (filerow == EC.numrows) {
+        if (filerow == EC.buf->numrows) {
             insertRow(filerow, "", 0);
             goto fixcursor;
         }
@@ -112,129 +335,206 @@ void insertNewLine(void) {
     } else {
         // We are in the middle of a line. Split it between two rows.
         insertRow(filerow + 1, row->chars + filecol, row->size - filecol);
-        row = &EC.row[filerow];
+        row = &EC.buf->row[filerow];
+        row->chars = rowOwn(row->chars);
         row->chars[filecol] = '\0';
         row->size = filecol;
         updateRow(row);
     }
 
 fixcursor:
-    if (EC.cy == EC.screenrows - 1) {
-        EC.row_offset++;
+    // With closed folds scrollCursor() scrolls down to the cursor.
+    if (EC.view->cy == EC.view->screenrows - 1 && !foldActive(EC.view)) {
+        EC.view->row_offset++;
     } else {
-        EC.cy++;
+        EC.view->cy++;
     }
-    EC.cx = 0;
-    EC.col_offset = 0;
+    EC.view->cx = 0;
+    EC.view->col_offset = 0;
 }
 
 void delAtChar(void) {
-    int filerow = EC.row_offset + EC.cy;
-    int filecol = EC.col_offset + EC.cx;
-    Erow *row = (filerow > EC.numrows) ? NULL : &EC.row[filerow];
+    int filerow = EC.view->row_offset + EC.view->cy;
+    int filecol = EC.view->cx;
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : &EC.buf->row[filerow];
 
     if (!row || (filecol == 0 && filerow == 0))
         return;
     if (filecol == 0) {
         // Handle the case of column 0, we need to move the current line
         // on the left of the next one.
+        rowCommit();
         delRow(filerow);
         row = NULL;
-        if (EC.cy == 0)
-            EC.row_offset--;
-        EC.cx = 0;
+        // The next row follows another one now.
+        if (filerow < EC.buf->numrows)
+            updateSyntaxHighLight(&EC.buf->row[filerow]);
+        if (EC.view->cy == 0)
+            EC.view->row_offset--;
+        EC.view->cx = 0;
     } else {
         rowDelChar(row, filecol);
-        if (EC.cx == 0 && EC.col_offset)
-            EC.col_offset--;
+        if (filecol > row->size)
+            EC.view->cx = row->size;
+        scrollCursor(EC.view);
     }
-    if (row)
-        updateRow(row);
-    EC.dirty++;
+    EC.buf->dirty++;
 }
 
 void delChar(void) {
-    int filerow = EC.row_offset + EC.cy;
-    int filecol = EC.col_offset + EC.cx;
-    Erow *row = (filerow > EC.numrows) ? NULL : &EC.row[filerow];
+    int filerow = EC.view->row_offset + EC.view->cy;
+    int filecol = EC.view->cx;
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : &EC.buf->row[filerow];
 
     if (!row || (filecol == 0 && filerow == 0))
         return;
     if (filecol == 0) {
         // Handle the case of column 0, we need to move the current line
         // on the right of the previous one.
-        filecol = EC.row[filerow - 1].size;
-        rowAppendString(&EC.row[filerow - 1], row->chars, row->size);
+        rowCommit();
+        filecol = rowAt(EC.buf, filerow - 1)->size;
+        rowAppendString(&EC.buf->row[filerow - 1], row->chars, row->size);
         delRow(filerow);
         row = NULL;
-        if (EC.cy == 0)
-            EC.row_offset--;
+        // The next row follows another one now.
+        if (filerow < EC.buf->numrows)
+            updateSyntaxHighLight(&EC.buf->row[filerow]);
+        if (EC.view->cy == 0)
+            EC.view->row_offset--;
         else
-            EC.cy--;
-        EC.cx = filecol;
-        if (EC.cx >= EC.screencols) {
-            int shift = (EC.screencols - EC.cx) + 1;
-            EC.cx -= shift;
-            EC.col_offset += shift;
-        }
+            EC.view->cy--;
+        EC.view->cx = filecol;
     } else {
-        rowDelChar(row, filecol - 1);
-        if (EC.cx == 0 && EC.col_offset)
-            EC.col_offset--;
-        else
-            EC.cx--;
+        filecol = rowPrevChar(row, filecol);
+        rowDelChar(row, filecol);
+        EC.view->cx = filecol;
     }
-    if (row)
-        updateRow(row);
-    EC.dirty++;
+    scrollCursor(EC.view);
+    EC.buf->dirty++;
 }
 
 // Append the string 's' at the end of a row
 void rowAppendString(Erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
+    rowCommit();
+    row->chars = rowRealloc(row->chars, row->size + len + 1);
     memcpy(row->chars + row->size, s, len);
     row->size += len;
     row->chars[row->size] = '\0';
     updateRow(row);
-    EC.dirty++;
+    EC.buf->dirty++;
 }
 
 void freeRow(Erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    if (row->gap)
+        rowGapFree(row);
+    rowLongFree(row);
+    rowFree(row->render);
+    rowFree(row->chars);
+    rowFree(row->hl);
+    rowFree(row->cols);
+}
+
+// Put the 'm' rows of 'rows' in place of the 'n' rows from 'at' of the
+// current buffer, with a single move of the rows after them. The rows
+// replaced are not freed, the new ones are not updated.
+void spliceRows(int at, int n, Erow *rows, int m) {
+    Ebuf *buf = EC.buf;
+    int numrows = buf->numrows - n + m;
+
+    coldRowsChanged(buf, at, n, m);
+    if (numrows > buf->rowcap) {
+        while (numrows > buf->rowcap)
+            buf->rowcap = buf->rowcap ? buf->rowcap * 2 : 16;
+        buf->row = realloc(buf->row, sizeof(Erow) * buf->rowcap);
+        if (buf->row == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    if (n != m)
+        memmove(buf->row + at + m, buf->row + at + n,
+                sizeof(Erow) * (buf->numrows - at - n));
+    if (m)
+        memcpy(buf->row + at, rows, sizeof(Erow) * m);
+    buf->numrows = numrows;
+    for (int j = at; j < (n == m ? at + m : numrows); j++)
+        buf->row[j].idx = j;
+    wrapRowsChanged(buf, at, n, m);
+    motionRowsChanged(buf, at);
+    foldRowsChanged(buf, at, n, m);
+}
+
+// Insert at 'at' the lines of the 'len' bytes of 's' as rows of the current
+// buffer, a last line without newline included. The buffer is not marked
+// as modified. Returns the number of rows inserted.
+int insertLines(int at, const char *s, size_t len) {
+    const char *end = s + len;
+    int n = 0;
+    Erow *rows;
+
+    for (const char *nl = s; nl < end && (nl = memchr(nl, '\n', end - nl)); nl++)
+        n++;
+    n += len && end[-1] != '\n';
+    if ((rows = malloc(sizeof(Erow) * (n + 1))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    for (int j = 0; j < n; j++) {
+        const char *nl = memchr(s, '\n', end - s);
+        size_t linelen = nl ? (size_t)(nl - s) : (size_t)(end - s);
+
+        rowInit(&rows[j], at + j, s, linelen);
+        s += linelen + 1;
+    }
+    rowCommit();
+    spliceRows(at, 0, rows, n);
+    for (int j = 0; j < n; j++)
+        updateRow(&EC.buf->row[at + j]);
+    free(rows);
+    return n;
+}
+
+// Remove the 'n' rows from 'at', shifting the remaining on the top.
+void delRows(int at, int n) {
+    if (at + n > EC.buf->numrows)
+        n = EC.buf->numrows - at;
+    if (n <= 0)
+        return;
+    rowCommit();
+    // The rows frozen are freed with their block, but the blocks of the
+    // first and last rows may hold rows kept.
+    coldThaw(EC.buf, at, at + 1);
+    coldThaw(EC.buf, at + n - 1, at + n);
+    for (int j = at; j < at + n; j++)
+        freeRow(&EC.buf->row[j]);
+    spliceRows(at, n, NULL, 0);
+    EC.buf->dirty++;
 }
 
 // Remove the row at the specified posision, shifting the remaining
 // on the top.
 void delRow(int at) {
-    Erow *row;
-
-    if (at >= EC.numrows)
-        return;
-    row = EC.row + at;
-    freeRow(row);
-    memmove(EC.row + at, EC.row + at + 1, sizeof(EC.row[0]) * (EC.numrows - at - 1));
-    for (int j = at; j < EC.numrows - 1; j++)
-        EC.row[j].idx++;
-
-    EC.numrows--;
-    EC.dirty++;
+    delRows(at, 1);
 }
 
-char *rowsToString(int *buflen) {
+char *rowsToString(size_t *buflen) {
     char *buf = NULL, *p;
-    int totlen = 0;
+    size_t totlen = 0;
 
-    for (int i = 0; i < EC.numrows; i++)
-        totlen += EC.row[i].size + 1; // +1 is for "\n" at end of every row
+    rowCommit();
+    for (int i = 0; i < EC.buf->numrows; i++)
+        totlen += EC.buf->row[i].size + 1; // +1 is for "\n" at end of every row
     *buflen = totlen;
     totlen++; // Also make space for nulterm
 
-    p = buf = malloc(totlen);
-    for (int j = 0; j < EC.numrows; j++) {
-        memcpy(p, EC.row[j].chars, EC.row[j].size);
-        p += EC.row[j].size;
+    if ((p = buf = malloc(totlen)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    // The frozen rows are read without being thawed.
+    for (int j = 0; j < EC.buf->numrows; j++) {
+        memcpy(p, coldPeek(EC.buf, j), EC.buf->row[j].size);
+        p += EC.buf->row[j].size;
         *p = '\n';
         p++;
     }
@@ -243,23 +543,21 @@ char *rowsToString(int *buflen) {
 }
 
 void insertChar(int c) {
-    int filerow = EC.row_offset + EC.cy;
-    int filecol = EC.col_offset + EC.cx;
-    Erow *row = (filerow >= EC.numrows) ? NULL : &EC.row[filerow];
+    int filerow = EC.view->row_offset + EC.view->cy;
+    int filecol = EC.view->cx;
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : &EC.buf->row[filerow];
 
     // If the row where the cursor is currently located does not exist
     // in our logical representation of the file, add enough empty rows
     // as needed.
     if (!row) {
-        while(EC.numrows <= filerow)
-            insertRow(EC.numrows, "", 0);
+        while(EC.buf->numrows <= filerow)
+            insertRow(EC.buf->numrows, "", 0);
     }
-    row = &EC.row[filerow];
+    row = &EC.buf->row[filerow];
     rowInsertChar(row, filecol, c);
-    if (EC.cx == EC.screencols - 1)
-        EC.col_offset++;
-    else
-        EC.cx++;
-    EC.dirty++;
+    EC.view->cx++;
+    scrollCursor(EC.view);
+    EC.buf->dirty++;
 }
 
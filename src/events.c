@@ -1,89 +1,179 @@
 #include "chibidit.h"
 
 void moveCursor(int key) {
-    int filerow = EC.row_offset + EC.cy;
-    int filecol = EC.col_offset + EC.cx;
-    int rowlen;
-    Erow *row = (filerow >= EC.numrows) ? NULL : &EC.row[filerow];
+    int filerow = EC.view->row_offset + EC.view->cy;
+    int filecol = EC.view->cx;
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : rowAt(EC.buf, filerow);
+    // The rows above and below, past the closed folds.
+    int folded = foldActive(EC.view);
+    int prev = foldRow(EC.view, foldLine(EC.view, filerow) - 1);
+    int next = foldRow(EC.view, foldLine(EC.view, filerow) + 1);
 
     switch (key) {
     case ARROW_LEFT:
-        if (EC.cx == 0) {
-            if (EC.col_offset) {
-                EC.col_offset--;
-            } else {
-                if (filerow > 0) {
-                    EC.cy--;
-                    EC.cx = EC.row[filerow - 1].size;
-                    if (EC.cx > EC.screencols - 1) {
-                        EC.col_offset = EC.cx - EC.screencols + 1;
-                        EC.cx = EC.screencols - 1;
-                    }
-                }
-            }
-        } else {
-            EC.cx -= 1;
+        if (filecol > 0) {
+            filecol = row ? rowPrevChar(row, filecol) : filecol - 1;
+        } else if (filerow > 0) {
+            // Go to the end of the previous line.
+            if (EC.view->cy == 0)
+                EC.view->row_offset = prev;
+            else
+                EC.view->cy = prev - EC.view->row_offset;
+            filecol = rowAt(EC.buf, prev)->size;
         }
         break;
     case ARROW_RIGHT:
         if (row && filecol < row->size) {
-            if (EC.cx == EC.screencols - 1)
-                EC.col_offset++;
-            else
-                EC.cx += 1;
+            // Move over all the bytes of the character.
+            filecol = rowNextChar(row, filecol);
         } else if (row && filecol == row->size) {
-            EC.cx = 0;
-            EC.col_offset = 0;
-            if (EC.cy == EC.screenrows - 1)
-                EC.row_offset++;
+            // Go to the start of the next line.
+            filecol = 0;
+            if (EC.view->cy == EC.view->screenrows - 1 && !folded)
+                EC.view->row_offset++;
             else
-                EC.cx += 1;
+                EC.view->cy = next - EC.view->row_offset;
         }
         break;
+    case HOME_KEY:
+        filecol = 0;
+        break;
+    case END_KEY:
+        filecol = row ? row->size : 0;
+        break;
     case ARROW_UP:
-        if (EC.cy == 0) {
-            if (EC.row_offset)
-                EC.row_offset--;
+        // When wrapping or folding, scrollCursor() scrolls up to the cursor.
+        if ((EC.view->wrap || folded) && filerow > 0) {
+            EC.view->cy = prev - EC.view->row_offset;
+        } else if (EC.view->cy == 0) {
+            if (EC.view->row_offset)
+                EC.view->row_offset--;
         } else {
-            EC.cy -= 1;
+            EC.view->cy -= 1;
         }
         break;
     case ARROW_DOWN:
-        if (filerow < EC.numrows) {
-            if (EC.cy == EC.screenrows - 1)
-                EC.row_offset++;
+        if (filerow < EC.buf->numrows) {
+            if (EC.view->cy == EC.view->screenrows - 1 && !EC.view->wrap &&
+                    !folded)
+                EC.view->row_offset++;
             else
-                EC.cy += 1;
+                EC.view->cy = next - EC.view->row_offset;
         }
         break;
     }
-    // Fix cx if the current line has not enough chars.
-    filerow = EC.row_offset + EC.cy;
-    filecol = EC.col_offset + EC.cx;
-    row = (filerow >= EC.numrows) ? NULL : &EC.row[filerow];
-    rowlen = row ? row->size : 0;
-    if (filecol > rowlen) {
-        EC.cx -= filecol - rowlen;
-        if (EC.cx < 0) {
-            EC.col_offset += EC.cx;
-            EC.cx = 0;
-        }
+    // Fix the column if the current line has not enough chars, moving
+    // vertically we may also land in the middle of a character.
+    EC.view->cx = filecol;
+    clampCursor(EC.view);
+    scrollCursor(EC.view);
+}
+
+// Refuse to edit the rows of a window over a larger document.
+static int readOnly(void) {
+    if (!EC.buf->window)
+        return 0;
+    setStatusMsg("The buffer is read only");
+    return 1;
+}
+
+// Keys that move the cursor in the visual modes as in the normal mode.
+static int visualMotion(int c) {
+    switch (c) {
+    case ARROW_UP: case ARROW_DOWN: case ARROW_LEFT: case ARROW_RIGHT:
+    case HOME_KEY: case END_KEY: case PAGE_UP: case PAGE_DOWN:
+    case CTRL_U: case CTRL_D: case 'G': case 'g': case '%': case '"':
+    case 'w': case 'b': case 'e': case '{': case '}':
+    case 'f': case 't': case ';': case ',':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+    case CTRL_L: case CTRL_T: case CTRL_G: case ESC:
+        return 1;
+    }
+    return 0;
+}
+
+// The other keys of the visual modes, that act on the selection, read from
+// 'fd'. 'reg' is the register named before, 0 if none.
+static void visualKeyPress(int fd, int c, int reg) {
+    int r0, c0, r1, c1, mode = EC.mode;
+
+    switch (c) {
+    case 'v':
+        visualMode(VISUAL);
+        break;
+    case 'V':
+        visualMode(VISUAL_LINE);
+        break;
+    case CTRL_V:
+        visualMode(VISUAL_BLOCK);
+        break;
+    case 'o': // Go to the other end of the selection
+        r0 = EC.vrow;
+        c0 = EC.vcol;
+        EC.vrow = EC.view->row_offset + EC.view->cy;
+        EC.vcol = EC.view->cx;
+        gotoRow(EC.view, r0);
+        EC.view->cx = c0;
+        clampCursor(EC.view);
+        scrollCursor(EC.view);
+        break;
+    case 'y': // Yank the selection
+    case 'd': // Delete it
+    case DEL_AT_KEY:
+        if (c != 'y' && readOnly())
+            break;
+        visualBounds(&r0, &c0, &r1, &c1);
+        EC.mode = NORMAL;
+        yank(reg, mode, r0, c0, r1, c1, c != 'y');
+        // The cursor goes to the start of the selection.
+        gotoRow(EC.view, r0);
+        if (mode == VISUAL)
+            EC.view->cx = c0;
+        else if (mode == VISUAL_BLOCK && r0 < EC.buf->numrows)
+            EC.view->cx = rowOffsetAtCol(rowAt(EC.buf, r0), c0);
+        clampCursor(EC.view);
+        scrollCursor(EC.view);
+        break;
+    case 'z': // zf folds the selected rows
+        if (readKey(fd) != 'f')
+            break;
+        visualBounds(&r0, &c0, &r1, &c1);
+        EC.mode = NORMAL;
+        if (foldShut(EC.view, r1) != -1)
+            r1 = foldShut(EC.view, r1);
+        if (r1 >= EC.buf->numrows)
+            r1 = EC.buf->numrows - 1;
+        if (r0 <= r1)
+            foldCreate(r0, r1);
+        gotoRow(EC.view, r0);
+        break;
     }
 }
 
 #define QUIT_TIMES 1
 void processKeyPress(int fd) {
     static int quit_times = QUIT_TIMES;
+    static int reload_times = QUIT_TIMES;
+    static long long count = 0; /* Count typed before a command, 0 if none. */
+    static int reg = 0;         /* Register named before a command, 0 if
+                                   none. */
 
     int c = readKey(fd);
-    if (EC.mode == NORMAL) {
+    // The rows the key may act on are thawed, see src/cold.c
+    coldView(EC.view);
+    int visual = EC.mode == VISUAL || EC.mode == VISUAL_LINE ||
+        EC.mode == VISUAL_BLOCK;
+    if (visual && !visualMotion(c)) {
+        visualKeyPress(fd, c, reg);
+    } else if (EC.mode == NORMAL || visual) {
         switch (c) {
         case CTRL_C: // Ignore ctrl-c
             break;
 
         case CTRL_Q: // Quit
             // Quit if this file was already saved.
-            if (EC.dirty && quit_times) {
+            if (anyBufferDirty() && quit_times) {
                 setStatusMsg("WARNING!! File has unsaved changes. "
                         "Press Ctrl-Q %d to quit.", quit_times);
                 quit_times--;
@@ -94,38 +184,176 @@ void processKeyPress(int fd) {
         case CTRL_S: // Save
             save();
             break;
+        case CTRL_G: // File and memory information
+            showBufferInfo();
+            break;
+        case CTRL_T: // Profiling overlay
+            profToggleOverlay();
+            break;
+        case CTRL_N: // Next buffer
+            nextBuffer(1);
+            break;
+        case CTRL_P: // Previous buffer
+            nextBuffer(-1);
+            break;
+        case CTRL_W: // Window commands
+            switch (readKey(fd)) {
+            case 's':
+                splitView(LAYOUT_HSPLIT);
+                break;
+            case 'v':
+                splitView(LAYOUT_VSPLIT);
+                break;
+            case 'w':
+            case CTRL_W:
+                nextView();
+                break;
+            case 'q':
+            case 'c':
+                closeView();
+                break;
+            case 'z':
+                wrapToggle();
+                break;
+            }
+            break;
         case CTRL_F: // Find mode
-            // TODO: implement find string
+            find(fd);
             break;
-        case BACKSPACE:
-        case CTRL_H:
-        case PAGE_UP:
-        case PAGE_DOWN: {
-            int times = EC.screenrows;
-            if (c == PAGE_UP && EC.cy != 0) {
-                EC.cy = 0;
-                while(times--)
-                    moveCursor(ARROW_UP);
+        case ':': // Command line
+            command(fd);
+            break;
+        case 'u': // Undo the last change made at once
+            undo(0);
+            break;
+        case CTRL_R: // and redo it
+            undo(1);
+            break;
+        case 'q': // Record a macro, or stop recording it
+            macroRecord(macroRecording() ? 0 : readKey(fd));
+            break;
+        case '@': { // Replay a macro 'count' times
+            // Its keys start with no count nor register.
+            long long n = count ? count : 1;
+            count = 0;
+            reg = 0;
+            macroReplay(fd, readKey(fd), n);
+            break;
+        }
+        case '"': // Register of the next command
+            c = readKey(fd);
+            reg = c >= 'a' && c <= 'z' ? c : 0;
+            return;
+        case 'v': // Visual modes
+            visualMode(VISUAL);
+            break;
+        case 'V':
+            visualMode(VISUAL_LINE);
+            break;
+        case CTRL_V:
+            visualMode(VISUAL_BLOCK);
+            break;
+        case 'y': // yy yanks 'count' lines
+        case 'd': // and dd deletes them
+            if (readKey(fd) != c || (c == 'd' && readOnly()))
                 break;
+            {
+                int row = EC.view->row_offset + EC.view->cy;
+                int n = count > 0 && count < INT_MAX - row ? count : 1;
+                // A closed fold is a single line.
+                int last = n < EC.buf->numrows ?
+                    foldRow(EC.view, foldLine(EC.view, row) + n) - 1 : row + n - 1;
+                yank(reg, VISUAL_LINE, row, 0, last, 0, c == 'd');
+                gotoRow(EC.view, row);
             }
-
-            if (c == PAGE_DOWN && EC.cy != EC.screenrows - 1) {
-                EC.cy = EC.screenrows - 1;
-                while(times--)
-                    moveCursor(ARROW_DOWN);
+            break;
+        case 'p': // Put after the cursor
+        case 'P': // or before it
+            if (!readOnly())
+                put(reg, c == 'P');
+            break;
+        case 'z': // Folds
+            foldCommand(readKey(fd), count);
+            break;
+        case 'F': // Follow the file as it grows
+            followToggle();
+            break;
+        case 'R': // Reload the file from disk
+            if (EC.buf->dirty && reload_times) {
+                setStatusMsg("WARNING!! File has unsaved changes. "
+                        "Press R again to reload.");
+                reload_times--;
+                return;
+            }
+            reloadBuffer(EC.buf);
+            break;
+        case PAGE_UP:
+            scrollRows(EC.view, -EC.view->screenrows, 1);
+            break;
+        case PAGE_DOWN:
+            scrollRows(EC.view, EC.view->screenrows, 1);
+            break;
+        case CTRL_U: // Half page up
+            scrollRows(EC.view, -(EC.view->screenrows + 1) / 2, 0);
+            break;
+        case CTRL_D: // Half page down
+            scrollRows(EC.view, (EC.view->screenrows + 1) / 2, 0);
+            break;
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            // Count of the next command, a leading 0 is the start of line.
+            if (c == '0' && count == 0) {
+                moveCursor(HOME_KEY);
                 break;
             }
-        }
+            if (count < LLONG_MAX / 10)
+                count = count * 10 + c - '0';
+            return;
+        case 'G': // Go to the line 'count', or to the last one
+            gotoLine(EC.view, count ? count - 1 : pagerLines(EC.buf) - 1);
+            break;
+        case 'g': // gg goes to the line 'count', or to the first one
+            if (readKey(fd) == 'g')
+                gotoLine(EC.view, count ? count - 1 : 0);
+            break;
+        case '%': // Go to 'count' percent of the file, or to the bracket
+                  // matching the one under the cursor
+            if (count == 0)
+                motionCommand(c, 1);
+            else if (count <= 100)
+                gotoLine(EC.view, (count * pagerLines(EC.buf) + 99) / 100 - 1);
+            break;
+        case 'w': // Words
+        case 'b':
+        case 'e':
+        case '{': // Paragraphs
+        case '}':
+            motionCommand(c, count);
+            break;
+        case 'f': // Go to a character of the row
+        case 't': // or just before it
+            motionFind(c, readKey(fd), count);
+            break;
+        case ';': // Repeat it
+        case ',': // backward
+            motionFind(c, 0, count);
+            break;
+        case BACKSPACE:
+        case CTRL_H:
         case DEL_KEY:
-            delChar();
+            if (!readOnly())
+                delChar();
             break;
         case DEL_AT_KEY:
-            delAtChar();
+            if (!readOnly())
+                delAtChar();
             break;
         case ARROW_UP:
         case ARROW_DOWN:
         case ARROW_LEFT:
         case ARROW_RIGHT:
+        case HOME_KEY:
+        case END_KEY:
             moveCursor(c);
             break;
         case CTRL_L: // Clear screen.
@@ -136,27 +364,49 @@ void processKeyPress(int fd) {
     } else if (EC.mode == INSERT) {
         switch(c) {
         case ENTER:  // Enter
-            insertNewLine();
+            if (!readOnly())
+                insertNewLine();
             break;
         case DEL_KEY:
-            delChar();
+            if (!readOnly())
+                delChar();
             break;
         case ARROW_UP:
         case ARROW_DOWN:
         case ARROW_LEFT:
         case ARROW_RIGHT:
+        case HOME_KEY:
+        case END_KEY:
             moveCursor(c);
             break;
         case ESC:
             break;
         default:
-            insertChar(c);
+            if (!readOnly())
+                insertChar(c);
             break;
         }
     }
 
+    // The row edited in the gap buffer is committed once the cursor leaves.
+    rowCommitIfLeft();
+    // The rows of a spilled stream or of a huge file are a window that
+    // follows the cursor.
+    streamScroll();
+    pagerScroll();
+    // Typing in a closed fold opens it.
+    if (EC.mode == INSERT)
+        foldReveal(EC.buf, EC.view->row_offset + EC.view->cy);
+    // Any edit may have moved the cursor out of a wrapped view, or into a
+    // closed fold.
+    if (EC.view->wrap || foldActive(EC.view))
+        scrollCursor(EC.view);
+
     // Reset it to the original time.
     quit_times = QUIT_TIMES;
+    reload_times = QUIT_TIMES;
+    count = 0;
+    reg = 0;
 }
 
 void updateWindowSize(void) {
@@ -165,16 +415,13 @@ void updateWindowSize(void) {
         perror("Unable to query the screen for size (columns / rows)");
         exit(1);
     }
-    EC.screenrows -= 2;
+    // The last row is used for the status message.
+    EC.screenrows -= 1;
+    layoutViews();
 }
 
 void handleSigWinCh(int unused __attribute__((unused))) {
     updateWindowSize();
-    if (EC.cy > EC.screenrows)
-        EC.cy = EC.screenrows - 1;
-
-    if (EC.cx > EC.screencols)
-        EC.cx = EC.screencols - 1;
     refreshScreen();
 }
 
@@ -0,0 +1,134 @@
+#include "chibidit.h"
+
+#define FIND_QUERY_LEN 256
+
+// Put back the highlight of the row of the last match, saved in '*saved'.
+static void restoreMatch(int row, unsigned char **saved) {
+    if (*saved == NULL)
+        return;
+    memcpy(rowAt(EC.buf, row)->hl, *saved, EC.buf->row[row].rsize);
+    free(*saved);
+    *saved = NULL;
+}
+
+// Incremental search. The query is typed on the status line, the view moves
+// to the next match on every key, arrows move to the next or previous match,
+// ENTER keeps the cursor on the match and ESC goes back where we were.
+void find(int fd) {
+    Eview *view = EC.view;
+    char query[FIND_QUERY_LEN + 1] = {0};
+    int qlen = 0;
+    int last_match = -1;    /* Last row where a match was found, or -1. */
+    int find_next = 0;      /* 1 to search forward, -1 backward. */
+    int saved_hl_row = -1;  /* Row whose highlight was changed, or -1. */
+    unsigned char *saved_hl = NULL;
+
+    // Save the cursor position in order to restore it later.
+    int saved_cx = view->cx, saved_cy = view->cy;
+    int saved_row_offset = view->row_offset;
+    int saved_col_offset = view->col_offset;
+    long long saved_above = EC.buf->above;
+
+    // The search needs all the rows as plain strings.
+    rowCommit();
+
+    // Keys must not be remapped as in normal mode while typing the query.
+    EC.mode = PROMPT;
+    while (1) {
+        setStatusMsg("Search: %s (Use ESC/Arrows/Enter)", query);
+        refreshScreen();
+
+        int c = readKey(fd);
+        if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
+            if (qlen != 0)
+                query[--qlen] = '\0';
+            last_match = -1;
+        } else if (c == ESC || c == ENTER) {
+            if (c == ESC) {
+                // The window over a huge file may have moved to a match.
+                restoreMatch(saved_hl_row, &saved_hl);
+                if (EC.buf->pager)
+                    pagerLoad(EC.buf, saved_above + saved_row_offset);
+                view->cx = saved_cx;
+                view->cy = saved_cy;
+                view->row_offset = saved_row_offset + saved_above -
+                    EC.buf->above;
+                view->col_offset = saved_col_offset;
+            }
+            break;
+        } else if (c == ARROW_RIGHT || c == ARROW_DOWN) {
+            find_next = 1;
+        } else if (c == ARROW_LEFT || c == ARROW_UP) {
+            find_next = -1;
+        } else if (c >= 0 && c < 256 && (isprint(c) || c >= 0x80)) {
+            if (qlen < FIND_QUERY_LEN) {
+                query[qlen++] = c;
+                query[qlen] = '\0';
+                last_match = -1;
+            }
+        }
+
+        // Search the next occurrence, starting from the top for a new query.
+        if (last_match == -1)
+            find_next = 1;
+        if (find_next && qlen) {
+            const char *match = NULL, *chars = NULL;
+            int current = last_match;
+
+            // Restore the highlight of the previous match.
+            restoreMatch(saved_hl_row, &saved_hl);
+
+            // One more step for a huge file, to go out of the rows.
+            int steps = EC.buf->numrows + (EC.buf->pager != NULL);
+            for (int i = 0; i < steps; i++) {
+                current += find_next;
+                // Out of the rows of a huge file, the rest of the file is
+                // searched and the window moved to the match.
+                if ((current == -1 || current == EC.buf->numrows) &&
+                        EC.buf->pager) {
+                    long long line = pagerFind(EC.buf, query, find_next);
+                    if (line != -1) {
+                        pagerLoad(EC.buf, line);
+                        current = line - EC.buf->above;
+                    }
+                }
+                if (current == -1)
+                    current = EC.buf->numrows - 1;
+                else if (current == EC.buf->numrows)
+                    current = 0;
+                // The frozen rows are searched without being thawed.
+                chars = coldPeek(EC.buf, current);
+                match = strstr(chars, query);
+                if (match)
+                    break;
+            }
+            find_next = 0;
+
+            if (match) {
+                int at = match - chars;
+                Erow *row = rowAt(EC.buf, current);
+                int start = rowRender(row, at);
+                int end = rowRender(row, at + qlen);
+
+                last_match = current;
+                if (row->hl) {
+                    saved_hl_row = current;
+                    saved_hl = malloc(row->rsize);
+                    memcpy(saved_hl, row->hl, row->rsize);
+                    row->hl = rowOwn(row->hl);
+                    memset(row->hl + start, HL_MATCH, end - start);
+                }
+                // A match in a closed fold opens it.
+                foldReveal(EC.buf, current);
+                view->cy = 0;
+                view->row_offset = current;
+                view->cx = at;
+                scrollCursor(view);
+            }
+        }
+    }
+
+    restoreMatch(saved_hl_row, &saved_hl);
+    EC.mode = NORMAL;
+    setStatusMsg("");
+}
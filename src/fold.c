@@ -0,0 +1,674 @@
+#include "chibidit.h"
+
+/* ================================ Folding =================================
+ *
+ * A fold is a range of rows of a buffer that may be closed: the views show
+ * it as a single line, with its number of rows and the text of its first
+ * row. Folds nest. They are made by hand with 'zf', 'zF' and ':fold', or by
+ * 'zc' from the block around the cursor: the braces outside the comments
+ * and the strings, as the highlight tells, or the indentation in the files
+ * that have no syntax highlight.
+ *
+ * The folds of a buffer are kept in a treap ordered by first row, and the
+ * outer ones first. Every node knows the largest last row of its subtree,
+ * as in an interval tree, so that the innermost fold around a row is found
+ * in O(log n). The rows hidden are those of the closed folds: the outermost
+ * closed folds are kept apart in a second treap, where they are disjoint
+ * and every node knows the rows hidden by its subtree. Mapping the rows to
+ * the lines of a view and back is then a walk down that tree, O(log n) with
+ * any number of folds, and opening or closing a fold looks at the folds
+ * inside it only. Rows inserted or deleted shift the folds after them at
+ * once: the shift is kept at the root of the subtree, and pushed down to
+ * its children when the tree is walked.
+ *
+ * Views in wrap mode show the folds open. */
+
+#define FOLD_SCAN_ROWS 100000   /* Rows looked at for a block by 'zc'. */
+
+struct fold {
+    int start, end;     /* First and last row. */
+    int closed;
+    unsigned prio;      /* Treap priority, larger at the root. */
+    int shift;          /* Rows to add to the folds below this one. */
+    int maxend;         /* Largest last row of the subtree. */
+    int hidden;         /* Rows after the first one of the folds of the
+                           subtree, the rows they hide when closed. */
+    struct fold *left, *right;
+};
+
+struct folds {
+    struct fold *all;   /* All the folds. */
+    struct fold *shut;  /* Copies of the outermost closed ones. */
+};
+
+static struct fold *newFold(int start, int end, int closed) {
+    static unsigned seed = 2463534242u;
+    struct fold *f = malloc(sizeof(*f));
+
+    if (f == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memset(f, 0, sizeof(*f));
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    f->prio = seed;
+    f->start = start;
+    f->end = f->maxend = end;
+    f->hidden = end - start;
+    f->closed = closed;
+    return f;
+}
+
+static void freeFolds(struct fold *t) {
+    if (t == NULL)
+        return;
+    freeFolds(t->left);
+    freeFolds(t->right);
+    free(t);
+}
+
+// Move the folds of the subtree 't' by 'delta' rows.
+static void shiftFolds(struct fold *t, int delta) {
+    if (t == NULL)
+        return;
+    t->start += delta;
+    t->end += delta;
+    t->maxend += delta;
+    t->shift += delta;
+}
+
+static void push(struct fold *t) {
+    if (t->shift) {
+        shiftFolds(t->left, t->shift);
+        shiftFolds(t->right, t->shift);
+        t->shift = 0;
+    }
+}
+
+static void pull(struct fold *t) {
+    t->maxend = t->end;
+    t->hidden = t->end - t->start;
+    if (t->left) {
+        if (t->left->maxend > t->maxend)
+            t->maxend = t->left->maxend;
+        t->hidden += t->left->hidden;
+    }
+    if (t->right) {
+        if (t->right->maxend > t->maxend)
+            t->maxend = t->right->maxend;
+        t->hidden += t->right->hidden;
+    }
+}
+
+// Does the fold 't' come before a fold of the rows 'start' to 'end' ?
+static int before(struct fold *t, int start, int end) {
+    return t->start < start || (t->start == start && t->end > end);
+}
+
+// Split 't' in the folds before the fold 'start', 'end' and the others.
+// With 'end' INT_MAX, in the folds that start before 'start' and the others.
+static void split(struct fold *t, int start, int end, struct fold **l,
+        struct fold **r) {
+    if (t == NULL) {
+        *l = *r = NULL;
+        return;
+    }
+    push(t);
+    if (before(t, start, end)) {
+        split(t->right, start, end, &t->right, r);
+        *l = t;
+    } else {
+        split(t->left, start, end, l, &t->left);
+        *r = t;
+    }
+    pull(t);
+}
+
+// Join two trees, the folds of 'a' come before those of 'b'.
+static struct fold *merge(struct fold *a, struct fold *b) {
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        push(a);
+        a->right = merge(a->right, b);
+        pull(a);
+        return a;
+    }
+    push(b);
+    b->left = merge(a, b->left);
+    pull(b);
+    return b;
+}
+
+// The innermost fold of 't' but 'not' around the rows 'from' to 'to', that
+// is the last one that starts at 'from' or before and ends at 'to' or after.
+static struct fold *innermost(struct fold *t, int from, int to,
+        struct fold *not) {
+    struct fold *f;
+
+    if (t == NULL || t->maxend < to)
+        return NULL;
+    push(t);
+    if (t->start <= from) {
+        if ((f = innermost(t->right, from, to, not)) != NULL)
+            return f;
+        if (t != not && t->end >= to)
+            return t;
+    }
+    return innermost(t->left, from, to, not);
+}
+
+// The last fold of 't' that starts at 'at' or before.
+static struct fold *lastFold(struct fold *t, int at) {
+    struct fold *f = NULL;
+
+    while (t) {
+        push(t);
+        if (t->start <= at) {
+            f = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return f;
+}
+
+// A closed fold of 't' of the rows 'start' to 'end', NULL if none.
+static struct fold *closedFold(struct fold *t, int start, int end) {
+    struct fold *f;
+
+    if (t == NULL)
+        return NULL;
+    push(t);
+    if (t->start == start && t->end == end && t->closed)
+        return t;
+    if (!before(t, start, end) &&
+            (f = closedFold(t->left, start, end)) != NULL)
+        return f;
+    if (before(t, start, end) || (t->start == start && t->end == end))
+        return closedFold(t->right, start, end);
+    return NULL;
+}
+
+// Append to 'shut' copies of the outermost closed folds of 't' that start
+// after the row '*last' and end at 'end' at the latest, '*last' is the last
+// row of the last one. Only the folds that start up to 'end' are looked at.
+static struct fold *shutFolds(struct fold *t, int *last, int end,
+        struct fold *shut) {
+    if (t == NULL)
+        return shut;
+    push(t);
+    if (t->start > *last)
+        shut = shutFolds(t->left, last, end, shut);
+    if (t->start > *last && t->start <= end && t->end <= end && t->closed) {
+        shut = merge(shut, newFold(t->start, t->end, 1));
+        *last = t->end;
+    }
+    if (t->start <= end)
+        shut = shutFolds(t->right, last, end, shut);
+    return shut;
+}
+
+static struct folds *bufFolds(Ebuf *buf) {
+    if (buf->folds == NULL) {
+        if ((buf->folds = malloc(sizeof(*buf->folds))) == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        memset(buf->folds, 0, sizeof(*buf->folds));
+    }
+    return buf->folds;
+}
+
+// Close the fold 'f' of 'folds'.
+static void closeFold(struct folds *folds, struct fold *f) {
+    struct fold *a, *b, *c, *out = lastFold(folds->shut, f->start);
+
+    f->closed = 1;
+    // Nothing more is hidden inside a closed fold.
+    if (out && out->end >= f->end)
+        return;
+    // It takes the place of the closed folds inside it.
+    split(folds->shut, f->start, INT_MAX, &a, &b);
+    split(b, f->end + 1, INT_MAX, &b, &c);
+    freeFolds(b);
+    folds->shut = merge(merge(a, newFold(f->start, f->end, 1)), c);
+}
+
+// Open the outermost closed fold of the rows 'start' to 'end': the closed
+// folds right inside it are the outermost ones now.
+static void openFold(struct folds *folds, int start, int end) {
+    struct fold *a, *b, *c, *f;
+    int last = start - 1;
+
+    while ((f = closedFold(folds->all, start, end)) != NULL)
+        f->closed = 0;
+    split(folds->shut, start, INT_MAX, &a, &b);
+    split(b, start + 1, INT_MAX, &b, &c);
+    freeFolds(b);
+    b = shutFolds(folds->all, &last, end, NULL);
+    folds->shut = merge(merge(a, b), c);
+}
+
+// Remove a fold of the rows of 'f' from the tree '*t'.
+static void eraseFold(struct fold **t, struct fold *f) {
+    struct fold *a, *b, *c;
+    int start = f->start, end = f->end;
+
+    split(*t, start, end, &a, &b);
+    split(b, start, end - 1, &b, &c);
+    if (b) {
+        push(b);
+        f = b;
+        b = merge(b->left, b->right);
+        free(f);
+    }
+    *t = merge(merge(a, b), c);
+}
+
+int foldActive(Eview *view) {
+    return !view->wrap && view->buf && view->buf->folds &&
+        view->buf->folds->shut;
+}
+
+// Line of the view that shows the row 'at', the line of its fold if it is
+// hidden. Rows and lines are the same when no fold is closed.
+int foldLine(Eview *view, int at) {
+    struct fold *t;
+    int hidden = 0;
+
+    if (!foldActive(view))
+        return at;
+    for (t = view->buf->folds->shut; t; ) {
+        push(t);
+        if (t->start >= at) {
+            t = t->left;
+            continue;
+        }
+        hidden += (t->left ? t->left->hidden : 0) +
+            (t->end < at ? t->end : at) - t->start;
+        t = t->right;
+    }
+    return at - hidden;
+}
+
+// Row shown on the line 'line' of the view. The lines past the end of the
+// buffer are one row each.
+int foldRow(Eview *view, int line) {
+    struct fold *t;
+    int hidden = 0;
+
+    if (!foldActive(view))
+        return line;
+    for (t = view->buf->folds->shut; t; ) {
+        int left;
+
+        push(t);
+        left = t->left ? t->left->hidden : 0;
+        // The first row of the fold is on this line.
+        if (t->start - hidden - left < line) {
+            hidden += left + t->end - t->start;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return line + hidden;
+}
+
+// Last row of the closed fold shown from the row 'at' of the view, -1 if
+// the row is not folded.
+int foldShut(Eview *view, int at) {
+    struct fold *f;
+
+    if (!foldActive(view))
+        return -1;
+    f = lastFold(view->buf->folds->shut, at);
+    return f && f->start == at ? f->end : -1;
+}
+
+// Scroll the view by the least number of lines that shows the cursor, the
+// cursor goes to the first row of the fold it is hidden in.
+void foldScroll(Eview *view) {
+    int filerow = view->row_offset + view->cy;
+    int cursor = foldLine(view, filerow);
+    int top = foldLine(view, view->row_offset);
+
+    if (cursor < top)
+        top = cursor;
+    else if (cursor >= top + view->screenrows)
+        top = cursor - view->screenrows + 1;
+    view->row_offset = foldRow(view, top);
+    view->cy = foldRow(view, cursor) - view->row_offset;
+    if (view->row_offset + view->cy != filerow)
+        clampCursor(view);
+}
+
+// Open the closed folds that hide the row 'at' of 'buf', or start at it.
+void foldReveal(Ebuf *buf, int at) {
+    struct fold *f;
+
+    while (buf->folds && (f = lastFold(buf->folds->shut, at)) != NULL &&
+            f->end >= at)
+        openFold(buf->folds, f->start, f->end);
+}
+
+// Add 'delta' to the last row of the folds of 't' that end at 'at' or
+// after it.
+static void growFolds(struct fold *t, int at, int delta) {
+    if (t == NULL || t->maxend < at)
+        return;
+    push(t);
+    if (t->end >= at)
+        t->end += delta;
+    growFolds(t->left, at, delta);
+    growFolds(t->right, at, delta);
+    pull(t);
+}
+
+// The rows from 'at' to 'end' excluded are gone: the folds of 't' that end
+// in them end before 'at' now, the ones that end after them end earlier.
+static void cutFolds(struct fold *t, int at, int end) {
+    if (t == NULL || t->maxend < at)
+        return;
+    push(t);
+    if (t->end >= end)
+        t->end -= end - at;
+    else if (t->end >= at)
+        t->end = at - 1;
+    cutFolds(t->left, at, end);
+    cutFolds(t->right, at, end);
+    pull(t);
+}
+
+// The folds of 't' start in the rows from 'at' to 'end' excluded, that are
+// gone. The folds that end in them are freed, the others start at 'at' now
+// and are appended to 'keep'.
+static struct fold *dropFolds(struct fold *t, int at, int end,
+        struct fold *keep) {
+    struct fold *l, *r;
+
+    if (t == NULL)
+        return keep;
+    push(t);
+    l = t->left;
+    r = t->right;
+    keep = dropFolds(l, at, end, keep);
+    if (t->end < end) {
+        free(t);
+    } else {
+        t->start = at;
+        t->end -= end - at;
+        t->left = t->right = NULL;
+        pull(t);
+        keep = merge(keep, t);
+    }
+    return dropFolds(r, at, end, keep);
+}
+
+static void insertRows(struct fold **t, int at, int n) {
+    struct fold *a, *b;
+
+    split(*t, at, INT_MAX, &a, &b);
+    growFolds(a, at, n);
+    shiftFolds(b, n);
+    *t = merge(a, b);
+}
+
+static void removeRows(struct fold **t, int at, int n) {
+    struct fold *a, *b, *c;
+
+    split(*t, at, INT_MAX, &a, &b);
+    split(b, at + n, INT_MAX, &b, &c);
+    cutFolds(a, at, at + n);
+    b = dropFolds(b, at, at + n, NULL);
+    shiftFolds(c, -n);
+    *t = merge(merge(a, b), c);
+}
+
+// The 'n' rows from 'at' of 'buf' were replaced by 'm' rows. The rows
+// replaced one by one keep their folds.
+void foldRowsChanged(Ebuf *buf, int at, int n, int m) {
+    struct folds *folds = buf->folds;
+
+    if (folds == NULL || n == m)
+        return;
+    if (n > m) {
+        removeRows(&folds->all, at + m, n - m);
+        removeRows(&folds->shut, at + m, n - m);
+    } else {
+        insertRows(&folds->all, at + n, m - n);
+        insertRows(&folds->shut, at + n, m - n);
+    }
+}
+
+void foldFree(Ebuf *buf) {
+    if (buf->folds == NULL)
+        return;
+    freeFolds(buf->folds->all);
+    freeFolds(buf->folds->shut);
+    free(buf->folds);
+    buf->folds = NULL;
+}
+
+// Make a closed fold of the rows 'from' to 'to' of the current buffer.
+// Returns -1 if it would cross another fold.
+int foldCreate(int from, int to) {
+    struct folds *folds = bufFolds(EC.buf);
+    struct fold *a, *b, *f;
+
+    // A fold around the row 'from' must end after 'to', a fold around the
+    // row 'to' and the one after must start before 'from'.
+    f = from > 0 ? innermost(folds->all, from - 1, from, NULL) : NULL;
+    if (f && f->end < to)
+        goto cross;
+    f = innermost(folds->all, to, to + 1, NULL);
+    if (f && f->start > from)
+        goto cross;
+    f = innermost(folds->all, from, to, NULL);
+    if (f == NULL || f->start != from || f->end != to) {
+        f = newFold(from, to, 0);
+        split(folds->all, from, to, &a, &b);
+        folds->all = merge(merge(a, f), b);
+    }
+    closeFold(folds, f);
+    return 0;
+
+cross:
+    setStatusMsg("Folds cannot cross");
+    return -1;
+}
+
+// First and last row of the innermost block in braces that the end of the
+// row 'at' is in. Returns -1 if there is none, or it is too far away.
+static int braceBlock(Ebuf *buf, int at, int *from, int *to) {
+    int col = buf->row[at].size;
+
+    // Back to the brace that opens it, and forward to the one that closes
+    // it.
+    *from = at;
+    if (bracketFind(buf, '{', from, &col, FOLD_SCAN_ROWS) == -1)
+        return -1;
+    *to = *from;
+    col++;
+    return bracketFind(buf, '}', to, &col, FOLD_SCAN_ROWS);
+}
+
+// Screen column of the first character of the row that is not blank, -1
+// if the row is blank.
+static int indentOf(Erow *row) {
+    for (int j = 0; j < row->size; j++)
+        if (row->chars[j] != ' ' && row->chars[j] != TAB)
+            return rowCol(row, j);
+    return -1;
+}
+
+// First and last row of the innermost indented block around the row 'at':
+// the row before it that is less indented, and the rows more indented
+// after it but the blank ones at the end. Returns -1 if there is none.
+static int indentBlock(Ebuf *buf, int at, int *from, int *to) {
+    int base = indentOf(rowAt(buf, at)), next = -1, head = -1, i;
+
+    for (i = at + 1; i < buf->numrows && i - at < FOLD_SCAN_ROWS; i++)
+        if ((next = indentOf(rowAt(buf, i))) != -1)
+            break;
+    if (base != -1 && next > base) {
+        head = at;
+    } else {
+        // A blank row belongs to the block of the next row.
+        if (base == -1 && (base = next) == -1)
+            return -1;
+        for (i = at - 1; i >= 0 && at - i < FOLD_SCAN_ROWS; i--) {
+            int indent = indentOf(rowAt(buf, i));
+            if (indent != -1 && indent < base) {
+                head = i;
+                break;
+            }
+        }
+        if (head == -1)
+            return -1;
+    }
+
+    base = indentOf(rowAt(buf, head));
+    *from = *to = head;
+    for (i = head + 1; i < buf->numrows && i - head < FOLD_SCAN_ROWS; i++) {
+        int indent = indentOf(rowAt(buf, i));
+        if (indent == -1)
+            continue;
+        if (indent <= base)
+            break;
+        *to = i;
+    }
+    return *to > head ? 0 : -1;
+}
+
+// First and last row of the innermost block around the rows 'from' to 'to'
+// that is larger than them: in braces when the buffer is highlighted, or
+// else by indentation. Returns -1 if there is none.
+static int blockAround(Ebuf *buf, int from, int to, int *bfrom, int *bto) {
+    int at = from;
+
+    while (at >= 0 && from - at < FOLD_SCAN_ROWS) {
+        if ((!buf->syntax || braceBlock(buf, at, bfrom, bto)) &&
+                indentBlock(buf, at, bfrom, bto))
+            return -1;
+        if (*bfrom <= from && *bto >= to && (*bfrom != from || *bto != to))
+            return 0;
+        // The block of the row before it is around it.
+        at = *bfrom - 1;
+    }
+    return -1;
+}
+
+// 'zc': close the innermost fold or block around the row 'at', or around
+// the closed fold shown at 'at'. The block is folded when it is inside the
+// fold, or when there is no fold.
+static void foldClose(int at) {
+    struct folds *folds = bufFolds(EC.buf);
+    struct fold *f = lastFold(folds->shut, at), *self = NULL;
+    int from = at, to = at, bfrom, bto;
+
+    if (f && f->start == at) {
+        to = f->end;
+        self = innermost(folds->all, from, to, NULL);
+    }
+    f = innermost(folds->all, from, to, self);
+    // The highlight of the row being edited is not in its hl.
+    rowCommit();
+    if (blockAround(EC.buf, from, to, &bfrom, &bto) == 0 &&
+            (f == NULL || (f->start <= bfrom && f->end >= bto &&
+                (f->start != bfrom || f->end != bto)))) {
+        if (foldCreate(bfrom, bto) == 0)
+            return;
+        setStatusMsg("");
+    }
+    if (f == NULL) {
+        setStatusMsg("No fold found");
+        return;
+    }
+    closeFold(folds, f);
+}
+
+// Open or close all the folds.
+static void foldAll(struct fold *t, int closed) {
+    if (t == NULL)
+        return;
+    t->closed = closed;
+    foldAll(t->left, closed);
+    foldAll(t->right, closed);
+}
+
+// Run the fold command 'z' 'key' on the cursor row, 'count' is the count
+// typed before it, 0 if none:
+//
+//   zF   fold 'count' lines, a closed fold is one
+//   zc   close a fold, see foldClose()
+//   zo   open the closed fold
+//   za   open or close it
+//   zd   delete the fold, the innermost one if it is open
+//   zE   delete all the folds
+//   zR   open all the folds
+//   zM   close all the folds
+void foldCommand(int key, long long count) {
+    Eview *view = EC.view;
+    struct folds *folds = bufFolds(EC.buf);
+    int at = view->row_offset + view->cy, end = foldShut(view, at);
+    int last = -1;
+    struct fold *f;
+
+    if (key == 'a')
+        key = end == -1 ? 'c' : 'o';
+    switch (key) {
+    case 'E':
+        foldFree(EC.buf);
+        break;
+    case 'R':
+        foldAll(folds->all, 0);
+        freeFolds(folds->shut);
+        folds->shut = NULL;
+        break;
+    case 'M':
+        foldAll(folds->all, 1);
+        freeFolds(folds->shut);
+        folds->shut = shutFolds(folds->all, &last, INT_MAX, NULL);
+        break;
+    case 'F':
+        if (at >= EC.buf->numrows)
+            break;
+        if (count < 1)
+            count = 1;
+        if (count > EC.buf->numrows - at)
+            count = EC.buf->numrows - at;
+        end = foldRow(view, foldLine(view, at) + count) - 1;
+        foldCreate(at, end < EC.buf->numrows ? end : EC.buf->numrows - 1);
+        break;
+    case 'c':
+        if (at < EC.buf->numrows)
+            foldClose(at);
+        break;
+    case 'o':
+        if (end != -1)
+            openFold(folds, at, end);
+        break;
+    case 'd':
+        if (end != -1) {
+            openFold(folds, at, end);
+            f = innermost(folds->all, at, end, NULL);
+        } else {
+            f = innermost(folds->all, at, at, NULL);
+        }
+        if (f == NULL) {
+            setStatusMsg("No fold found");
+            break;
+        }
+        eraseFold(&folds->all, f);
+        break;
+    }
+    scrollCursor(view);
+}
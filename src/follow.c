@@ -0,0 +1,154 @@
+#include "chibidit.h"
+
+/* ============================== Follow mode ===============================
+ *
+ * A followed buffer shows a growing file, a log most of the time, as 'tail
+ * -f' does. The buffer remembers how many bytes of the file it has read, and
+ * when the file changes only the bytes after them are read and appended as
+ * new rows, so that only the new rows are rendered and highlighted. A view
+ * with the cursor on the last row keeps showing the end of the file.
+ *
+ * A file that got shorter was truncated or replaced, as by a log rotation,
+ * and is read again from its start. The changes of the files are collected
+ * by src/watch.c. */
+
+#define FOLLOW_CHUNK (1024 * 1024)  /* Bytes read at once. */
+
+// Append the 'len' bytes of 's' to the rows of the current buffer, the
+// first ones to the last row if it had no newline yet. 's' is modified.
+static void appendBytes(char *s, int len) {
+    Ebuf *buf = EC.buf;
+
+    while (len > 0) {
+        char *nl = memchr(s, '\n', len);
+        int linelen = nl ? nl - s : len;
+
+        s[linelen] = '\0';
+        if (buf->partial && buf->numrows) {
+            rowAppendString(rowAt(buf, buf->numrows - 1), s, linelen);
+        } else {
+            rowArenaUse(linelen > LONG_ROW_SIZE ? NULL : buf->arena);
+            insertRow(buf->numrows, s, linelen);
+        }
+        buf->partial = nl == NULL;
+        s += linelen + 1;
+        len -= linelen + 1;
+    }
+    rowArenaUse(NULL);
+}
+
+// Read what was written to the file of 'buf' past the bytes already read.
+// Returns the number of bytes read, or -1 if the file was read again from
+// the start.
+static long long followRead(Ebuf *buf) {
+    static char *chunk;
+    struct stat st;
+    long long total = 0;
+    int fd, truncated = 0;
+
+    fd = open(buf->filename, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    if (fstat(fd, &st) == -1 || st.st_size == buf->loaded) {
+        close(fd);
+        return 0;
+    }
+    if (chunk == NULL && (chunk = malloc(FOLLOW_CHUNK + 1)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+
+    // The rows are appended to the current buffer, and the dirty flag is
+    // about the edits of the user only.
+    Ebuf *cur = EC.buf;
+    int dirty = buf->dirty;
+    EC.buf = buf;
+    if (st.st_size < buf->loaded) {
+        delRows(0, buf->numrows);
+        undoFree(buf);
+        buf->loaded = 0;
+        buf->partial = 0;
+        truncated = 1;
+    }
+    if (buf->arena == NULL && buf->cold == NULL)
+        buf->arena = rowArenaNew();
+    // Stop at the size seen now, the bytes written meanwhile will come with
+    // an event of their own.
+    ssize_t n;
+    while (buf->loaded < st.st_size &&
+            (n = pread(fd, chunk, st.st_size - buf->loaded < FOLLOW_CHUNK ?
+                st.st_size - buf->loaded : FOLLOW_CHUNK, buf->loaded)) > 0) {
+        appendBytes(chunk, n);
+        buf->loaded += n;
+        total += n;
+    }
+    buf->dirty = dirty;
+    buf->mtime = st.st_mtim;
+    EC.buf = cur;
+    close(fd);
+    return truncated ? -1 : total;
+}
+
+// Move the cursor of the views of 'buf' that were on its last row, before
+// rows were appended after 'oldrows', to the new last row.
+static void followViews(Elayout *node, Ebuf *buf, int oldrows) {
+    if (node->type != LAYOUT_VIEW) {
+        followViews(node->child[0], buf, oldrows);
+        followViews(node->child[1], buf, oldrows);
+        return;
+    }
+    Eview *view = node->view;
+    int filerow = view->row_offset + view->cy;
+    if (view->buf != buf)
+        return;
+    if (filerow >= oldrows - 1 || filerow >= buf->numrows)
+        gotoRow(view, buf->numrows - 1);
+}
+
+// Append the 'len' bytes of 's' to the rows of 'buf' as if they were read
+// from its file. 's' is modified, and must have room for one more byte.
+void followAppend(Ebuf *buf, char *s, int len) {
+    Ebuf *cur = EC.buf;
+    int dirty = buf->dirty, oldrows = buf->numrows;
+
+    EC.buf = buf;
+    appendBytes(s, len);
+    buf->dirty = dirty;
+    EC.buf = cur;
+    followViews(EC.layout, buf, oldrows);
+}
+
+// Read the new bytes of 'buf', returns non zero if the rows changed.
+int followUpdate(Ebuf *buf) {
+    int oldrows = buf->numrows;
+    long long n = followRead(buf);
+
+    if (n == 0)
+        return 0;
+    followViews(EC.layout, buf, n == -1 ? 0 : oldrows);
+    if (n == -1)
+        setStatusMsg("%.20s was truncated, read again", buf->filename);
+    return 1;
+}
+
+// Start or stop following the file of 'buf'.
+void followFile(Ebuf *buf, int on) {
+    if (buf->filename == NULL)
+        return;
+    buf->follow = on;
+    if (on)
+        followUpdate(buf);
+}
+
+void followToggle(void) {
+    if (EC.buf->filename == NULL) {
+        setStatusMsg("No file name");
+        return;
+    }
+    if (EC.buf->window) {
+        setStatusMsg("The buffer is read only");
+        return;
+    }
+    followFile(EC.buf, !EC.buf->follow);
+    setStatusMsg("Follow %s", EC.buf->follow ? "on" : "off");
+}
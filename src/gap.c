@@ -0,0 +1,435 @@
+#include "chibidit.h"
+
+/* ======================== Gap buffer of the edited row ====================
+ *
+ * Inserting or deleting a character used to move all the bytes on its right
+ * and to render and highlight the whole row again, so typing got slower with
+ * the length of the line. Instead, the row being edited is moved into a gap
+ * buffer: its bytes are kept at the two ends of a larger array, and the
+ * edits just fill or widen the hole in the middle, that is moved where the
+ * cursor is. The highlight, the lexer state and the screen column of every
+ * byte are kept in arrays with a gap at the same place, and only the span
+ * an edit may affect is updated:
+ *
+ * - The columns after the gap are stored relative to 'coldelta', so that
+ *   shifting all of them is a single addition. The ones up to the first TAB
+ *   after the edit are updated one by one, since the TAB absorbs the shift
+ *   up to the next tab stop.
+ * - The highlight resumes from the lexer state stored a few bytes before
+ *   the edit, and stops as soon as the state is the one stored before the
+ *   edit, see highlightSpan().
+ *
+ * While a row is in the gap buffer, row->gap is set and its chars, render,
+ * hl and cols are not valid: the functions in edit.c and screen.c access it
+ * with the functions below, and its highlight is indexed by chars instead
+ * of render. There is only one such row at a time. It goes back to plain
+ * rows, with all its arrays built again by updateRow(), when the cursor
+ * leaves it, or when the whole row is needed by some other code (saving,
+ * searching, splitting it...) that must call rowCommit() first. */
+
+// Bytes before an edit from where the highlight is resumed: no token can
+// look further ahead, since this is longer than any keyword.
+#define GAP_LOOKBEHIND 32
+#define GAP_MIN_SIZE 64
+
+struct rowGap {
+    char *chars;            /* Bytes, cap + 1 for the null term. */
+    unsigned char *hl;      /* Highlight of every byte. */
+    unsigned char *st;      /* Lexer state before every byte. */
+    int *cols;              /* Screen column of every byte, cap + 1 entries.
+                               NULL as long as the row is ASCII without
+                               TABs, where the column is the offset. */
+    int cap;                /* Capacity, gap included. */
+    int gap, gapend;        /* The gap is [gap, gapend). */
+    int coldelta;           /* Added to the cols after the gap. */
+    int tabs;               /* Number of TABs after the gap. */
+};
+
+static Ebuf *active_buf;    /* Buffer and index of the row in the gap, */
+static int active_row;      /* if active_buf is not NULL. */
+
+// Index in the arrays of the byte at offset 'at' of the row.
+#define GAP_INDEX(g, at) ((at) < (g)->gap ? (at) : (at) + (g)->gapend - (g)->gap)
+
+static int gapCol(struct rowGap *g, int at) {
+    if (at < g->gap)
+        return g->cols[at];
+    return g->cols[at + g->gapend - g->gap] + g->coldelta;
+}
+
+static int countTabs(const char *s, int len) {
+    int tabs = 0;
+    for (int j = 0; j < len; j++)
+        if (s[j] == TAB)
+            tabs++;
+    return tabs;
+}
+
+// Move the gap at offset 'at', shifting the bytes in between.
+static void moveGap(struct rowGap *g, int at) {
+    int gaplen = g->gapend - g->gap;
+
+    if (at < g->gap) {
+        int n = g->gap - at;
+        memmove(g->chars + at + gaplen, g->chars + at, n);
+        memmove(g->hl + at + gaplen, g->hl + at, n);
+        memmove(g->st + at + gaplen, g->st + at, n);
+        if (g->cols) {
+            for (int j = n - 1; j >= 0; j--)
+                g->cols[at + gaplen + j] = g->cols[at + j] - g->coldelta;
+        }
+        g->tabs += countTabs(g->chars + at + gaplen, n);
+        g->gap -= n;
+        g->gapend -= n;
+    } else if (at > g->gap) {
+        int n = at - g->gap;
+        g->tabs -= countTabs(g->chars + g->gapend, n);
+        memmove(g->chars + g->gap, g->chars + g->gapend, n);
+        memmove(g->hl + g->gap, g->hl + g->gapend, n);
+        memmove(g->st + g->gap, g->st + g->gapend, n);
+        if (g->cols) {
+            for (int j = 0; j < n; j++)
+                g->cols[g->gap + j] = g->cols[g->gapend + j] + g->coldelta;
+        }
+        g->gap += n;
+        g->gapend += n;
+    }
+}
+
+// Make room for at least 'n' bytes in the gap, doubling the capacity so
+// that a sequence of inserts is amortized O(1).
+static void growGap(struct rowGap *g, int n) {
+    if (g->gapend - g->gap >= n)
+        return;
+
+    int tail = g->cap - g->gapend;
+    int cap = (g->cap - (g->gapend - g->gap) + n) * 2;
+    g->chars = rowRealloc(g->chars, cap + 1);
+    g->hl = rowRealloc(g->hl, cap);
+    g->st = rowRealloc(g->st, cap);
+    // The bytes after the gap go to the end, with the null term and the
+    // column of the end of the row.
+    memmove(g->chars + cap - tail, g->chars + g->gapend, tail + 1);
+    memmove(g->hl + cap - tail, g->hl + g->gapend, tail);
+    memmove(g->st + cap - tail, g->st + g->gapend, tail);
+    if (g->cols) {
+        g->cols = rowRealloc(g->cols, sizeof(int) * (cap + 1));
+        memmove(g->cols + cap - tail, g->cols + g->gapend, sizeof(int) * (tail + 1));
+    }
+    g->gapend = cap - tail;
+    g->cap = cap;
+}
+
+// Compute the columns of all the row, once it has TABs or multi-byte
+// characters.
+static void buildCols(Erow *row) {
+    struct rowGap *g = row->gap;
+    int col = 0;
+
+    g->cols = rowAlloc(sizeof(int) * (g->cap + 1));
+    g->coldelta = 0;
+    for (int j = 0; j < row->size;) {
+        int cp, n = rowGapDecode(row, j, &cp);
+        int c = rowGapByte(row, j);
+
+        for (; n > 0; n--, j++)
+            g->cols[GAP_INDEX(g, j)] = col;
+        if (c == TAB) {
+            col++;
+            while ((col + 1) % 8 != 0)
+                col++;
+        } else {
+            col += cp < 0 ? 1 : utf8Width(cp);
+        }
+    }
+    g->cols[g->cap] = col;
+}
+
+// Update the columns after the bytes [start, end) changed, the gap being at
+// 'end'. Columns are computed again from the character before 'start' up to
+// where the ones on the right are all shifted by the same amount, that is
+// up to the first TAB after the edit, or just past the edit if there are no
+// more TABs.
+static void updateCols(Erow *row, int start, int end) {
+    struct rowGap *g = row->gap;
+    int j, col, seen = 0;
+
+    if (g->cols == NULL) {
+        for (j = start; j < end; j++) {
+            int c = rowGapByte(row, j);
+            if (c == TAB || c >= 0x80) {
+                buildCols(row);
+                break;
+            }
+        }
+        return;
+    }
+
+    // The character before the edit may now take some of the bytes after
+    // it, or the other way around. Start from its first byte, that is the
+    // byte before the edit itself if it is a stray continuation byte: a
+    // character has at most three of them.
+    j = start > 0 ? start - 1 : 0;
+    while (j > 0 && start - 1 - j < 3 && (rowGapByte(row, j) & 0xc0) == 0x80)
+        j--;
+    if ((rowGapByte(row, j) & 0xc0) == 0x80)
+        j = start > 0 ? start - 1 : 0;
+    col = j > 0 ? gapCol(g, j) : 0;
+
+    while (1) {
+        int c = rowGapByte(row, j);
+        if (j == row->size || (j >= end && (c & 0xc0) != 0x80 &&
+                    (seen || g->tabs == 0)))
+            break;
+
+        int cp, n = rowGapDecode(row, j, &cp);
+        if (j >= end && c == TAB)
+            seen++;
+        for (int k = 0; k < n; k++) {
+            // Columns after the gap are stored as they are for now, they
+            // are made relative to the new coldelta at the end.
+            g->cols[GAP_INDEX(g, j + k)] = col;
+        }
+        if (c == TAB) {
+            col++;
+            while ((col + 1) % 8 != 0)
+                col++;
+        } else {
+            col += cp < 0 ? 1 : utf8Width(cp);
+        }
+        j += n;
+    }
+
+    // Everything from 'j' on moves by the same amount.
+    int coldelta = col - gapCol(g, j);
+    for (int k = end; k < j; k++)
+        g->cols[GAP_INDEX(g, k)] -= g->coldelta + coldelta;
+    g->coldelta += coldelta;
+}
+
+// Highlight the row again from a little before 'from', stopping once the
+// lexer state at or after 'converge' is the same as before the edit.
+static void relex(Erow *row, int from, int converge) {
+    struct rowGap *g = row->gap;
+    struct editorSyntax *syntax = active_buf->syntax;
+
+    // In batch the whole row is highlighted once committed, see
+    // syntaxFlush().
+    if (EC.batch)
+        return;
+    if (syntax == NULL) {
+        for (int j = from; j < converge && j < row->size; j++)
+            g->hl[GAP_INDEX(g, j)] = HL_NORMAL;
+        return;
+    }
+
+    // Resume from a byte where the lexer state is known, the first one
+    // of the row depends on the previous row.
+    from = from > GAP_LOOKBEHIND ? from - GAP_LOOKBEHIND : 0;
+    while (from > 0 && g->st[GAP_INDEX(g, from)] == HLS_NONE)
+        from--;
+    int state = g->st[GAP_INDEX(g, from)];
+    if (from == 0) {
+        state = HLS_SEP;
+        if (row->idx > 0 ?
+                rowHasOpenComment(&active_buf->row[row->idx - 1]) :
+                active_buf->above_oc)
+            state |= HLS_COMMENT;
+    }
+
+    // The bytes from the gap on are contiguous.
+    moveGap(g, from);
+    int off = g->gapend - g->gap;
+    highlightSpan(syntax, g->chars + off, from, row->size, g->hl + off,
+            g->st + off, state, converge);
+}
+
+// Move the row into the gap buffer, if it is not already there.
+static struct rowGap *activate(Erow *row) {
+    struct rowGap *g = row->gap;
+
+    if (g)
+        return g;
+    rowCommit();
+
+    g = malloc(sizeof(*g));
+    if (g == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    // The gap starts at the end of the row.
+    g->cap = row->size + (row->size / 4 > GAP_MIN_SIZE ? row->size / 4 : GAP_MIN_SIZE);
+    g->gap = row->size;
+    g->gapend = g->cap;
+    g->coldelta = 0;
+    g->tabs = 0;
+    g->chars = rowAlloc(g->cap + 1);
+    memcpy(g->chars, row->chars, row->size);
+    g->chars[g->cap] = '\0';
+    g->hl = rowAlloc(g->cap);
+    g->st = rowAlloc(g->cap);
+    g->cols = NULL;
+    if (row->cols) {
+        g->cols = rowAlloc(sizeof(int) * (g->cap + 1));
+        memcpy(g->cols, row->cols, sizeof(int) * row->size);
+        g->cols[g->cap] = row->cols[row->size];
+    }
+
+    rowFree(row->chars);
+    rowFree(row->render);
+    rowFree(row->hl);
+    rowFree(row->cols);
+    row->chars = row->render = NULL;
+    row->hl = NULL;
+    row->cols = row->rx = NULL;
+    row->rsize = 0;
+    row->gap = g;
+    active_buf = EC.buf;
+    active_row = row->idx;
+
+    relex(row, 0, row->size + 1);
+    return g;
+}
+
+// Propagate the change of the open comment state at the end of the row to
+// the following rows.
+static void updateNextRows(Erow *row) {
+    // In batch the highlight is not up to date, nor needed yet.
+    if (EC.batch) {
+        row->hl_oc = HL_OC_DEFERRED;
+        return;
+    }
+    int oc = rowHasOpenComment(row);
+    if (row->hl_oc != oc) {
+        row->hl_oc = oc;
+        if (row->idx + 1 < EC.buf->numrows)
+            updateSyntaxHighLight(&EC.buf->row[row->idx + 1]);
+    }
+}
+
+// Insert 'len' bytes of 's' at offset 'at' of the row.
+void rowGapInsert(Erow *row, int at, const char *s, int len) {
+    struct rowGap *g = activate(row);
+
+    moveGap(g, at);
+    growGap(g, len);
+    memcpy(g->chars + g->gap, s, len);
+    g->gap += len;
+    row->size += len;
+
+    updateCols(row, at, at + len);
+    PROF_START(start);
+    relex(row, at, at + len);
+    PROF_STOP(PROF_HIGHLIGHT, start);
+    PROF_COUNT(PROF_ROWS, 1);
+    updateNextRows(row);
+    wrapRowChanged(row);
+    motionRowChanged(row);
+    coldRowChanged(row);
+}
+
+// Delete 'len' bytes at offset 'at' of the row.
+void rowGapDelete(Erow *row, int at, int len) {
+    struct rowGap *g = activate(row);
+
+    moveGap(g, at);
+    g->tabs -= countTabs(g->chars + g->gapend, len);
+    g->gapend += len;
+    row->size -= len;
+
+    updateCols(row, at, at);
+    PROF_START(start);
+    relex(row, at, at);
+    PROF_STOP(PROF_HIGHLIGHT, start);
+    PROF_COUNT(PROF_ROWS, 1);
+    updateNextRows(row);
+    wrapRowChanged(row);
+    motionRowChanged(row);
+    coldRowChanged(row);
+}
+
+// The open comment state at the start of the row changed, highlight it all.
+void rowGapHighlight(Erow *row) {
+    relex(row, 0, row->size + 1);
+}
+
+int rowGapOpenComment(Erow *row) {
+    int size = row->size;
+
+    if (size == 0 || rowGapHl(row, size - 1) != HL_MLCOMMENT)
+        return 0;
+    return size < 2 || rowGapByte(row, size - 2) != '*' ||
+        rowGapByte(row, size - 1) != '/';
+}
+
+int rowGapByte(Erow *row, int at) {
+    return (unsigned char)row->gap->chars[GAP_INDEX(row->gap, at)];
+}
+
+int rowGapHl(Erow *row, int at) {
+    return row->gap->hl[GAP_INDEX(row->gap, at)];
+}
+
+// Screen column of the byte at offset 'at', see rowCol().
+int rowGapCol(Erow *row, int at) {
+    struct rowGap *g = row->gap;
+
+    if (g->cols == NULL)
+        return at;
+    if (at > row->size)
+        return gapCol(g, row->size) + at - row->size;
+    return gapCol(g, at);
+}
+
+// Decode the character at offset 'at', that may span the gap.
+int rowGapDecode(Erow *row, int at, int *cp) {
+    char buf[4];
+    int n = 0;
+
+    while (n < 4 && at + n < row->size) {
+        buf[n] = rowGapByte(row, at + n);
+        n++;
+    }
+    return utf8Decode(buf, n, cp);
+}
+
+void rowGapFree(Erow *row) {
+    struct rowGap *g = row->gap;
+
+    rowFree(g->chars);
+    rowFree(g->hl);
+    rowFree(g->st);
+    rowFree(g->cols);
+    free(g);
+    row->gap = NULL;
+    active_buf = NULL;
+}
+
+// Move the row in the gap buffer, if any, back to a plain row.
+void rowCommit(void) {
+    if (active_buf == NULL)
+        return;
+
+    Ebuf *buf = active_buf, *cur = EC.buf;
+    Erow *row = &buf->row[active_row];
+    struct rowGap *g = row->gap;
+
+    moveGap(g, row->size);
+    g->chars[row->size] = '\0';
+    row->chars = rowRealloc(g->chars, row->size + 1);
+    g->chars = NULL;
+    rowGapFree(row);
+
+    // updateRow() works on the current buffer, the row may belong to
+    // another one.
+    EC.buf = buf;
+    updateRow(row);
+    EC.buf = cur;
+}
+
+// Commit the row in the gap buffer if the cursor is not on it anymore.
+void rowCommitIfLeft(void) {
+    if (active_buf && (active_buf != EC.buf ||
+                active_row != EC.view->row_offset + EC.view->cy))
+        rowCommit();
+}
@@ -0,0 +1,393 @@
+#include "chibidit.h"
+
+/* ============================ Ranges of lines =============================
+ *
+ * Commands that keep or reorder whole lines, as ':g/pattern/d' or ':sort',
+ * do not copy them: the rows kept are moved in the array of rows, already
+ * rendered and highlighted, and share their chars with the undo group that
+ * takes the old rows (see rowShare() in src/alloc.c). The change is a single
+ * edit of the group, so undoing it moves the rows once as well. Only the
+ * rows that now follow another open comment state are highlighted again. */
+
+// Open comment state left by the row before 'at' of the current buffer, as
+// of its last highlight: the rows are rarely in the cache when moved.
+static int ocBefore(int at) {
+    return at > 0 ? EC.buf->row[at - 1].hl_oc : 0;
+}
+
+// Put the 'm' rows of 'rows', taken from the range [from, from + n) of the
+// current buffer, in place of that range as a single change that can be
+// undone. The rows of the range whose flag in 'keep' is not set are freed,
+// 'keep' is NULL if all of them are moved. When they were highlighted, the
+// row of 'rows' at 'j' followed the open comment state 'before[j]', and the
+// row after the range 'after'.
+static void moveRows(int from, int n, Erow *rows, int m, const char *keep,
+        const char *before, int after) {
+    Ebuf *buf = EC.buf;
+    int oc = ocBefore(from), *update, nupdate = 0;
+
+    if ((update = malloc(sizeof(int) * (m + 1))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    undoBegin();
+    undoSave(from, n, m, &buf->row[from]);
+    for (int j = 0; keep && j < n; j++) {
+        if (keep[j])
+            continue;
+        buf->row[from + j].chars = NULL;
+        freeRow(&buf->row[from + j]);
+    }
+    // The old chars belong to the group now, the rows moved share them.
+    for (int j = 0; j < m; j++) {
+        rows[j].chars = rowShare(rows[j].chars);
+        if (before[j] != oc)
+            update[nupdate++] = from + j;
+        oc = rows[j].hl_oc;
+    }
+    if (from + n < buf->numrows && after != oc)
+        update[nupdate++] = from + m;
+    spliceRows(from, n, rows, m);
+    for (int j = 0; j < nupdate; j++)
+        updateSyntaxHighLight(&buf->row[update[j]]);
+    free(update);
+    buf->dirty++;
+    undoEnd();
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+// Remove the rows [from, to] of the current buffer whose flag in 'keep',
+// indexed from 'from', is not set. Returns the number of rows removed.
+int filterRows(int from, int to, const char *keep) {
+    Ebuf *buf = EC.buf;
+    int n = to - from + 1, m = 0;
+    Erow *rows = xmalloc(sizeof(Erow) * (n + 1));
+    char *before = xmalloc(n + 1);
+
+    rowCommit();
+    for (int j = 0; j < n; j++) {
+        if (!keep[j])
+            continue;
+        before[m] = ocBefore(from + j);
+        rows[m++] = buf->row[from + j];
+    }
+    if (m < n)
+        moveRows(from, n, rows, m, keep, before, ocBefore(to + 1));
+    free(rows);
+    free(before);
+    return n - m;
+}
+
+// Rows scanned by a task of the pool.
+#define LINES_TASK_ROWS 16384
+// Runs shorter than this are sorted by insertion.
+#define SORT_INSERTION 16
+
+// Run 'fn' on the pool for the rows [from, to], in tasks of LINES_TASK_ROWS
+// rows: 'fn(arg, task)' scans the rows from 'from + task * LINES_TASK_ROWS'.
+static void poolRows(int from, int to, void (*fn)(void *arg, int task), void *arg) {
+    int ntasks = (to - from) / LINES_TASK_ROWS + 1;
+
+    if (ntasks == 1)
+        fn(arg, 0);
+    else
+        poolRun(ntasks, fn, arg);
+}
+
+struct matchJob {
+    Erow *row;          /* First row scanned. */
+    int n;
+    const char *pat;
+    int invert;
+    char *match;        /* Flag of every row. */
+    int *count;         /* Rows matched by every task. */
+};
+
+static void matchTask(void *arg, int task) {
+    struct matchJob *job = arg;
+    int from = task * LINES_TASK_ROWS, to = from + LINES_TASK_ROWS, count = 0;
+
+    if (to > job->n)
+        to = job->n;
+    for (int j = from; j < to; j++) {
+        job->match[j] = (strstr(job->row[j].chars, job->pat) != NULL) != job->invert;
+        count += job->match[j];
+    }
+    job->count[task] = count;
+}
+
+// Set the flag in 'match' of the rows [from, to] of the current buffer that
+// contain 'pat', or that do not if 'invert' is set, on the thread pool.
+// Returns the number of rows flagged.
+int matchRows(int from, int to, const char *pat, int invert, char *match) {
+    int ntasks = (to - from) / LINES_TASK_ROWS + 1, matches = 0;
+    struct matchJob job = {EC.buf->row + from, to - from + 1, pat, invert,
+        match, xmalloc(sizeof(int) * ntasks)};
+
+    rowCommit();
+    poolRows(from, to, matchTask, &job);
+    for (int t = 0; t < ntasks; t++)
+        matches += job.count[t];
+    free(job.count);
+    return matches;
+}
+
+/* Sorting. The key of every row is extracted first, on the pool: its first
+ * eight bytes, big endian, or its number made an unsigned integer of the
+ * same order, so that most comparisons are made without touching the rows.
+ * The keys are sorted by a merge sort, that keeps the order of equal rows:
+ * a run for every task, then the runs are merged by pairs in parallel, in
+ * as many rounds as it takes. */
+
+struct sortKey {
+    uint64_t prefix;    /* First bytes of the key, or its number. */
+    const char *s;      /* The key, 'len' bytes, NULL if numeric. */
+    int len;
+    int idx;            /* Row, from the first one sorted. */
+};
+
+struct sortJob {
+    Erow *row;          /* First row sorted. */
+    int n;
+    int flags;          /* SORT_* */
+    int field, column;  /* The key starts at this field, or column, from 1. */
+    struct sortKey *keys, *tmp;
+    int *runs;          /* Start of every run, and 'n' after the last. */
+    int nruns;
+};
+
+// Compare the keys 'a' and 'b', in the reverse order if 'rev' is set.
+static inline int cmpKeys(const struct sortKey *a, const struct sortKey *b, int rev) {
+    int c = 0;
+
+    if (a->prefix != b->prefix)
+        c = a->prefix < b->prefix ? -1 : 1;
+    else if (a->len > 8 && b->len > 8)
+        c = memcmp(a->s + 8, b->s + 8, (a->len < b->len ? a->len : b->len) - 8);
+    if (c == 0 && a->len != b->len)
+        c = a->len < b->len ? -1 : 1;
+    return rev ? -c : c;
+}
+
+// Find the key 'k' of the row 'idx' of the job.
+static void sortKey(struct sortJob *job, struct sortKey *k, int idx) {
+    Erow *row = &job->row[idx];
+    const char *s = row->chars, *end = row->chars + row->size;
+
+    if (job->column) {
+        s += job->column - 1 < row->size ? job->column - 1 : row->size;
+    } else if (job->field) {
+        // Fields are separated by blanks, the ones at the start of the row
+        // don't count.
+        for (int f = 1; s < end && f <= job->field; f++) {
+            while (s < end && (*s == ' ' || *s == '\t'))
+                s++;
+            if (f == job->field)
+                break;
+            while (s < end && *s != ' ' && *s != '\t')
+                s++;
+        }
+    }
+    k->idx = idx;
+    if (job->flags & SORT_NUMERIC) {
+        // The first number, the rows without any sort before the others.
+        while (s < end && !isdigit((unsigned char)*s))
+            s++;
+        k->s = NULL;
+        k->len = 0;
+        k->prefix = 0;
+        if (s == end)
+            return;
+        if (s > row->chars && s[-1] == '-')
+            s--;
+        double d = strtod(s, NULL);
+        uint64_t u;
+        memcpy(&u, &d, sizeof(u));
+        k->prefix = u >> 63 ? ~u : u | 1ULL << 63;
+        return;
+    }
+    k->s = s;
+    k->len = end - s;
+    k->prefix = 0;
+    for (int j = 0; j < 8; j++)
+        k->prefix = k->prefix << 8 | (j < k->len ? (unsigned char)s[j] : 0);
+}
+
+// Merge the sorted runs a[0..n) and b[0..m) into 'dst', the ones of 'a'
+// first when equal.
+static void mergeKeys(struct sortKey *dst, const struct sortKey *a, int n,
+        const struct sortKey *b, int m, int rev) {
+    int i = 0, j = 0;
+
+    while (i < n && j < m)
+        *dst++ = cmpKeys(&b[j], &a[i], rev) < 0 ? b[j++] : a[i++];
+    memcpy(dst, a + i, sizeof(*a) * (n - i));
+    memcpy(dst + n - i, b + j, sizeof(*b) * (m - j));
+}
+
+// Sort the 'n' keys of 'a', with 'tmp' as large for the merges.
+static void sortRun(struct sortKey *a, struct sortKey *tmp, int n, int rev) {
+    if (n <= SORT_INSERTION) {
+        for (int j = 1; j < n; j++) {
+            struct sortKey k = a[j];
+            int i = j;
+            for (; i > 0 && cmpKeys(&k, &a[i - 1], rev) < 0; i--)
+                a[i] = a[i - 1];
+            a[i] = k;
+        }
+        return;
+    }
+    int h = n / 2;
+    sortRun(a, tmp, h, rev);
+    sortRun(a + h, tmp + h, n - h, rev);
+    if (cmpKeys(&a[h], &a[h - 1], rev) >= 0)
+        return;
+    memcpy(tmp, a, sizeof(*a) * h);
+    mergeKeys(a, tmp, h, a + h, n - h, rev);
+}
+
+// Find the keys of a run and sort them, on a thread of the pool.
+static void sortTask(void *arg, int task) {
+    struct sortJob *job = arg;
+    int from = job->runs[task], to = job->runs[task + 1];
+
+    for (int j = from; j < to; j++)
+        sortKey(job, &job->keys[j], j);
+    sortRun(job->keys + from, job->tmp + from, to - from,
+            job->flags & SORT_REVERSE);
+}
+
+// Merge the runs 2 * task and 2 * task + 1 from 'keys' into 'tmp'.
+static void mergeTask(void *arg, int task) {
+    struct sortJob *job = arg;
+    int *r = job->runs + 2 * task;
+
+    if (2 * task + 1 == job->nruns)
+        memcpy(job->tmp + r[0], job->keys + r[0],
+                sizeof(struct sortKey) * (r[1] - r[0]));
+    else
+        mergeKeys(job->tmp + r[0], job->keys + r[0], r[1] - r[0],
+                job->keys + r[1], r[2] - r[1], job->flags & SORT_REVERSE);
+}
+
+// Sort the rows [from, to] of the current buffer, by their bytes from the
+// 'field'th field or the 'column'th byte if not 0, or by the first number
+// there with SORT_NUMERIC. SORT_REVERSE reverses the order, SORT_UNIQUE
+// keeps only the first of the rows with the same key. Rows with the same key
+// keep their order. Returns the number of
+// rows removed.
+int sortRows(int from, int to, int flags, int field, int column) {
+    Ebuf *buf = EC.buf;
+    int n = to - from + 1, m = 0;
+    struct sortJob job = {buf->row + from, n, flags, field, column,
+        xmalloc(sizeof(struct sortKey) * (n + 1)),
+        xmalloc(sizeof(struct sortKey) * (n + 1)), NULL, 0};
+
+    rowCommit();
+    job.nruns = poolThreads() * 4;
+    if (job.nruns > n / LINES_TASK_ROWS + 1)
+        job.nruns = n / LINES_TASK_ROWS + 1;
+    job.runs = xmalloc(sizeof(int) * (job.nruns + 1));
+    for (int t = 0; t <= job.nruns; t++)
+        job.runs[t] = (long long)n * t / job.nruns;
+    if (job.nruns == 1)
+        sortTask(&job, 0);
+    else
+        poolRun(job.nruns, sortTask, &job);
+    while (job.nruns > 1) {
+        int pairs = (job.nruns + 1) / 2;
+        poolRun(pairs, mergeTask, &job);
+        for (int t = 1; t <= pairs; t++)
+            job.runs[t] = job.runs[t * 2 < job.nruns ? t * 2 : job.nruns];
+        job.nruns = pairs;
+        struct sortKey *k = job.keys;
+        job.keys = job.tmp;
+        job.tmp = k;
+    }
+    free(job.runs);
+
+    // The rows in their new order, the duplicates dropped.
+    Erow *rows = xmalloc(sizeof(Erow) * (n + 1));
+    char *before = xmalloc(n + 1), *keep = xmalloc(n + 1);
+    for (int j = 0; j < n; j++) {
+        struct sortKey *k = &job.keys[j];
+        keep[k->idx] = !(flags & SORT_UNIQUE) || j == 0 ||
+            cmpKeys(k, k - 1, 0) != 0;
+        if (!keep[k->idx])
+            continue;
+        before[m] = ocBefore(from + k->idx);
+        rows[m++] = buf->row[from + k->idx];
+    }
+    moveRows(from, n, rows, m, keep, before, ocBefore(to + 1));
+    free(job.keys);
+    free(job.tmp);
+    free(rows);
+    free(before);
+    free(keep);
+    return n - m;
+}
+
+struct uniqJob {
+    Erow *row;          /* First row. */
+    int n;
+    uint64_t *hash;     /* Of every row. */
+};
+
+static void hashTask(void *arg, int task) {
+    struct uniqJob *job = arg;
+    int from = task * LINES_TASK_ROWS, to = from + LINES_TASK_ROWS;
+
+    if (to > job->n)
+        to = job->n;
+    for (int j = from; j < to; j++)
+        job->hash[j] = hashBytes(job->row[j].chars, job->row[j].size);
+}
+
+// Remove the rows [from, to] of the current buffer equal to a row before
+// them in the range, wherever it is. The rows are hashed on the pool, then
+// looked up in a hash table of the rows kept. Returns the number of rows
+// removed.
+int uniqRows(int from, int to) {
+    Ebuf *buf = EC.buf;
+    int n = to - from + 1, size = 16, removed = 0, *table;
+    struct uniqJob job = {buf->row + from, n, xmalloc(sizeof(uint64_t) * (n + 1))};
+    char *keep = xmalloc(n + 1);
+
+    rowCommit();
+    poolRows(from, to, hashTask, &job);
+    while (size < 2 * n)
+        size *= 2;
+    table = xmalloc(sizeof(int) * size);
+    memset(table, -1, sizeof(int) * size);
+    for (int j = 0; j < n; j++) {
+        Erow *row = &job.row[j];
+        int slot = job.hash[j] & (size - 1);
+
+        keep[j] = 1;
+        for (; table[slot] != -1; slot = (slot + 1) & (size - 1)) {
+            Erow *other = &job.row[table[slot]];
+            if (job.hash[table[slot]] == job.hash[j] && other->size == row->size &&
+                    memcmp(other->chars, row->chars, row->size) == 0) {
+                keep[j] = 0;
+                removed++;
+                break;
+            }
+        }
+        if (keep[j])
+            table[slot] = j;
+    }
+    free(table);
+    free(job.hash);
+    if (removed)
+        filterRows(from, to, keep);
+    free(keep);
+    return removed;
+}
@@ -0,0 +1,268 @@
+#include "chibidit.h"
+
+/* ================================ Long rows ===============================
+ *
+ * A row of a minified file or of a log can be hundreds of MB long. Building
+ * its render, highlight and columns index takes several times its size in
+ * memory, and time proportional to its length on every edit, while just a
+ * screen width of it is ever visible. So above LONG_ROW_SIZE bytes a row
+ * has no render, hl and cols at all (and is never moved in the gap buffer):
+ *
+ * - The screen column is indexed every LONG_CHUNK bytes only, and the index
+ *   is built lazily, up to the furthest offset asked so far. Converting
+ *   between offsets and columns seeks the chunk, then scans at most a chunk
+ *   of bytes.
+ * - The highlight is computed when the row is drawn, for the visible bytes
+ *   only, resuming the lexer LONG_CONTEXT bytes before them in the default
+ *   state. So a string or a comment started further on the left than that
+ *   is not highlighted as such, this is the price of not lexing all the row.
+ * - Edits move the bytes in place and only drop the index after them. */
+
+#define LONG_CHUNK 4096     /* Bytes between two entries of the index. */
+#define LONG_CONTEXT 4096   /* Bytes lexed before the visible ones. */
+
+struct rowLong {
+    int *offs;      /* First character at or after every chunk start, */
+    int *cols;      /* and its screen column. */
+    int chunks;     /* Entries of the arrays. */
+    int valid;      /* Entries computed so far, at least the first one. */
+    int cap;        /* Bytes of chars that can be used in place. */
+};
+
+static unsigned char *hlbuf;    /* Highlight of the last lexed bytes. */
+static int hlbuf_size;
+
+// Skip the character at 'j' updating the column 'col', returns the offset
+// of the next one.
+static int nextCol(Erow *row, int j, int *col) {
+    unsigned char c = row->chars[j];
+
+    if (c == TAB) {
+        (*col)++;
+        while ((*col + 1) % 8 != 0)
+            (*col)++;
+        return j + 1;
+    } else if (c < 0x80) {
+        (*col)++;
+        return j + 1;
+    }
+    int cp, n = utf8Decode(row->chars + j, row->size - j, &cp);
+    *col += cp < 0 ? 1 : utf8Width(cp);
+    return j + n;
+}
+
+// Compute the index up to the chunk 'k'.
+static void extendIndex(Erow *row, int k) {
+    struct rowLong *l = row->lr;
+
+    if (k >= l->chunks)
+        k = l->chunks - 1;
+    while (l->valid <= k) {
+        int j = l->offs[l->valid - 1], col = l->cols[l->valid - 1];
+        int start = l->valid * LONG_CHUNK;
+
+        while (j < start)
+            j = nextCol(row, j, &col);
+        l->offs[l->valid] = j;
+        l->cols[l->valid] = col;
+        l->valid++;
+    }
+}
+
+// The chars of the row changed, size the index again and keep it valid up
+// to the chunk that may be affected by a change at 'at'.
+static void resizeIndex(Erow *row, int at) {
+    struct rowLong *l = row->lr;
+
+    l->chunks = row->size / LONG_CHUNK + 1;
+    l->offs = rowRealloc(l->offs, sizeof(int) * l->chunks);
+    l->cols = rowRealloc(l->cols, sizeof(int) * l->chunks);
+    if (l->valid > l->chunks)
+        l->valid = l->chunks;
+    // The column of a character depends on the characters before it, that
+    // are decoded reading up to 3 bytes after their start.
+    while (l->valid > 1 && l->offs[l->valid - 1] + 3 >= at)
+        l->valid--;
+}
+
+// Turn the row into a long row, or update it after its chars changed as a
+// whole.
+void rowLongUpdate(Erow *row) {
+    if (row->lr == NULL) {
+        row->lr = malloc(sizeof(*row->lr));
+        if (row->lr == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        row->lr->offs = row->lr->cols = NULL;
+        row->lr->valid = 1;
+    }
+    rowFree(row->render);
+    rowFree(row->hl);
+    rowFree(row->cols);
+    row->render = NULL;
+    row->hl = NULL;
+    row->cols = row->rx = NULL;
+    row->rsize = 0;
+    row->lr->cap = row->size + 1;
+    resizeIndex(row, 0);
+    row->lr->offs[0] = row->lr->cols[0] = 0;
+}
+
+void rowLongFree(Erow *row) {
+    if (row->lr == NULL)
+        return;
+    rowFree(row->lr->offs);
+    rowFree(row->lr->cols);
+    free(row->lr);
+    row->lr = NULL;
+}
+
+// Screen column of the byte at offset 'at', see rowCol().
+int rowLongCol(Erow *row, int at) {
+    struct rowLong *l = row->lr;
+    int k, j, col, extra = 0;
+
+    if (at > row->size) {
+        extra = at - row->size;
+        at = row->size;
+    }
+    k = at / LONG_CHUNK;
+    extendIndex(row, k);
+    if (l->offs[k] > at)
+        k--;
+    j = l->offs[k];
+    col = l->cols[k];
+    while (j < at) {
+        int prev = col, next = nextCol(row, j, &col);
+        // The bytes of a character are all in its column.
+        if (next > at)
+            return prev;
+        j = next;
+    }
+    return col + extra;
+}
+
+// Offset of the first character starting at or after the screen column
+// 'col', the characters and their combining marks are not kept together
+// here, see rowOffsetAtCol().
+int rowLongOffsetAtCol(Erow *row, int col) {
+    struct rowLong *l = row->lr;
+    int lo = 0, hi, j, c;
+
+    // Index the row up to the column, then seek the last chunk before it.
+    while (l->valid < l->chunks && l->cols[l->valid - 1] < col)
+        extendIndex(row, l->valid);
+    hi = l->valid - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (l->cols[mid] < col)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    j = l->offs[lo];
+    c = l->cols[lo];
+    while (j < row->size && c < col)
+        j = nextCol(row, j, &c);
+    return j < row->size ? j : row->size + col - c;
+}
+
+// Highlight the bytes [start, to) of the row, starting with the lexer in
+// 'state'. Returns the highlight of the byte 'from', valid until the next
+// call.
+static unsigned char *lexSpan(struct editorSyntax *syntax, Erow *row,
+        int state, int start, int from, int to) {
+    // One more byte: a token ending at 'to' may be highlighted past it.
+    if (to - start + 1 > hlbuf_size) {
+        hlbuf_size = to - start + 1;
+        hlbuf = realloc(hlbuf, hlbuf_size);
+        if (hlbuf == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    if (syntax == NULL)
+        memset(hlbuf, HL_NORMAL, to - start);
+    else
+        highlightSpan(syntax, row->chars + start, 0, to - start, hlbuf,
+                NULL, state, 0);
+    return hlbuf + from - start;
+}
+
+// Highlight of the visible bytes [from, to) of a row of 'buf', indexed
+// from 'from' and valid until the next call.
+unsigned char *rowLongHighlight(Ebuf *buf, Erow *row, int from, int to) {
+    int start = 0, state = HLS_SEP;
+    unsigned char *hl;
+
+    PROF_START(t);
+    if (from > LONG_CONTEXT) {
+        // Resume at the character boundary of a chunk.
+        int k = (from - LONG_CONTEXT) / LONG_CHUNK;
+        extendIndex(row, k);
+        start = row->lr->offs[k];
+    } else if (row->idx > 0 ? buf->row[row->idx - 1].hl_oc :
+            buf->above_oc) {
+        state |= HLS_COMMENT;
+    }
+    hl = lexSpan(buf->syntax, row, state, start, from, to);
+    PROF_STOP(PROF_HIGHLIGHT, t);
+    PROF_COUNT(PROF_ROWS, 1);
+    return hl;
+}
+
+// Open comment state at the end of the row, see rowHasOpenComment(). Only
+// the last bytes of the row are lexed.
+int rowLongOpenComment(Erow *row) {
+    int from = row->size > LONG_CONTEXT ? row->size - LONG_CONTEXT : 0;
+    unsigned char *hl;
+
+    if (row->size < 2)
+        return 0;
+    while (from < row->size && (row->chars[from] & 0xc0) == 0x80)
+        from++;
+    if (from == row->size)
+        return 0;
+    hl = lexSpan(EC.buf->syntax, row, HLS_SEP, from, from, row->size);
+    return hl[row->size - from - 1] == HL_MLCOMMENT &&
+        (row->chars[row->size - 2] != '*' || row->chars[row->size - 1] != '/');
+}
+
+// The chars changed at 'at', update what depends on them.
+static void rowLongChanged(Erow *row, int at) {
+    resizeIndex(row, at);
+    wrapRowChanged(row);
+    motionRowChanged(row);
+    coldRowChanged(row);
+    // A comment opened or closed at the end of the row changes the
+    // highlight of the following rows.
+    int oc = rowHasOpenComment(row);
+    if (row->hl_oc != oc) {
+        row->hl_oc = oc;
+        if (row->idx + 1 < EC.buf->numrows)
+            updateSyntaxHighLight(&EC.buf->row[row->idx + 1]);
+    }
+}
+
+// Insert 'len' bytes of 's' at offset 'at' of the row.
+void rowLongInsert(Erow *row, int at, const char *s, int len) {
+    row->chars = rowOwn(row->chars);
+    // Grow with some room, so that the next inserts happen in place.
+    if (row->size + len + 1 > row->lr->cap) {
+        row->lr->cap = row->size + len + 1 + row->size / 8;
+        row->chars = rowRealloc(row->chars, row->lr->cap);
+    }
+    memmove(row->chars + at + len, row->chars + at, row->size - at + 1);
+    memcpy(row->chars + at, s, len);
+    row->size += len;
+    rowLongChanged(row, at);
+}
+
+// Delete 'len' bytes at offset 'at' of the row.
+void rowLongDelete(Erow *row, int at, int len) {
+    row->chars = rowOwn(row->chars);
+    memmove(row->chars + at, row->chars + at + len, row->size - at - len + 1);
+    row->size -= len;
+    rowLongChanged(row, at);
+}
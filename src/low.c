@@ -6,11 +6,12 @@ static struct termios orig_termios;
 int editorOpen(char *filename) {
     FILE *fp;
 
-    EC.dirty = 0;
-    free(EC.filename);
+    EC.buf->dirty = 0;
+    undoFree(EC.buf);
+    free(EC.buf->filename);
     size_t fnlen = strlen(filename) + 1;
-    EC.filename = malloc(fnlen);
-    memcpy(EC.filename, filename, fnlen);
+    EC.buf->filename = malloc(fnlen);
+    memcpy(EC.buf->filename, filename, fnlen);
 
     fp = fopen(filename, "r");
     if (!fp) {
@@ -21,45 +22,126 @@ int editorOpen(char *filename) {
         return 1;
     }
 
+    // The rows of a huge file are compressed once far from the cursor, see
+    // src/cold.c. Their memory must be reused then, and not be left unused
+    // in the arena.
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0)
+        coldEnable(EC.buf, st.st_size);
+
+    // The rows loaded from the file are packed in the arena of the buffer.
+    // Long rows are edited in place instead, they would leave all their
+    // bytes unused in the arena once they grow.
+    if (EC.buf->arena == NULL && EC.buf->cold == NULL)
+        EC.buf->arena = rowArenaNew();
+
     char *line = NULL;
     size_t linecap = 0;
     ssize_t linelen;
     while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        EC.buf->loaded += linelen;
+        EC.buf->partial = line[linelen - 1] != '\n';
         if (linelen && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
             line[--linelen] = '\0';
-        insertRow(EC.numrows, line, linelen);
+        if (linelen > INT_MAX - 1) {
+            fprintf(stderr, "Some line of the edited file is too long for chibidit\n");
+            exit(1);
+        }
+        rowArenaUse(linelen > LONG_ROW_SIZE ? NULL : EC.buf->arena);
+        insertRow(EC.buf->numrows, line, linelen);
+        coldLoaded(EC.buf);
     }
+    rowArenaUse(NULL);
     free(line);
+    if (fstat(fileno(fp), &st) == 0)
+        EC.buf->mtime = st.st_mtim;
     fclose(fp);
-    EC.dirty = 0;
+    EC.buf->dirty = 0;
     return 0;
 }
 
-int save(void) {
-    int len;
+// Write the rows of the current buffer to the file 'filename', and its
+// status to '*st'. Returns the number of bytes written, or -1 on error.
+static ssize_t writeRows(const char *filename, struct stat *st) {
+    size_t len, done = 0;
+    ssize_t n;
     char *buf = rowsToString(&len);
-    int fd = open(EC.filename, O_RDWR | O_CREAT, 0644);
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
     if (fd == -1)
         goto err;
 
-    // Use truncate + a single write(2) call in order to make saving
-    // a bit safer, under the limits of what we can do in a small editor.
+    // Use truncate + write(2) in order to make saving a bit safer, under
+    // the limits of what we can do in a small editor. A single write(2)
+    // may write less than asked, over 2 GB on Linux.
     if (ftruncate(fd, len) == -1)
         goto err;
-    if (write(fd, buf, len) != len)
-        goto err;
+    while (done < len) {
+        if ((n = write(fd, buf + done, len - done)) == -1) {
+            if (errno == EINTR)
+                continue;
+            goto err;
+        }
+        done += n;
+    }
+    if (fstat(fd, st) == -1)
+        memset(st, 0, sizeof(*st));
 
     close(fd);
     free(buf);
-    EC.dirty = 0;
-    setStatusMsg("%d bytes written on disk", len);
-    return 0;
+    setStatusMsg("%zu bytes written on disk", len);
+    return len;
 
 err:
     free(buf);
     if (fd != -1)
         close(fd);
-    return 1;
+    setStatusMsg("Can't write %s: %s", filename, strerror(errno));
+    return -1;
+}
+
+int save(void) {
+    struct stat st;
+
+    if (EC.buf->filename == NULL) {
+        setStatusMsg("No file name");
+        return 1;
+    }
+    if (EC.buf->window) {
+        setStatusMsg("The buffer is read only");
+        return 1;
+    }
+    if (writeRows(EC.buf->filename, &st) == -1)
+        return 1;
+    // Our own write is not a change of the file on disk.
+    if (st.st_ino)
+        watchStat(EC.buf, &st);
+    // The dirty counter starts again: the undo group could no longer tell
+    // the edits made before the save from those made after it.
+    EC.buf->dirty = 0;
+    undoFree(EC.buf);
+    return 0;
+}
+
+// Save the current buffer to 'filename', that becomes its name if it has
+// none. The buffer stays modified if it is another file.
+int saveAs(char *filename) {
+    struct stat st;
+
+    if (filename == NULL || (EC.buf->filename &&
+                strcmp(filename, EC.buf->filename) == 0))
+        return save();
+    if (EC.buf->filename == NULL) {
+        if ((EC.buf->filename = strdup(filename)) == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        return save();
+    }
+    if (EC.buf->window) {
+        setStatusMsg("The buffer is read only");
+        return 1;
+    }
+    return writeRows(filename, &st) == -1;
 }
 
 void atExit(void) {
@@ -110,26 +192,24 @@ void disableRawMode(int fd) {
     }
 }
 
-int readKey(int fd) {
-    int nread;
-    char c, seq[3];
-    while ((nread = read(fd, &c, 1)) == 0);
-    if (nread == -1) exit(1);
+// Decode the key starting with the byte 'c' read from the terminal, the
+// escape sequences of the special keys.
+static int decodeKey(int fd, char c) {
+    char seq[3];
 
     while(1) {
         switch(c) {
         case ESC:    /* escape sequence */
-            setStatusMsg("---NORMAL MODE---");
-            EC.mode = NORMAL;
-            /* If this is just an ESC, we'll timeout here. */
-            if (read(fd, seq, 1) == 0) return ESC;
-            if (read(fd, seq+1, 1) == 0) return ESC;
+            /* If this is just an ESC, we'll timeout here (or find
+             * nothing to read if the input is non blocking). */
+            if (read(fd, seq, 1) != 1) return ESC;
+            if (read(fd, seq+1, 1) != 1) return ESC;
 
             /* ESC [ sequences. */
             if (seq[0] == '[') {
                 if (seq[1] >= '0' && seq[1] <= '9') {
                     /* Extended escape, read additional byte. */
-                    if (read(fd, seq+2, 2) == 0) return ESC;
+                    if (read(fd, seq+2, 1) != 1) return ESC;
                     if (seq[2] == '~') {
                         switch(seq[1]) {
                         case '3': return DEL_KEY;
@@ -157,37 +237,81 @@ int readKey(int fd) {
                 }
             }
             break;
-        case 'i':
-            if (EC.mode == NORMAL) {
-                setStatusMsg("---INSERT MODE---");
-                EC.mode = INSERT;
-                return ESC;
-            }
-            return c;
-        case 'k':
-            if (EC.mode == NORMAL) return ARROW_UP;
-            return c;
-        case 'j':
-            if (EC.mode == NORMAL) return ARROW_DOWN;
-            return c;
-        case 'l':
-            if (EC.mode == NORMAL) return ARROW_RIGHT;
-            return c;
-        case 'h':
-            if (EC.mode == NORMAL) return ARROW_LEFT;
-            return c;
-        case 'x':
-            if (EC.mode == NORMAL) return DEL_AT_KEY;
-            return c;
-        case 127: // DEL Key
-            if (EC.mode == INSERT) return DEL_KEY;
-            return c;
         default:
             return c;
         }
     }
 }
 
+// Map the key 'key' as the current mode reads it: ESC and the special keys
+// go back to normal mode, 'i' enters insert mode.
+static int modeKey(int key) {
+    // The normal and visual modes move the cursor with hjkl.
+    int moving = EC.mode != INSERT && EC.mode != PROMPT;
+
+    if (key == ESC || key >= ARROW_LEFT) {
+        setStatusMsg("---NORMAL MODE---");
+        EC.mode = NORMAL;
+        return key;
+    }
+    switch(key) {
+    case 'i':
+        if (EC.mode == NORMAL) {
+            setStatusMsg("---INSERT MODE---");
+            EC.mode = INSERT;
+            return ESC;
+        }
+        return key;
+    case 'k':
+        if (moving) return ARROW_UP;
+        return key;
+    case 'j':
+        if (moving) return ARROW_DOWN;
+        return key;
+    case 'l':
+        if (moving) return ARROW_RIGHT;
+        return key;
+    case 'h':
+        if (moving) return ARROW_LEFT;
+        return key;
+    case 'x':
+        if (moving) return DEL_AT_KEY;
+        return key;
+    case 127: // DEL Key
+        if (EC.mode == INSERT) return DEL_KEY;
+        return key;
+    default:
+        return key;
+    }
+}
+
+// Read a key, from the macro being replayed if any. The keys of macros are
+// recorded as decoded, before the mapping of the mode.
+int readKey(int fd) {
+    int nread, key;
+    char c;
+
+    if (macroNextKey(&key))
+        return modeKey(key);
+    // Nothing typed for a while: look for changes of the files meanwhile.
+    while ((nread = read(fd, &c, 1)) == 0) {
+        if (watchPoll())
+            refreshScreen();
+        streamPoll(fd);
+        pagerPoll(fd);
+        coldPoll();
+    }
+    if (nread == -1) exit(1);
+
+    // The frame starts here, the time waiting for the key is not counted.
+    PROF_START(start);
+    key = decodeKey(fd, c);
+    macroKey(key);
+    key = modeKey(key);
+    PROF_STOP(PROF_INPUT, start);
+    return key;
+}
+
 int getCursorPosition(int ifd, int ofd, int *rows, int *cols) {
     char buf[32];
     unsigned int i = 0;
@@ -0,0 +1,121 @@
+#include "chibidit.h"
+
+/* ================================= Macros =================================
+ *
+ * 'q' and a letter record the keys that follow in the macro of that letter,
+ * until the next 'q'. '@' and a letter replay them 'count' times, '@@' the
+ * last macro replayed. The keys are recorded as decoded by readKey(), so
+ * replaying them does not depend on the terminal.
+ *
+ * A macro is replayed in batch: the screen is not refreshed and the rows
+ * are not highlighted until it ends (see updateSyntaxHighLight()), so that
+ * replaying it many times costs just the edits it makes. A macro may replay
+ * another one; a command that still waits for keys when its macro ends
+ * gets ESC. */
+
+#define MACRO_DEPTH 32      /* Macros replaying macros. */
+
+struct macro {
+    int *keys;
+    int n, cap;
+};
+
+static struct macro macros[26];
+static int recording = -1;  /* Macro being recorded, -1 if none. */
+static int last = -1;       /* Macro replayed last, -1 if none. */
+
+// Keys of the macros being replayed, the last one is the innermost.
+static struct {
+    const int *keys;
+    int n, at;
+} replay[MACRO_DEPTH];
+static int depth;
+
+// Start recording the macro 'name', or stop the recording.
+void macroRecord(int name) {
+    if (recording != -1) {
+        // The 'q' that stops it was recorded, unless a macro typed it.
+        if (depth == 0 && macros[recording].n)
+            macros[recording].n--;
+        setStatusMsg("");
+        recording = -1;
+        return;
+    }
+    if (name < 'a' || name > 'z')
+        return;
+    recording = name - 'a';
+    macros[recording].n = 0;
+    setStatusMsg("recording @%c", name);
+}
+
+// Letter of the macro being recorded, or 0.
+int macroRecording(void) {
+    return recording == -1 ? 0 : 'a' + recording;
+}
+
+// Record the key 'key' read from the terminal.
+void macroKey(int key) {
+    struct macro *m;
+
+    if (recording == -1 || depth)
+        return;
+    m = &macros[recording];
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        if ((m->keys = realloc(m->keys, sizeof(int) * m->cap)) == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    m->keys[m->n++] = key;
+}
+
+// Next key of the macro being replayed, in '*key'. Returns 0 if no macro
+// is replayed.
+int macroNextKey(int *key) {
+    if (depth == 0)
+        return 0;
+    if (replay[depth - 1].at < replay[depth - 1].n)
+        *key = replay[depth - 1].keys[replay[depth - 1].at++];
+    else
+        *key = ESC;
+    return 1;
+}
+
+// Replay the macro 'name' 'count' times, running its keys on 'fd' as if
+// they were typed.
+void macroReplay(int fd, int name, long long count) {
+    int idx = name == '@' ? last : name >= 'a' && name <= 'z' ? name - 'a' : -1;
+    int batch = EC.batch, *keys;
+
+    if (idx == -1 || macros[idx].n == 0) {
+        setStatusMsg("No macro to replay");
+        return;
+    }
+    if (depth == MACRO_DEPTH) {
+        setStatusMsg("Macros nested too deep");
+        return;
+    }
+    // The macro may be recorded again while it runs.
+    if ((keys = malloc(sizeof(int) * macros[idx].n)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memcpy(keys, macros[idx].keys, sizeof(int) * macros[idx].n);
+    last = idx;
+    replay[depth].keys = keys;
+    replay[depth].n = macros[idx].n;
+    depth++;
+
+    EC.batch = 1;
+    for (long long j = 0; j < count; j++) {
+        replay[depth - 1].at = 0;
+        while (replay[depth - 1].at < replay[depth - 1].n)
+            processKeyPress(fd);
+    }
+    depth--;
+    free(keys);
+    EC.batch = batch;
+    if (!batch)
+        syntaxFlush();
+}
@@ -0,0 +1,513 @@
+#include "chibidit.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* ================================= Motions ================================
+ *
+ * The word, paragraph, bracket and character motions of the normal mode.
+ *
+ * Words and characters are searched 16 bytes at a time with SSE2 when the
+ * compiler targets it: the bytes of a block are classified at once (blank,
+ * word, punctuation, bracket) and the first one out of the class is found
+ * from the mask, so that crossing a row of hundreds of MB is a memory scan.
+ * The plain loops after them do the rest of the row, or all of it without
+ * SSE2.
+ *
+ * '%' skips the brackets in strings and comments, as the highlight of the
+ * row says. Matching a bracket far away in deeply nested code would scan
+ * all the rows in between every time, so every block of BRACKET_BLOCK rows
+ * keeps, for each kind of bracket, its depth change and the lowest and
+ * highest depths reached from its first and last row. A block that the
+ * match is not in is skipped at once. The blocks are computed lazily when
+ * a search goes over them, and dropped when one of their rows is edited or
+ * highlighted again, or when rows are inserted or deleted above them. */
+
+#define BRACKET_BLOCK 256   /* Rows summed up together. */
+
+#define CLASS_BLANK 0
+#define CLASS_PUNCT 1
+#define CLASS_WORD 2
+
+// Depths of one kind of bracket over some text, an open bracket counting
+// 1 and a close one -1.
+struct depth {
+    int delta;  /* Depth at the end. */
+    int lo;     /* Lowest depth from the start, 0 or less. */
+    int hi;     /* Highest depth from the end: 'delta' minus the lowest
+                   depth before it, 0 or more. */
+};
+
+struct bracketBlock {
+    int valid;
+    struct depth d[3];  /* Of (), [] and {}. */
+};
+
+struct bracketIndex {
+    int numblocks;      /* Blocks the array holds, valid or not. */
+    struct bracketBlock *blocks;
+};
+
+static const char brackets[] = "([{)]}";
+
+static int lastFind;        /* Last f or t searched, */
+static int lastFindChar;    /* for this byte. */
+static int lastFindDir;     /* Forward 1, backward -1. */
+
+static int byteClass(unsigned char c) {
+    if (c == ' ' || c == TAB)
+        return CLASS_BLANK;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c >= 0x80)
+        return CLASS_WORD;
+    return CLASS_PUNCT;
+}
+
+#ifdef __SSE2__
+// Bit mask of the bytes of 'v' in the class 'cls'.
+static int classMask(__m128i v, int cls) {
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(TAB)));
+    if (cls == CLASS_BLANK)
+        return _mm_movemask_epi8(blank);
+
+    // Lower case the letters. The bytes of UTF-8 sequences are negative.
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i word = _mm_and_si128(
+            _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    word = _mm_or_si128(word, _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+    word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    word = _mm_or_si128(word, _mm_cmplt_epi8(v, _mm_setzero_si128()));
+    if (cls == CLASS_WORD)
+        return _mm_movemask_epi8(word);
+    return ~_mm_movemask_epi8(_mm_or_si128(word, blank)) & 0xffff;
+}
+
+static int bracketMask(__m128i v) {
+    __m128i m = _mm_setzero_si128();
+    for (int k = 0; k < 6; k++)
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(brackets[k])));
+    return _mm_movemask_epi8(m);
+}
+
+static __m128i load(const char *s) {
+    return _mm_loadu_si128((const __m128i *)s);
+}
+#endif
+
+// Offset of the first byte from 'at' to 'end' of 's' that is not in the
+// class 'cls', 'end' if none.
+static int skipClass(const char *s, int at, int end, int cls) {
+#ifdef __SSE2__
+    for (; at + 16 <= end; at += 16) {
+        int m = ~classMask(load(s + at), cls) & 0xffff;
+        if (m)
+            return at + __builtin_ctz(m);
+    }
+#endif
+    while (at < end && byteClass(s[at]) == cls)
+        at++;
+    return at;
+}
+
+// Offset of the first byte of the run of bytes in the class 'cls' that
+// ends before 'at', 'at' if there is none.
+static int skipClassBack(const char *s, int at, int cls) {
+#ifdef __SSE2__
+    for (; at >= 16; at -= 16) {
+        int m = ~classMask(load(s + at - 16), cls) & 0xffff;
+        if (m)
+            return at - 16 + 32 - __builtin_clz(m);
+    }
+#endif
+    while (at > 0 && byteClass(s[at - 1]) == cls)
+        at--;
+    return at;
+}
+
+// Offset of the first bracket from 'at' to 'end' of 's', 'end' if none.
+static int findBracket(const char *s, int at, int end) {
+#ifdef __SSE2__
+    for (; at + 16 <= end; at += 16) {
+        int m = bracketMask(load(s + at));
+        if (m)
+            return at + __builtin_ctz(m);
+    }
+#endif
+    while (at < end && !strchr(brackets, s[at]))
+        at++;
+    return at;
+}
+
+// Offset of the last bracket before 'at' of 's', -1 if none.
+static int findBracketBack(const char *s, int at) {
+#ifdef __SSE2__
+    for (; at >= 16; at -= 16) {
+        int m = bracketMask(load(s + at - 16));
+        if (m)
+            return at - 16 + 31 - __builtin_clz(m);
+    }
+#endif
+    while (at > 0 && !strchr(brackets, s[at - 1]))
+        at--;
+    return at - 1;
+}
+
+// Offset of the last byte 'c' before 'at' of 's', -1 if none.
+static int findByteBack(const char *s, int at, int c) {
+#ifdef __SSE2__
+    __m128i v = _mm_set1_epi8(c);
+    for (; at >= 16; at -= 16) {
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(load(s + at - 16), v));
+        if (m)
+            return at - 16 + 31 - __builtin_clz(m);
+    }
+#endif
+    while (at > 0 && s[at - 1] != c)
+        at--;
+    return at - 1;
+}
+
+// Append the depths 'b' to the depths 'a'.
+static void addDepth(struct depth *a, const struct depth *b) {
+    if (a->delta + b->lo < a->lo)
+        a->lo = a->delta + b->lo;
+    a->hi = b->hi > b->delta + a->hi ? b->hi : b->delta + a->hi;
+    a->delta += b->delta;
+}
+
+// Add the brackets of the row that are code to 'd'.
+static void rowDepths(Erow *row, struct depth d[3]) {
+    for (int j = findBracket(row->chars, 0, row->size); j < row->size;
+            j = findBracket(row->chars, j + 1, row->size)) {
+        int k = strchr(brackets, row->chars[j]) - brackets;
+        struct depth b = { k < 3 ? 1 : -1, k < 3 ? 0 : -1, k < 3 ? 1 : 0 };
+        if (rowIsCode(row, j))
+            addDepth(&d[k % 3], &b);
+    }
+}
+
+// The depths of the rows of the block 'k' of the buffer.
+static struct depth *blockDepths(Ebuf *buf, int k) {
+    struct bracketIndex *idx = buf->brackets;
+    int n = (buf->numrows + BRACKET_BLOCK - 1) / BRACKET_BLOCK;
+
+    if (idx == NULL) {
+        idx = buf->brackets = malloc(sizeof(*idx));
+        if (idx == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        memset(idx, 0, sizeof(*idx));
+    }
+    if (n > idx->numblocks) {
+        idx->blocks = realloc(idx->blocks, sizeof(*idx->blocks) * n);
+        if (idx->blocks == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        memset(idx->blocks + idx->numblocks, 0,
+                sizeof(*idx->blocks) * (n - idx->numblocks));
+        idx->numblocks = n;
+    }
+
+    struct bracketBlock *b = &idx->blocks[k];
+    if (!b->valid) {
+        int end = (k + 1) * BRACKET_BLOCK;
+        memset(b->d, 0, sizeof(b->d));
+        for (int j = k * BRACKET_BLOCK; j < end && j < buf->numrows; j++)
+            rowDepths(rowAt(buf, j), b->d);
+        b->valid = 1;
+    }
+    return b->d;
+}
+
+// Look in the row for the bracket that brings 'depth' to 0, for the kind
+// of brackets 'kind': forward from the byte 'at' when 'dir' is 1, backward
+// from the byte before it when -1. Returns its offset, or -1 with 'depth'
+// updated.
+static int scanRow(Erow *row, int kind, int dir, int at, int *depth) {
+    char open = brackets[kind], close = brackets[kind + 3];
+
+    if (dir > 0) {
+        for (at = findBracket(row->chars, at, row->size); at < row->size;
+                at = findBracket(row->chars, at + 1, row->size)) {
+            char c = row->chars[at];
+            if ((c == open || c == close) && rowIsCode(row, at) &&
+                    (*depth += c == open ? 1 : -1) == 0)
+                return at;
+        }
+    } else {
+        while ((at = findBracketBack(row->chars, at)) >= 0) {
+            char c = row->chars[at];
+            if ((c == open || c == close) && rowIsCode(row, at) &&
+                    (*depth += c == close ? 1 : -1) == 0)
+                return at;
+        }
+    }
+    return -1;
+}
+
+// Find the bracket 'c' that is not matched: forward from the byte 'at' of
+// the row 'row' for a close bracket, backward from the byte before it for
+// an open one. Gives up past 'limit' rows. Returns 0 with its position set,
+// or -1.
+int bracketFind(Ebuf *buf, int c, int *row, int *at, int limit) {
+    int k = strchr(brackets, c) - brackets, kind = k % 3;
+    int dir = k < 3 ? -1 : 1, depth = 1, r = *row, j;
+
+    if ((j = scanRow(rowAt(buf, r), kind, dir, *at, &depth)) != -1)
+        goto found;
+    for (r += dir; r >= 0 && r < buf->numrows && abs(r - *row) <= limit;
+            r += dir) {
+        // Skip the whole blocks that the bracket is not in.
+        while (dir > 0 ? r % BRACKET_BLOCK == 0 :
+                r % BRACKET_BLOCK == BRACKET_BLOCK - 1) {
+            struct depth *d = &blockDepths(buf, r / BRACKET_BLOCK)[kind];
+            if (dir > 0 ? depth + d->lo <= 0 : depth - d->hi <= 0)
+                break;
+            depth += dir * d->delta;
+            r += dir * BRACKET_BLOCK;
+            if (r < 0 || r >= buf->numrows || abs(r - *row) > limit)
+                return -1;
+        }
+        Erow *erow = rowAt(buf, r);
+        j = scanRow(erow, kind, dir, dir > 0 ? 0 : erow->size, &depth);
+        if (j != -1)
+            goto found;
+    }
+    return -1;
+
+found:
+    *row = r;
+    *at = j;
+    return 0;
+}
+
+// The chars or the highlight of the row changed.
+void motionRowChanged(Erow *row) {
+    struct bracketIndex *idx = EC.buf->brackets;
+
+    if (idx && row->idx / BRACKET_BLOCK < idx->numblocks)
+        idx->blocks[row->idx / BRACKET_BLOCK].valid = 0;
+}
+
+// Rows were inserted or deleted at 'at', the blocks after it moved.
+void motionRowsChanged(Ebuf *buf, int at) {
+    struct bracketIndex *idx = buf->brackets;
+
+    for (int k = at / BRACKET_BLOCK; idx && k < idx->numblocks; k++)
+        idx->blocks[k].valid = 0;
+}
+
+void motionFree(Ebuf *buf) {
+    if (buf->brackets == NULL)
+        return;
+    free(buf->brackets->blocks);
+    free(buf->brackets);
+    buf->brackets = NULL;
+}
+
+// Class of the byte at 'at' of the row, the end of the row is blank.
+static int classAt(Erow *row, int at) {
+    return at < row->size ? byteClass(row->chars[at]) : CLASS_BLANK;
+}
+
+// 'w': the start of the next word, or an empty row.
+static void nextWord(Ebuf *buf, int *r, int *c) {
+    Erow *row = rowAt(buf, *r);
+    int j = skipClass(row->chars, *c, row->size, classAt(row, *c));
+
+    while ((j = skipClass(row->chars, j, row->size, CLASS_BLANK)) >=
+            row->size) {
+        if (*r + 1 >= buf->numrows) {
+            // No word after, go to the last character.
+            j = rowPrevChar(row, row->size);
+            break;
+        }
+        row = rowAt(buf, ++*r);
+        j = 0;
+        if (row->size == 0)
+            break;
+    }
+    *c = j;
+}
+
+// 'e': the end of the word, or of the next one.
+static void wordEnd(Ebuf *buf, int *r, int *c) {
+    Erow *row = rowAt(buf, *r);
+    int j = rowNextChar(row, *c);
+
+    while ((j = skipClass(row->chars, j, row->size, CLASS_BLANK)) >=
+            row->size) {
+        if (*r + 1 >= buf->numrows) {
+            *c = rowPrevChar(row, row->size);
+            return;
+        }
+        row = rowAt(buf, ++*r);
+        j = 0;
+    }
+    j = skipClass(row->chars, j, row->size, byteClass(row->chars[j]));
+    *c = rowPrevChar(row, j);
+}
+
+// 'b': the start of the word, or of the previous one, or an empty row.
+static void prevWord(Ebuf *buf, int *r, int *c) {
+    Erow *row = rowAt(buf, *r);
+    int j = *c < row->size ? *c : row->size;
+
+    while ((j = skipClassBack(row->chars, j, CLASS_BLANK)) == 0) {
+        // Only blanks before, go to the end of the previous row, or stop
+        // on it when it is empty.
+        if (*r == 0) {
+            *c = 0;
+            return;
+        }
+        row = rowAt(buf, --*r);
+        if ((j = row->size) == 0) {
+            *c = 0;
+            return;
+        }
+    }
+    *c = skipClassBack(row->chars, j, byteClass(row->chars[j - 1]));
+}
+
+// '}' and '{': the next or previous empty row after the rows of text.
+static void paragraph(Ebuf *buf, int dir, int *r, int *c) {
+    int j = *r;
+
+    while (j >= 0 && j < buf->numrows && buf->row[j].size == 0)
+        j += dir;
+    while (j >= 0 && j < buf->numrows && buf->row[j].size != 0)
+        j += dir;
+    if (j < 0) {
+        *r = *c = 0;
+    } else if (j >= buf->numrows) {
+        *r = buf->numrows - 1;
+        *c = buf->row[*r].size;
+    } else {
+        *r = j;
+        *c = 0;
+    }
+}
+
+// '%': the bracket matching the first one of the row from the cursor on.
+static int matchBracket(Ebuf *buf, int *r, int *c) {
+    Erow *row = rowAt(buf, *r);
+    int j, k;
+
+    for (j = findBracket(row->chars, *c, row->size); j < row->size;
+            j = findBracket(row->chars, j + 1, row->size))
+        if (rowIsCode(row, j))
+            break;
+    if (j == row->size)
+        return -1;
+    // Look for the other bracket of the pair, after this one or before.
+    k = strchr(brackets, row->chars[j]) - brackets;
+    *c = k < 3 ? j + 1 : j;
+    return bracketFind(buf, brackets[(k + 3) % 6], r, c, INT_MAX);
+}
+
+// Move the cursor to the byte 'c' of the row 'r'.
+static void moveTo(int r, int c) {
+    if (r != EC.view->row_offset + EC.view->cy)
+        gotoRow(EC.view, r);
+    EC.view->cx = c;
+    clampCursor(EC.view);
+    scrollCursor(EC.view);
+}
+
+// 'fx' goes to the next byte 'x' of the row, 'tx' just before it, 'count'
+// times. 'key' is ';' or ',' to repeat the last one in the same or in the
+// other direction.
+void motionFind(int key, int c, long long count) {
+    int r = EC.view->row_offset + EC.view->cy, at = EC.view->cx, dir = 1;
+    int repeat = key == ';' || key == ',';
+
+    if (repeat) {
+        if (lastFind == 0)
+            return;
+        dir = key == ';' ? lastFindDir : -lastFindDir;
+        key = lastFind;
+        c = lastFindChar;
+    } else {
+        if (c <= 0 || c > 0xff || c == ESC)
+            return;
+        lastFind = key;
+        lastFindChar = c;
+        lastFindDir = 1;
+    }
+    if (r >= EC.buf->numrows)
+        return;
+    rowCommit();
+
+    Erow *row = rowAt(EC.buf, r);
+    // Repeating 't' next to the byte goes past it, not to the same place.
+    if (repeat && key == 't') {
+        int next = dir > 0 ? rowNextChar(row, at) : rowPrevChar(row, at);
+        if (next < row->size && row->chars[next] == c)
+            at = next;
+    }
+    if (count <= 0)
+        count = 1;
+    for (; count > 0; count--) {
+        if (dir > 0) {
+            const char *p = at + 1 < row->size ?
+                memchr(row->chars + at + 1, c, row->size - at - 1) : NULL;
+            if (p == NULL)
+                return;
+            at = p - row->chars;
+        } else if ((at = findByteBack(row->chars, at < row->size ? at :
+                        row->size, c)) < 0) {
+            return;
+        }
+    }
+    if (key == 't')
+        at = dir > 0 ? rowPrevChar(row, at) : rowNextChar(row, at);
+    moveTo(r, at);
+}
+
+// The motions 'w', 'b', 'e', '{', '}' and '%', repeated 'count' times.
+void motionCommand(int key, long long count) {
+    Ebuf *buf = EC.buf;
+    int r = EC.view->row_offset + EC.view->cy, c = EC.view->cx;
+
+    if (r >= buf->numrows)
+        return;
+    rowCommit();
+    if (count <= 0)
+        count = 1;
+    for (; count > 0; count--) {
+        int pr = r, pc = c;
+
+        switch (key) {
+        case 'w':
+            nextWord(buf, &r, &c);
+            break;
+        case 'e':
+            wordEnd(buf, &r, &c);
+            break;
+        case 'b':
+            prevWord(buf, &r, &c);
+            break;
+        case '}':
+        case '{':
+            paragraph(buf, key == '}' ? 1 : -1, &r, &c);
+            break;
+        case '%':
+            if (matchBracket(buf, &r, &c) == -1) {
+                r = pr;
+                c = pc;
+            }
+            count = 1;
+            break;
+        }
+        // At the start or the end of the buffer.
+        if (r == pr && c == pc)
+            break;
+    }
+    moveTo(r, c);
+}
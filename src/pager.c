@@ -0,0 +1,595 @@
+#include "chibidit.h"
+#include <poll.h>
+#include <sys/mman.h>
+
+/* =============================== Huge files ===============================
+ *
+ * 'chibidit -R' shows files too large to be loaded as rows, read only. The
+ * file is mapped in memory, and the rows are a window of at most PAGER_ROWS
+ * lines around the cursor, that slides when the cursor gets near its top
+ * or its bottom, or is moved to another line with gotoLine().
+ *
+ * The lines are found with a sparse index: the offset of every PAGER_STEP
+ * line. It is built while waiting for the keys (see readKey()), reading the
+ * file in chunks with pread(2), so that the pages of the map are not all
+ * touched, and a jump to a line not indexed yet indexes up to it.
+ * A jump then goes to the checkpoint before the line, and scans at most
+ * PAGER_STEP lines from there. So opening a file takes the time of loading
+ * a window, and the memory taken is the one of the index and of the
+ * window, whatever the size of the file.
+ *
+ * With a syntax, the lines are lexed while indexed, and the open comment
+ * state of every checkpoint is kept next to its offset: a window starting
+ * anywhere is highlighted as if the file was highlighted from its start.
+ *
+ * Once the file is all indexed, the index is written to a cache file, in
+ * ~/.cache/chibidit, named by the hash of the path of the file. It is keyed
+ * by the size, the modification time and a hash of INDEX_SAMPLES blocks of
+ * the file, as hashing all of it would take the time of indexing it. The
+ * next time the file is opened unchanged, the cache is mapped and used as
+ * the index, so the lines are counted and any of them reached at once. */
+
+#define PAGER_STEP 1024             /* Lines between two checkpoints. */
+#define PAGER_ROWS 4096             /* Lines of the window, at most, */
+#define PAGER_BYTES (16 * 1024 * 1024)  /* and bytes. */
+#define PAGER_CHUNK (1024 * 1024)   /* Bytes indexed at once. */
+#define PAGER_SLICE 0.02            /* Seconds of indexing between two
+                                       checks for a key. */
+#define INDEX_MAGIC "chibidx1"      /* Start of the index cache files. */
+#define INDEX_SAMPLES 64            /* Blocks of the file hashed, */
+#define INDEX_SAMPLE 4096           /* of this size. */
+
+struct pager {
+    int fd;             /* The file, */
+    char *map;          /* The file mapped in memory, */
+    off_t size;         /* and its size. */
+    off_t *index;       /* Offset of the line j * PAGER_STEP at index[j]. */
+    long long points;   /* Checkpoints in the index, */
+    long long cap;      /* and the room for them. */
+    unsigned char *oc;  /* Open comment state before every checkpoint. */
+    off_t indexed;      /* Bytes of the file indexed, */
+    long long lines;    /* and the newlines in them. */
+    off_t start, end;   /* Bytes of the file in the rows. */
+    struct editorSyntax *syntax;    /* Syntax the lines are lexed with, */
+    off_t line;         /* start of the line to lex next, */
+    int state;          /* and open comment state before it. */
+    struct timespec mtime;  /* Modification time of the file opened. */
+    uint64_t hash;      /* Hash of the samples of the file. */
+    char *cache_path;   /* Index cache of the file, or NULL. */
+    char *cache;        /* The index cache mapped, when used as the index, */
+    size_t cache_size;  /* and its size. */
+};
+
+// Header of the index cache files, followed by the offsets and by the open
+// comment states of the checkpoints.
+struct indexHeader {
+    char magic[8];          /* INDEX_MAGIC */
+    int64_t size;           /* Size, */
+    int64_t mtime, mtime_ns;    /* modification time */
+    uint64_t hash;          /* and hash of the samples of the file. */
+    uint64_t syntax;        /* Hash of the name of the syntax, or 0. */
+    int64_t points;         /* Checkpoints, */
+    int64_t lines;          /* and newlines of the file. */
+};
+
+static void indexSave(struct pager *p);
+
+// Index the next chunk of the file. Returns non zero once it is all indexed.
+static int indexChunk(struct pager *p) {
+    static char *s;
+    ssize_t len = p->size - p->indexed < PAGER_CHUNK ?
+        p->size - p->indexed : PAGER_CHUNK;
+
+    if (s == NULL && (s = malloc(PAGER_CHUNK)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    if ((len = pread(p->fd, s, len, p->indexed)) <= 0) {
+        // The file got shorter, the rest can't be indexed.
+        p->indexed = p->size;
+        return 1;
+    }
+    for (char *nl = s; (nl = memchr(nl, '\n', s + len - nl)) != NULL; nl++) {
+        off_t at = p->indexed + (nl - s);
+
+        // The line is lexed in the map, it may start in a previous chunk.
+        if (p->syntax)
+            p->state = lineOpenComment(p->syntax, p->map + p->line,
+                    at - p->line, p->state);
+        p->line = at + 1;
+        if (++p->lines % PAGER_STEP)
+            continue;
+        if (p->points == p->cap) {
+            p->cap *= 2;
+            if ((p->index = realloc(p->index, sizeof(off_t) * p->cap)) == NULL ||
+                    (p->oc = realloc(p->oc, p->cap)) == NULL) {
+                perror("Out of memory");
+                exit(1);
+            }
+        }
+        p->oc[p->points] = p->state;
+        p->index[p->points++] = at + 1;
+    }
+    p->indexed += len;
+    if (p->indexed < p->size)
+        return 0;
+    indexSave(p);
+    return 1;
+}
+
+// Count the lines of 'buf' out of the rows.
+static void countLines(Ebuf *buf) {
+    struct pager *p = buf->pager;
+    long long lines = p->lines;
+
+    if (p->indexed == p->size && p->size && p->map[p->size - 1] != '\n')
+        lines++;
+    buf->below = lines - buf->above - buf->numrows;
+    if (buf->below < 0)
+        buf->below = 0;
+    buf->counting = p->indexed < p->size;
+}
+
+// Index the file of 'buf' up to the line 'line', and return the line,
+// clamped to the last one of the file.
+static long long indexTo(Ebuf *buf, long long line) {
+    struct pager *p = buf->pager;
+    double last = profNow();
+
+    while (p->lines < line && p->indexed < p->size && !indexChunk(p)) {
+        if (profNow() - last > 0.1) {
+            countLines(buf);
+            setStatusMsg("Indexing... %lld lines", p->lines);
+            refreshScreen();
+            last = profNow();
+        }
+    }
+    countLines(buf);
+    long long lines = buf->above + buf->numrows + buf->below;
+    if (line >= lines)
+        line = lines - 1;
+    return line < 0 ? 0 : line;
+}
+
+// Offset of the line 'line', that is indexed, from the checkpoint before it.
+static off_t lineOffset(struct pager *p, long long line) {
+    off_t at = p->index[line / PAGER_STEP];
+
+    for (long long j = line % PAGER_STEP; j > 0; j--)
+        at = (char *)memchr(p->map + at, '\n', p->size - at) + 1 - p->map;
+    return at;
+}
+
+// Open comment state before the line 'line', that is indexed and starts at
+// 'at', lexing the lines from the checkpoint before it.
+static int stateBefore(struct pager *p, long long line, off_t at) {
+    long long k = line / PAGER_STEP;
+    off_t from = p->index[k];
+    int oc = p->oc[k];
+
+    if (p->syntax == NULL)
+        return 0;
+    while (from < at) {
+        char *nl = memchr(p->map + from, '\n', at - from);
+        oc = lineOpenComment(p->syntax, p->map + from, nl - p->map - from, oc);
+        from = nl + 1 - p->map;
+    }
+    return oc;
+}
+
+// Line of the byte 'at' of the file, indexing the file up to it.
+static long long lineAt(struct pager *p, off_t at) {
+    long long lo = 0, hi, line;
+
+    while (p->indexed <= at && !indexChunk(p))
+        ;
+    hi = p->points - 1;
+    while (lo < hi) {
+        long long mid = (lo + hi + 1) / 2;
+        if (p->index[mid] <= at)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    line = lo * PAGER_STEP;
+    for (char *nl = p->map + p->index[lo];
+            (nl = memchr(nl, '\n', p->map + at - nl)) != NULL; nl++)
+        line++;
+    return line;
+}
+
+// Move from the line starting at 'at' by at most '*n' lines, down or up,
+// and 'bytes' bytes. Sets '*n' to the lines moved and returns the offset.
+static off_t linesAfter(struct pager *p, off_t at, int *n, off_t bytes) {
+    off_t from = at;
+    int j;
+
+    for (j = 0; j < *n && at < p->size && at - from < bytes; j++) {
+        char *nl = memchr(p->map + at, '\n', p->size - at);
+        at = nl ? nl + 1 - p->map : p->size;
+    }
+    *n = j;
+    return at;
+}
+
+static off_t linesBefore(struct pager *p, off_t at, int *n, off_t bytes) {
+    off_t from = at;
+    int j;
+
+    for (j = 0; j < *n && at > 0 && from - at < bytes; j++) {
+        // Skip the newline of the line before, then go to its start.
+        at--;
+        while (at > 0 && p->map[at - 1] != '\n')
+            at--;
+    }
+    *n = j;
+    return at;
+}
+
+// Bytes of the file in the row 'at', with its newline.
+static off_t rowBytes(Ebuf *buf, int at) {
+    int last = at == buf->numrows - 1 && buf->pager->end == buf->pager->size;
+
+    return buf->row[at].size + (last && buf->partial ? 0 : 1);
+}
+
+// Insert at 'at' the rows of the bytes [from, to) of the file.
+static int loadRows(Ebuf *buf, off_t from, off_t to, int at) {
+    Ebuf *cur = EC.buf;
+
+    EC.buf = buf;
+    int n = insertLines(at, buf->pager->map + from, to - from);
+    EC.buf = cur;
+    return n;
+}
+
+// Drop the rows at the top, or at the bottom, past 'rows' rows and 'bytes'
+// bytes.
+static void dropRows(Ebuf *buf, int rows, off_t bytes, int top) {
+    struct pager *p = buf->pager;
+    Ebuf *cur = EC.buf;
+    off_t dropped = 0;
+    int n = 0, dirty = buf->dirty;
+
+    while (n < buf->numrows - 1 &&
+            (buf->numrows - n > rows || p->end - p->start - dropped > bytes)) {
+        dropped += rowBytes(buf, top ? n : buf->numrows - 1 - n);
+        n++;
+    }
+    if (n == 0)
+        return;
+    EC.buf = buf;
+    if (top)
+        buf->above_oc = rowHasOpenComment(&buf->row[n - 1]);
+    delRows(top ? 0 : buf->numrows - n, n);
+    buf->dirty = dirty;
+    EC.buf = cur;
+    if (top) {
+        p->start += dropped;
+        buf->above += n;
+        shiftViews(buf, -n);
+    } else {
+        p->end -= dropped;
+    }
+    buf->partial = p->end == p->size && p->size && p->map[p->size - 1] != '\n';
+}
+
+// Load the window around the line 'line' of 'buf', unless it is already
+// in the rows.
+void pagerLoad(Ebuf *buf, long long line) {
+    struct pager *p = buf->pager;
+    Ebuf *cur = EC.buf;
+    int dirty = buf->dirty, up = PAGER_ROWS / 2, down = PAGER_ROWS - PAGER_ROWS / 2;
+
+    line = indexTo(buf, line);
+    if (line >= buf->above && line < buf->above + buf->numrows)
+        return;
+    off_t at = lineOffset(p, line);
+    off_t from = linesBefore(p, at, &up, PAGER_BYTES / 2);
+    off_t to = linesAfter(p, at, &down, PAGER_BYTES / 2);
+    long long above = buf->above;
+
+    EC.buf = buf;
+    delRows(0, buf->numrows);
+    EC.buf = cur;
+    buf->above_oc = stateBefore(p, line - up, from);
+    loadRows(buf, from, to, 0);
+    buf->dirty = dirty;
+    buf->above = line - up;
+    p->start = from;
+    p->end = to;
+    buf->partial = p->end == p->size && p->size && p->map[p->size - 1] != '\n';
+    shiftViews(buf, above - buf->above);
+    countLines(buf);
+}
+
+// Slide the window of the current view when the cursor gets near its top
+// or its bottom, by a quarter of its lines.
+void pagerScroll(void) {
+    Eview *view = EC.view;
+    Ebuf *buf = view->buf;
+    struct pager *p = buf->pager;
+    int filerow = view->row_offset + view->cy, n = PAGER_ROWS / 4;
+
+    if (p == NULL)
+        return;
+    if (filerow < view->screenrows * 2 && p->start > 0) {
+        off_t from = linesBefore(p, p->start, &n, PAGER_BYTES / 4);
+        buf->above_oc = stateBefore(p, buf->above - n, from);
+        loadRows(buf, from, p->start, 0);
+        p->start = from;
+        buf->above -= n;
+        shiftViews(buf, n);
+        dropRows(buf, PAGER_ROWS, PAGER_BYTES, 0);
+    } else if (filerow >= buf->numrows - view->screenrows * 2 && p->end < p->size) {
+        off_t to = linesAfter(p, p->end, &n, PAGER_BYTES / 4);
+        loadRows(buf, p->end, to, buf->numrows);
+        p->end = to;
+        dropRows(buf, PAGER_ROWS, PAGER_BYTES, 1);
+    }
+    countLines(buf);
+}
+
+// Lines of the document of 'buf', indexing all of a huge file.
+long long pagerLines(Ebuf *buf) {
+    if (buf->pager)
+        indexTo(buf, LLONG_MAX);
+    return buf->above + buf->numrows + buf->below;
+}
+
+// Offset of the first match of 'q' in the bytes [from, to) of the file, or
+// of the last one if 'dir' is -1. Returns -1 if there is none.
+static off_t findBytes(struct pager *p, off_t from, off_t to, const char *q,
+        size_t qlen, int dir) {
+    if (to - from < (off_t)qlen)
+        return -1;
+    if (dir > 0) {
+        for (char *c = p->map + from;
+                (c = memchr(c, q[0], p->map + to - qlen + 1 - c)) != NULL; c++)
+            if (memcmp(c, q, qlen) == 0)
+                return c - p->map;
+        return -1;
+    }
+    for (off_t at = to - qlen; at >= from; at--)
+        if (p->map[at] == q[0] && memcmp(p->map + at, q, qlen) == 0)
+            return at;
+    return -1;
+}
+
+// Search 'query' in the file out of the rows of 'buf', from the rows on
+// for 'dir' 1 and back from them for -1, going around the end of the file.
+// Returns the line of the match, or -1 if there is none.
+long long pagerFind(Ebuf *buf, const char *query, int dir) {
+    struct pager *p = buf->pager;
+    size_t qlen = strlen(query);
+    off_t at;
+
+    if (dir > 0 && (at = findBytes(p, p->end, p->size, query, qlen, 1)) == -1)
+        at = findBytes(p, 0, p->start, query, qlen, 1);
+    if (dir < 0 && (at = findBytes(p, 0, p->start, query, qlen, -1)) == -1)
+        at = findBytes(p, p->end, p->size, query, qlen, -1);
+    return at == -1 ? -1 : lineAt(p, at);
+}
+
+// Index the huge files until a key can be read from 'fd', drawing the line
+// counts as they grow.
+void pagerPoll(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while (1) {
+        double start = profNow();
+        int indexed = 0;
+
+        for (int j = 0; j < EC.numbufs; j++) {
+            Ebuf *buf = EC.bufs[j];
+            if (buf->pager == NULL || !buf->counting)
+                continue;
+            while (profNow() - start < PAGER_SLICE && !indexChunk(buf->pager))
+                ;
+            countLines(buf);
+            indexed = 1;
+        }
+        if (!indexed)
+            return;
+        refreshScreen();
+        if (poll(&pfd, 1, 0) > 0)
+            return;
+    }
+}
+
+// Hash of the name of the syntax the states of the lines were lexed with.
+static uint64_t syntaxHash(struct editorSyntax *syntax) {
+    if (syntax == NULL)
+        return 0;
+    return hashBytes(syntax->filematch[0], strlen(syntax->filematch[0]));
+}
+
+// Hash of INDEX_SAMPLES blocks spread over the file, the first and the last
+// ones included.
+static uint64_t sampleHash(int fd, off_t size) {
+    char block[INDEX_SAMPLE];
+    uint64_t h = size;
+
+    for (int j = 0; j < INDEX_SAMPLES; j++) {
+        off_t at = size > INDEX_SAMPLE ?
+            (size - INDEX_SAMPLE) * j / (INDEX_SAMPLES - 1) : 0;
+        ssize_t len = pread(fd, block, INDEX_SAMPLE, at);
+        if (len <= 0)
+            break;
+        h = (h ^ hashBytes(block, len)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Path of the index cache of 'filename', in $XDG_CACHE_HOME/chibidit or in
+// ~/.cache/chibidit, that are created. Returns NULL if there is no home.
+static char *cachePath(char *filename) {
+    char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char abs[2 * PATH_MAX], dir[PATH_MAX], *path;
+
+    // Named by the hash of the absolute path of the file.
+    if (filename[0] == '/')
+        snprintf(abs, sizeof(abs), "%s", filename);
+    else if (getcwd(dir, sizeof(dir)) != NULL)
+        snprintf(abs, sizeof(abs), "%s/%s", dir, filename);
+    else
+        return NULL;
+    if (xdg && xdg[0]) {
+        snprintf(dir, sizeof(dir), "%s/chibidit", xdg);
+    } else if (home && home[0]) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%s/.cache/chibidit", home);
+    } else {
+        return NULL;
+    }
+    mkdir(dir, 0700);
+    if ((path = malloc(strlen(dir) + 32)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    sprintf(path, "%s/%016llx.idx", dir,
+            (unsigned long long)hashBytes(abs, strlen(abs)));
+    return path;
+}
+
+// Use the index cache of the file as its index if it was written for the
+// file as it is now. Returns non zero if it was.
+static int indexLoad(struct pager *p) {
+    struct indexHeader *h;
+    struct stat st;
+    int fd = open(p->cache_path, O_RDONLY);
+
+    if (fd == -1)
+        return 0;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*h)) {
+        close(fd);
+        return 0;
+    }
+    h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+        return 0;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) ||
+            h->size != p->size || h->mtime != p->mtime.tv_sec ||
+            h->mtime_ns != p->mtime.tv_nsec || h->hash != p->hash ||
+            h->syntax != syntaxHash(p->syntax) || h->points < 1 ||
+            st.st_size != (off_t)(sizeof(*h) +
+                h->points * (sizeof(off_t) + 1))) {
+        munmap(h, st.st_size);
+        return 0;
+    }
+    free(p->index);
+    free(p->oc);
+    p->cache = (char *)h;
+    p->cache_size = st.st_size;
+    p->index = (off_t *)(h + 1);
+    p->oc = (unsigned char *)(p->index + h->points);
+    p->points = p->cap = h->points;
+    p->lines = h->lines;
+    p->indexed = p->size;
+    return 1;
+}
+
+// Write the index of the file, all indexed, to its cache. It is written
+// aside then renamed, so that a cache half written is never read.
+static void indexSave(struct pager *p) {
+    struct indexHeader h;
+    char *tmp;
+    FILE *fp;
+    int ok;
+
+    if (p->cache_path == NULL || p->cache)
+        return;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.size = p->size;
+    h.mtime = p->mtime.tv_sec;
+    h.mtime_ns = p->mtime.tv_nsec;
+    h.hash = p->hash;
+    h.syntax = syntaxHash(p->syntax);
+    h.points = p->points;
+    h.lines = p->lines;
+    if ((tmp = malloc(strlen(p->cache_path) + 16)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    sprintf(tmp, "%s.%d", p->cache_path, (int)getpid());
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        free(tmp);
+        return;
+    }
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        fwrite(p->index, sizeof(off_t), p->points, fp) == (size_t)p->points &&
+        fwrite(p->oc, 1, p->points, fp) == (size_t)p->points;
+    if (fclose(fp) != 0 || !ok || rename(tmp, p->cache_path) == -1)
+        unlink(tmp);
+    free(tmp);
+}
+
+// Open 'filename' read only in a new buffer, as a window over the file.
+void pagerOpen(char *filename) {
+    struct pager *p = malloc(sizeof(*p));
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if (p == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("Opening file");
+        exit(1);
+    }
+    memset(p, 0, sizeof(*p));
+    p->size = st.st_size;
+    if (p->size) {
+        p->map = mmap(NULL, p->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p->map == MAP_FAILED) {
+            perror("Mapping file");
+            exit(1);
+        }
+    }
+    p->fd = fd;
+    p->mtime = st.st_mtim;
+    p->cap = 64;
+    if ((p->index = malloc(sizeof(off_t) * p->cap)) == NULL ||
+            (p->oc = malloc(p->cap)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    p->oc[p->points] = 0;
+    p->index[p->points++] = 0;
+
+    openBuffer(NULL);
+    EC.buf->filename = strdup(filename);
+    selectSyntaxHighlight(filename);
+    EC.buf->window = 1;
+    EC.buf->counting = 1;
+    EC.buf->pager = p;
+    p->syntax = EC.buf->syntax;
+    if (p->size && (p->cache_path = cachePath(filename)) != NULL) {
+        p->hash = sampleHash(fd, p->size);
+        indexLoad(p);
+    }
+    pagerLoad(EC.buf, 0);
+}
+
+void pagerFree(Ebuf *buf) {
+    struct pager *p = buf->pager;
+
+    if (p == NULL)
+        return;
+    if (p->map)
+        munmap(p->map, p->size);
+    close(p->fd);
+    if (p->cache) {
+        munmap(p->cache, p->cache_size);
+    } else {
+        free(p->index);
+        free(p->oc);
+    }
+    free(p->cache_path);
+    free(p);
+    buf->pager = NULL;
+}
@@ -0,0 +1,95 @@
+#include "chibidit.h"
+#include <pthread.h>
+
+/* =============================== Thread pool ==============================
+ *
+ * Work that splits in independent tasks, as scanning ranges of rows, runs
+ * on a pool of threads, one per processor, started on the first use. The
+ * calling thread runs tasks as well, and poolRun() returns once all of them
+ * ran. The tasks must touch nothing but what they are given: the row
+ * allocator in particular is not thread safe. */
+
+#define POOL_MAX_THREADS 16
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* Signaled when a job starts, */
+    pthread_cond_t done;    /* and when its last task ran. */
+    int threads;            /* Threads started, -1 before the first job. */
+    void (*fn)(void *arg, int task);
+    void *arg;
+    int ntasks;             /* Tasks of the current job, */
+    int next;               /* the next one to run, */
+    int finished;           /* and the ones that ran. */
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, -1, NULL, NULL, 0, 0, 0};
+
+// Run the tasks of the current job until none is left, with the lock held.
+static void runTasks(void) {
+    while (pool.next < pool.ntasks) {
+        void (*fn)(void *arg, int task) = pool.fn;
+        void *arg = pool.arg;
+        int task = pool.next++;
+
+        pthread_mutex_unlock(&pool.lock);
+        fn(arg, task);
+        pthread_mutex_lock(&pool.lock);
+        if (++pool.finished == pool.ntasks)
+            pthread_cond_signal(&pool.done);
+    }
+}
+
+static void *worker(void *unused __attribute__((unused))) {
+    pthread_mutex_lock(&pool.lock);
+    while (1) {
+        while (pool.next >= pool.ntasks)
+            pthread_cond_wait(&pool.work, &pool.lock);
+        runTasks();
+    }
+    return NULL;
+}
+
+// Start the threads, the signals are left to the main thread.
+static void startThreads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    sigset_t all, old;
+    pthread_t t;
+
+    if (n > POOL_MAX_THREADS - 1)
+        n = POOL_MAX_THREADS - 1;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    // With no threads at all the tasks just run in the calling thread.
+    for (pool.threads = 0; pool.threads < n; pool.threads++)
+        if (pthread_create(&t, NULL, worker, NULL) != 0 || pthread_detach(t) != 0)
+            break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// Number of threads running the tasks, the calling one included.
+int poolThreads(void) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.threads == -1)
+        startThreads();
+    pthread_mutex_unlock(&pool.lock);
+    return pool.threads + 1;
+}
+
+// Call 'fn(arg, task)' for every task from 0 to 'ntasks' - 1 on the threads
+// of the pool, and return once all the calls returned.
+void poolRun(int ntasks, void (*fn)(void *arg, int task), void *arg) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.threads == -1)
+        startThreads();
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.ntasks = ntasks;
+    pool.next = 0;
+    pool.finished = 0;
+    pthread_cond_broadcast(&pool.work);
+    runTasks();
+    while (pool.finished < pool.ntasks)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pool.ntasks = pool.next = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,179 @@
+#include "chibidit.h"
+
+/* ================================ Profiling ===============================
+ *
+ * The hot paths of a frame are timed with the monotonic clock: decoding the
+ * key in readKey(), the syntax highlight of the rows, building the screen in
+ * refreshScreen() and the write(2) of it. A frame starts when the first byte
+ * of a key is read (the time spent waiting for the user is not counted) and
+ * ends when the screen has been written; what is left once the timed
+ * sections are subtracted is the time spent handling the key.
+ *
+ * All of this is done only when EC.profiling is set, that is when the
+ * overlay is shown (Ctrl-T) or a trace file was given with -t, otherwise
+ * every probe costs a single test. */
+
+#define PROF_HISTORY 128    /* Frames kept for the rolling histogram. */
+
+static const char *section_names[PROF_SECTIONS] = {
+    "key", "hl", "draw", "write"
+};
+
+// Upper bound, in ms, of every histogram bucket but the last one, and the
+// glyphs used to draw a bucket from empty to full.
+static const double hist_bounds[] = {0.1, 0.25, 0.5, 1, 2, 4, 8, 16, 33};
+#define HIST_BUCKETS (sizeof(hist_bounds) / sizeof(hist_bounds[0]) + 1)
+static const char hist_glyphs[] = " .:-=+*#%@";
+
+typedef struct profFrame {
+    double start;               /* Start of the frame, 0 if not started. */
+    double total;
+    double time[PROF_SECTIONS];
+    unsigned long count[PROF_COUNTERS];
+    unsigned long long allocs;
+} profFrame;
+
+static profFrame cur, last;
+static unsigned long long frame_allocs;    /* Row allocs at frame start. */
+static double history[PROF_HISTORY];
+static int history_len, history_next;
+static int overlay;                         /* Is the overlay shown ? */
+static FILE *trace;
+static unsigned long trace_frames;
+static double trace_epoch;
+
+double profNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long rowAllocs(void) {
+    struct rowStats st;
+    rowStatsGet(&st);
+    return st.allocs;
+}
+
+static void profUpdate(void) {
+    int enable = overlay || trace != NULL;
+    if (enable && !EC.profiling) {
+        memset(&cur, 0, sizeof(cur));
+        frame_allocs = rowAllocs();
+    }
+    EC.profiling = enable;
+}
+
+// Add the time elapsed since 'start' to the section 'sec' of the frame.
+void profAdd(int sec, double start) {
+    double now = profNow();
+    if (cur.start == 0 || start < cur.start)
+        cur.start = start;
+    cur.time[sec] += now - start;
+}
+
+void profCount(int cnt, unsigned long n) {
+    cur.count[cnt] += n;
+}
+
+// Called once the screen was written: the current frame becomes the last
+// one, goes into the histogram and the trace file.
+void profFrameEnd(void) {
+    unsigned long long allocs = rowAllocs();
+
+    cur.total = profNow() - cur.start;
+    cur.allocs = allocs - frame_allocs;
+    frame_allocs = allocs;
+    last = cur;
+    memset(&cur, 0, sizeof(cur));
+
+    history[history_next] = last.total;
+    history_next = (history_next + 1) % PROF_HISTORY;
+    if (history_len < PROF_HISTORY)
+        history_len++;
+
+    if (trace) {
+        double edit = last.total;
+        fprintf(trace, "%lu %.3f %.3f", trace_frames++,
+                (last.start - trace_epoch) * 1000, last.total * 1000);
+        for (int j = 0; j < PROF_SECTIONS; j++) {
+            fprintf(trace, " %.3f", last.time[j] * 1000);
+            edit -= last.time[j];
+        }
+        fprintf(trace, " %.3f %lu %lu %llu\n", edit * 1000,
+                last.count[PROF_ROWS], last.count[PROF_BYTES], last.allocs);
+    }
+}
+
+void profToggleOverlay(void) {
+    overlay = !overlay;
+    profUpdate();
+}
+
+// Write a line for every frame to 'filename', with the times in ms.
+int profTrace(char *filename) {
+    trace = fopen(filename, "w");
+    if (trace == NULL)
+        return -1;
+    // Line buffered, so that the trace is complete even if we are killed.
+    setvbuf(trace, NULL, _IOLBF, 0);
+    trace_epoch = profNow();
+    fprintf(trace, "# frame start total");
+    for (int j = 0; j < PROF_SECTIONS; j++)
+        fprintf(trace, " %s", section_names[j]);
+    fprintf(trace, " edit rows bytes allocs\n");
+    profUpdate();
+    return 0;
+}
+
+// Format the overlay in 'buf': the timing of the last frame and the
+// histogram of the last frames. Returns the length, or 0 when the overlay
+// is not shown.
+int profOverlay(char *buf, int len) {
+    int counts[HIST_BUCKETS] = {0}, max = 0;
+    double edit = last.total;
+    struct coldStats cold;
+    int n;
+
+    if (!overlay)
+        return 0;
+
+    n = snprintf(buf, len, "%.3fms", last.total * 1000);
+    for (int j = 0; j < PROF_SECTIONS && n < len; j++) {
+        n += snprintf(buf + n, len - n, " %s %.3f", section_names[j],
+                last.time[j] * 1000);
+        edit -= last.time[j];
+    }
+    if (n < len)
+        n += snprintf(buf + n, len - n,
+                " edit %.3f | %lu rows %lu bytes %llu allocs |", edit * 1000,
+                last.count[PROF_ROWS], last.count[PROF_BYTES], last.allocs);
+    // The compression of the cold rows, and how often they were thawed
+    // already when needed.
+    coldStatsGet(&cold);
+    if (cold.raw && n < len) {
+        unsigned long long looked = cold.hits + cold.misses;
+        n += snprintf(buf + n, len - n, " cold %.1fx %.0f%% hits |",
+                (double)cold.raw / cold.zipped,
+                looked ? 100.0 * cold.hits / looked : 0);
+    }
+
+    for (int j = 0; j < history_len; j++) {
+        size_t b = 0;
+        while (b < HIST_BUCKETS - 1 && history[j] * 1000 > hist_bounds[b])
+            b++;
+        if (++counts[b] > max)
+            max = counts[b];
+    }
+    if (n < len)
+        n += snprintf(buf + n, len - n, " %gms[", hist_bounds[0]);
+    for (size_t b = 0; b < HIST_BUCKETS && n < len - 1; b++) {
+        // Any non empty bucket gets at least the first visible glyph.
+        int level = max ?
+            (counts[b] * (int)(sizeof(hist_glyphs) - 2) + max - 1) / max : 0;
+        buf[n++] = hist_glyphs[level];
+    }
+    if (n < len)
+        n += snprintf(buf + n, len - n, "]%gms",
+                hist_bounds[HIST_BUCKETS - 2]);
+    return n < len ? n : len - 1;
+}
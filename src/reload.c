@@ -0,0 +1,336 @@
+#include "chibidit.h"
+
+/* ================================ Reloading ===============================
+ *
+ * Reloading a file changed on disk replaces only the rows that changed, the
+ * others keep their render, highlight and columns, and the cursors stay on
+ * their lines. The rows equal at the start and at the end of the file are
+ * skipped comparing their bytes, then the lines in between are hashed and
+ * diffed with the Myers algorithm, that finds the shortest edit script
+ * turning the old rows into the new lines: the rows it keeps are moved as
+ * they are. Edit scripts longer than RELOAD_MAX_EDITS lines are not
+ * searched, then all the rows in between are replaced.
+ *
+ * So reloading after a small change still reads and compares all the file,
+ * but renders and highlights just the changed rows. */
+
+#define RELOAD_MAX_EDITS 512    /* Longest edit script searched. */
+
+struct line {
+    char *s;            /* Null terminated, in the file contents. */
+    int len;
+};
+
+// Hash of a line, eight bytes at a time.
+uint64_t hashBytes(const char *s, int len) {
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)len, w;
+    int j = 0;
+
+    for (; j + 8 <= len; j += 8) {
+        memcpy(&w, s + j, 8);
+        h = (h ^ w) * 1099511628211ULL;
+        h ^= h >> 29;
+    }
+    w = 0;
+    memcpy(&w, s + j, len - j);
+    h = (h ^ w) * 1099511628211ULL;
+    return h ^ (h >> 32);
+}
+
+static int rowEquals(Erow *row, struct line *l) {
+    return row->size == l->len &&
+        memcmp(coldPeek(EC.buf, row->idx), l->s, l->len) == 0;
+}
+
+// Split the 'size' bytes of 'data' in lines as editorOpen() does, the
+// newlines are replaced by null terminators. 'data' must have room for one
+// more byte. Returns the number of lines, or -1 if a line is too long.
+static int splitLines(char *data, size_t size, struct line **lines, int *partial) {
+    size_t count = 0, j = 0;
+    char *p = data, *end = data + size;
+
+    for (char *nl = p; (nl = memchr(nl, '\n', end - nl)) != NULL; nl++)
+        count++;
+    *lines = malloc(sizeof(struct line) * (count + 1));
+    if (*lines == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    *partial = 0;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+
+        if (len > INT_MAX - 1) {
+            free(*lines);
+            return -1;
+        }
+        if (nl == NULL) {
+            *partial = 1;
+            if (len && p[len - 1] == '\r')
+                len--;
+        }
+        p[len] = '\0';
+        (*lines)[j].s = p;
+        (*lines)[j].len = len;
+        j++;
+        p += nl ? len + 1 : (size_t)(end - p);
+    }
+    return j;
+}
+
+// Shortest edit script between the lines hashed in a[0..n) and b[0..m).
+// Sets 'from' to the index in 'a' of every line of 'b' kept, or -1 for the
+// inserted ones. Returns -1, with nothing kept, if more than
+// RELOAD_MAX_EDITS lines are inserted or deleted.
+static int diffLines(uint64_t *a, int n, uint64_t *b, int m, int *from) {
+    int limit = n + m < RELOAD_MAX_EDITS ? n + m : RELOAD_MAX_EDITS;
+    int off = limit + 1, d, k, x, y;
+    int *v = malloc(sizeof(int) * (2 * limit + 3));
+    // The furthest point on every diagonal after each step d, the values
+    // for the diagonals -d..d start at trace[d * d].
+    int *trace = malloc(sizeof(int) * (limit + 1) * (limit + 1));
+
+    if (v == NULL || trace == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    for (int j = 0; j < m; j++)
+        from[j] = -1;
+    v[off + 1] = 0;
+    for (d = 0; d <= limit; d++) {
+        for (k = -d; k <= d; k += 2) {
+            // Go down (insert a line of 'b') or right (delete one of 'a'),
+            // whichever reaches further, then along the equal lines.
+            if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+                x = v[off + k + 1];
+            else
+                x = v[off + k - 1] + 1;
+            y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            v[off + k] = x;
+            if (x >= n && y >= m)
+                break;
+        }
+        memcpy(trace + d * d, v + off - d, sizeof(int) * (2 * d + 1));
+        if (k <= d)
+            break;
+    }
+    free(v);
+    if (d > limit) {
+        free(trace);
+        return -1;
+    }
+
+    // Walk back from the end, the equal lines are the diagonal moves.
+    x = n;
+    y = m;
+    for (; d >= 0; d--) {
+        int *prev = trace + (d - 1) * (d - 1) + (d - 1);
+        int pk, px, mx;
+
+        k = x - y;
+        if (d == 0) {
+            mx = 0;
+        } else {
+            pk = (k == -d || (k != d && prev[k - 1] < prev[k + 1])) ? k + 1 : k - 1;
+            px = prev[pk];
+            mx = pk == k + 1 ? px : px + 1;
+        }
+        while (x > mx) {
+            x--;
+            y--;
+            from[y] = x;
+        }
+        if (d > 0) {
+            x = px;
+            y = px - pk;
+        }
+    }
+    free(trace);
+    return 0;
+}
+
+// New index of the row 'at', after the 'n' rows from 'first' were replaced
+// by 'm' rows, mapped by 'to'. A replaced row goes to the next row kept.
+static int mapRow(int at, int first, int n, int m, int *to) {
+    if (at < first)
+        return at;
+    if (at >= first + n)
+        return at - n + m;
+    for (int j = at - first; j < n; j++)
+        if (to[j] >= 0)
+            return first + to[j];
+    return first + m;
+}
+
+static void mapViews(Elayout *node, Ebuf *buf, int first, int n, int m, int *to) {
+    if (node->type != LAYOUT_VIEW) {
+        mapViews(node->child[0], buf, first, n, m, to);
+        mapViews(node->child[1], buf, first, n, m, to);
+        return;
+    }
+    Eview *view = node->view;
+    if (view->buf != buf)
+        return;
+    int filerow = mapRow(view->row_offset + view->cy, first, n, m, to);
+    view->row_offset = mapRow(view->row_offset, first, n, m, to);
+    view->skip = 0;
+    gotoRow(view, filerow);
+}
+
+// Replace the 'n' rows of the current buffer from 'first' with the 'm'
+// 'lines', keeping the rows that did not change. Returns the number of rows
+// inserted.
+static int replaceRows(int first, int n, struct line *lines, int m) {
+    Ebuf *buf = EC.buf;
+    Erow *old = buf->row + first;
+    uint64_t *a = malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t *b = malloc(sizeof(uint64_t) * (m + 1));
+    int *from = malloc(sizeof(int) * (m + 1));
+    int *to = malloc(sizeof(int) * (n + 1));
+    unsigned char *oldoc = malloc(n + 1);
+    Erow *rows = malloc(sizeof(Erow) * (m + 1));
+    int inserted = 0;
+
+    if (!a || !b || !from || !to || !oldoc || !rows) {
+        perror("Out of memory");
+        exit(1);
+    }
+    // The rows kept are moved, and must not be frozen.
+    coldThaw(buf, first, first + n);
+    for (int j = 0; j < n; j++) {
+        a[j] = hashBytes(old[j].chars, old[j].size);
+        to[j] = -1;
+        oldoc[j] = old[j].hl_oc;
+    }
+    for (int j = 0; j < m; j++)
+        b[j] = hashBytes(lines[j].s, lines[j].len);
+    diffLines(a, n, b, m, from);
+
+    // Move the rows kept, the hashes may collide so compare them as well.
+    if (buf->arena == NULL && buf->cold == NULL)
+        buf->arena = rowArenaNew();
+    for (int j = 0; j < m; j++) {
+        int i = from[j];
+        if (i >= 0 && rowEquals(&old[i], &lines[j])) {
+            rows[j] = old[i];
+            to[i] = j;
+        } else {
+            from[j] = -1;
+            rowArenaUse(lines[j].len > LONG_ROW_SIZE ? NULL : buf->arena);
+            rowInit(&rows[j], first + j, lines[j].s, lines[j].len);
+            inserted++;
+        }
+    }
+    rowArenaUse(NULL);
+    for (int j = 0; j < n; j++)
+        if (to[j] == -1)
+            freeRow(&old[j]);
+
+    spliceRows(first, n, rows, m);
+    int numrows = buf->numrows;
+
+    // Render and highlight the new rows. A row kept after a different row
+    // than before starts in another comment state if the open comment
+    // state of the row before it changed.
+    for (int j = 0; j < m; j++)
+        if (from[j] == -1)
+            updateRow(&buf->row[first + j]);
+    for (int j = 0; j <= m && first + j < numrows; j++) {
+        int i = j < m ? from[j] : n;
+        if (i == -1 || (j > 0 ? from[j - 1] == i - 1 && i > 0 : i == 0))
+            continue;
+        int then = i > 0 ? oldoc[i - 1] : first > 0 ? buf->row[first - 1].hl_oc : 0;
+        int now = first + j > 0 ? buf->row[first + j - 1].hl_oc : 0;
+        if (then != now)
+            updateSyntaxHighLight(&buf->row[first + j]);
+    }
+
+    // The cursors stay on their lines.
+    mapViews(EC.layout, buf, first, n, m, to);
+    if (EC.view->buf != buf) {
+        int filerow = mapRow(buf->row_offset + buf->cy, first, n, m, to);
+        buf->row_offset = mapRow(buf->row_offset, first, n, m, to);
+        buf->cy = filerow - buf->row_offset;
+    }
+
+    free(a);
+    free(b);
+    free(from);
+    free(to);
+    free(oldoc);
+    free(rows);
+    return inserted;
+}
+
+// Read the file of 'buf' again, replacing just the rows that changed.
+int reloadBuffer(Ebuf *buf) {
+    struct stat st;
+    struct line *lines;
+    char *data;
+    int fd, numlines, partial;
+    size_t got = 0;
+
+    if (buf->filename == NULL) {
+        setStatusMsg("No file name");
+        return -1;
+    }
+    if (buf->window) {
+        setStatusMsg("The buffer is read only");
+        return -1;
+    }
+    fd = open(buf->filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        setStatusMsg("Can't reload! I/O error: %s", strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    data = malloc(st.st_size + 1);
+    if (data == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    while (got < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + got, st.st_size - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    if ((numlines = splitLines(data, got, &lines, &partial)) == -1) {
+        setStatusMsg("Can't reload! Some line is too long");
+        free(data);
+        return -1;
+    }
+
+    Ebuf *cur = EC.buf;
+    EC.buf = buf;
+    rowCommit();
+    // Skip the rows equal at the start and at the end.
+    int first = 0, last = 0;
+    while (first < buf->numrows && first < numlines &&
+            rowEquals(&buf->row[first], &lines[first]))
+        first++;
+    while (last < buf->numrows - first && last < numlines - first &&
+            rowEquals(&buf->row[buf->numrows - 1 - last], &lines[numlines - 1 - last]))
+        last++;
+    int n = buf->numrows - first - last, m = numlines - first - last;
+    int inserted = n || m ? replaceRows(first, n, lines + first, m) : 0;
+    buf->dirty = 0;
+    undoFree(buf);
+    buf->partial = partial;
+    watchStat(buf, &st);
+    buf->loaded = got;
+    EC.buf = cur;
+
+    free(lines);
+    free(data);
+    setStatusMsg("\"%.20s\" reloaded, %d rows changed, %d deleted",
+            buf->filename, inserted, n - (m - inserted));
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "chibidit.h"
+
+/* =========================== Search and replace ===========================
+ *
+ * ':%s/pattern/replacement/g' replaces a literal pattern in a range of
+ * rows. The matches are planned first, in parallel: the rows are split in
+ * ranges of REPLACE_ROWS rows scanned on the thread pool, every range
+ * noting the rows that match and the offsets of the matches, so the plan
+ * takes memory for the matches only. The rows are then changed on the main
+ * thread, each one built at once in a single block, and the old chars go
+ * to a single undo group. The rows changed are rendered, then highlighted
+ * in one pass, see updateRows(). */
+
+#define REPLACE_ROWS 16384  /* Rows scanned by a task. */
+
+// Matches in a range of rows.
+struct plan {
+    int from, to;       /* Range of rows scanned. */
+    struct {
+        int row;        /* Row with matches, */
+        int count;      /* and their number. */
+    } *rows;
+    long long nrows, caprows;
+    int *offs;          /* Offsets of all the matches. */
+    long long noffs, capoffs;
+};
+
+struct replaceJob {
+    Erow *row;          /* Rows of the buffer. */
+    const char *pat;
+    int plen;
+    int global;         /* Replace all the matches of a row, or the first. */
+    struct plan *plans;
+};
+
+static void *grow(void *p, long long *cap, long long n, size_t size) {
+    if (n < *cap)
+        return p;
+    *cap = *cap ? *cap * 2 : 64;
+    if ((p = realloc(p, size * *cap)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+// Plan the matches of the range 'task', on a thread of the pool.
+static void planRange(void *arg, int task) {
+    struct replaceJob *job = arg;
+    struct plan *p = &job->plans[task];
+
+    for (int j = p->from; j < p->to; j++) {
+        char *s = job->row[j].chars, *m;
+        int count = 0;
+
+        while ((m = strstr(s, job->pat)) != NULL) {
+            p->offs = grow(p->offs, &p->capoffs, p->noffs, sizeof(int));
+            p->offs[p->noffs++] = m - job->row[j].chars;
+            count++;
+            s = m + job->plen;
+            if (!job->global)
+                break;
+        }
+        if (count == 0)
+            continue;
+        p->rows = grow(p->rows, &p->caprows, p->nrows, sizeof(*p->rows));
+        p->rows[p->nrows].row = j;
+        p->rows[p->nrows++].count = count;
+    }
+}
+
+// Replace 'pat' by 'rep' in the rows [from, to] of the current buffer, all
+// the matches of a row if 'global' is set. Returns the number of matches
+// replaced, or -1 on error.
+long long replace(int from, int to, const char *pat, const char *rep, int global) {
+    Ebuf *buf = EC.buf;
+    int plen = strlen(pat), rlen = strlen(rep), ntasks, *changed, nchanged = 0;
+    long long matches = 0, rows = 0;
+
+    if (plen == 0) {
+        setStatusMsg("Empty pattern");
+        return -1;
+    }
+    if (to >= buf->numrows)
+        to = buf->numrows - 1;
+    if (from < 0)
+        from = 0;
+    if (from > to) {
+        setStatusMsg("Pattern not found: %s", pat);
+        return 0;
+    }
+
+    // The scan needs all the rows as plain strings.
+    rowCommit();
+    ntasks = (to - from) / REPLACE_ROWS + 1;
+    struct replaceJob job = {buf->row, pat, plen, global,
+        calloc(ntasks, sizeof(struct plan))};
+    if (job.plans == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    for (int t = 0; t < ntasks; t++) {
+        job.plans[t].from = from + t * REPLACE_ROWS;
+        job.plans[t].to = t == ntasks - 1 ? to + 1 : from + (t + 1) * REPLACE_ROWS;
+    }
+    // A single range is planned here, waking the pool would cost more.
+    if (ntasks == 1)
+        planRange(&job, 0);
+    else
+        poolRun(ntasks, planRange, &job);
+    for (int t = 0; t < ntasks; t++)
+        rows += job.plans[t].nrows;
+    if (rows == 0) {
+        free(job.plans);
+        setStatusMsg("Pattern not found: %s", pat);
+        return 0;
+    }
+
+    // Build the new rows, from the top.
+    if ((changed = malloc(sizeof(int) * rows)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    undoBegin();
+    for (int t = 0; t < ntasks; t++) {
+        struct plan *p = &job.plans[t];
+        int *off = p->offs;
+
+        for (long long k = 0; k < p->nrows; k++) {
+            Erow *row = &buf->row[p->rows[k].row];
+            int count = p->rows[k].count;
+            long long size = row->size + (long long)count * (rlen - plen);
+
+            off += count;
+            if (size > INT_MAX - 1)
+                continue;
+            char *chars = rowAlloc(size + 1), *d = chars;
+            int at = 0;
+            for (int j = -count; j < 0; j++) {
+                memcpy(d, row->chars + at, off[j] - at);
+                d += off[j] - at;
+                memcpy(d, rep, rlen);
+                d += rlen;
+                at = off[j] + plen;
+            }
+            memcpy(d, row->chars + at, row->size - at + 1);
+            undoSave(p->rows[k].row, 1, 1, row);
+            row->chars = chars;
+            row->size = size;
+            changed[nchanged++] = p->rows[k].row;
+            matches += count;
+        }
+        free(p->rows);
+        free(p->offs);
+    }
+    free(job.plans);
+    updateRows(changed, nchanged);
+    free(changed);
+    buf->dirty++;
+    undoEnd();
+    clampCursor(EC.view);
+    setStatusMsg("%lld substitutions on %d lines", matches, nchanged);
+    return matches;
+}
@@ -21,137 +21,445 @@ void abFree(struct abuf *ab) {
     free(ab->b);
 }
 
-void refreshScreen(void) {
-    int y;
-    Erow *r;
+// Append 'n' blank columns.
+static void abPad(struct abuf *ab, int n) {
+    static const char spaces[] = "                                ";
+
+    while (n > 0) {
+        int chunk = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+        abAppend(ab, spaces, chunk);
+        n -= chunk;
+    }
+}
+
+// Move to the zero-based screen position 'y', 'x'.
+static void abMoveTo(struct abuf *ab, int y, int x) {
     char buf[32];
-    struct abuf ab = ABUF_INIT;
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    abAppend(ab, buf, len);
+}
 
-    // Hide cursor
-    abAppend(&ab, "\x1b[?25l", 6);
-    // Go home
-    abAppend(&ab, "\x1b[H", 3);
-    for (y = 0; y < EC.screenrows; y++) {
-        int filerow = EC.row_offset + y;
+// Draw 'msg' centered on a line of the view, returns the used columns.
+static int drawCentered(struct abuf *ab, Eview *view, const char *msg) {
+    int msglen = strlen(msg);
+    int padding = (view->screencols - msglen) / 2;
+    int width = 0;
 
-        // Open initialized editor home
-        if (filerow >= EC.numrows) {
-            if (EC.numrows == 0 && y == EC.screenrows / 3) {
-                char welcome[80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        "Welcome, Chibidit Editor\x1b[0K\r\n");
-                int padding = (EC.screencols - welcomelen) / 2;
-                if (padding) {
-                    abAppend(&ab, "~", 1);
-                    padding--;
-                }
-                while (padding--)
-                    abAppend(&ab, " ", 1);
-                abAppend(&ab, welcome, welcomelen);
-                y++;
-
-                char submsg[80];
-                int submsg_len = snprintf(submsg, sizeof(submsg),
-                        "This is a Toy Text Editor written by C-language.\x1b[0K\r\n");
-                int sub_padding = (EC.screencols - submsg_len) / 2;
-                if (sub_padding) {
-                    abAppend(&ab, "~", 1);
-                    padding--;
-                }
-                while (sub_padding--)
-                    abAppend(&ab, " ", 1);
-                abAppend(&ab, submsg, submsg_len);
-            } else {
-                abAppend(&ab, "~\x1b[0K\r\n", 7);
+    if (msglen > view->screencols)
+        msglen = view->screencols;
+    if (padding > 0) {
+        abAppend(ab, "~", 1);
+        abPad(ab, padding - 1);
+        width = padding;
+    }
+    abAppend(ab, msg, msglen);
+    return width + msglen;
+}
+
+// Append the character 'c' of 'len' bytes highlighted as 'hl', changing
+// the current color if needed.
+static void drawChar(struct abuf *ab, const char *c, int len, int hl,
+        int *current_color) {
+    if (hl == HL_NONPRINT) {
+        char sym;
+        abAppend(ab, "\x1b[7m", 4);
+        if ((unsigned char)*c <= 26)
+            sym = '@' + *c;
+        else
+            sym = '?';
+        abAppend(ab, &sym, 1);
+        abAppend(ab, "\x1b[0m", 4);
+    } else if (hl == HL_NORMAL) {
+        if (*current_color != -1) {
+            abAppend(ab, "\x1b[39m", 5);
+            *current_color = -1;
+        }
+        abAppend(ab, c, len);
+    } else {
+        int color = syntaxToColor(hl);
+        if (color != *current_color) {
+            char buf[16];
+            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+            *current_color = color;
+            abAppend(ab, buf , clen);
+        }
+        abAppend(ab, c, len);
+    }
+}
+
+// Turn the reverse video of the visual selection on or off, for the screen
+// column 'col' of a row that has the columns [sel[0], sel[1]) selected.
+static void drawSelection(struct abuf *ab, const int *sel, int col, int *on) {
+    int in = sel && col >= sel[0] && col < sel[1];
+
+    if (in != *on) {
+        abAppend(ab, in ? "\x1b[7m" : "\x1b[27m", in ? 4 : 5);
+        *on = in;
+    }
+}
+
+// Draw a row that has no render, the one in the gap buffer or a long row:
+// TABs are expanded here, and the highlight of a long row is computed for
+// the visible bytes only. Returns the used columns.
+static int drawLazyRow(struct abuf *ab, Eview *view, Erow *r, int col_offset,
+        const int *sel) {
+    int current_color = -1, selected = 0;
+    int j = rowOffsetAtCol(r, col_offset);
+    int width = rowCol(r, j) - col_offset;
+    int from = j, end = r->size;
+    unsigned char *hlwin = NULL;
+
+    if (r->lr) {
+        // A wide character may overlap the right edge.
+        end = rowOffsetAtCol(r, col_offset + view->screencols + 1);
+        if (end > r->size)
+            end = r->size;
+        if (j < end)
+            hlwin = rowLongHighlight(view->buf, r, j, end);
+    }
+
+    abPad(ab, width);
+    while (j < end) {
+        char c[4];
+        int hl = hlwin ? hlwin[j - from] : rowGapHl(r, j);
+        int len = 1, cwidth = 1;
+
+        c[0] = rowByte(r, j);
+        if (c[0] == TAB) {
+            // Draw the spaces of the TAB that fit, up to the tab stop after
+            // the current column.
+            int col = col_offset + width + 1;
+            while ((col + 1) % 8 != 0)
+                col++;
+            for (cwidth = col - col_offset - width;
+                    cwidth > 0 && width < view->screencols; cwidth--) {
+                drawSelection(ab, sel, col_offset + width, &selected);
+                drawChar(ab, " ", 1, hl, &current_color);
+                width++;
             }
+            if (cwidth)
+                break;
+            j++;
             continue;
         }
+        if ((unsigned char)c[0] >= 0x80 && hl != HL_NONPRINT) {
+            int cp;
+            len = rowDecode(r, j, &cp);
+            for (int k = 1; k < len; k++)
+                c[k] = rowByte(r, j + k);
+            if (cp < 0)
+                hl = HL_NONPRINT;
+            else
+                cwidth = utf8Width(cp);
+        }
+        if (width + cwidth > view->screencols)
+            break;
+        drawSelection(ab, sel, col_offset + width, &selected);
+        drawChar(ab, c, len, hl, &current_color);
+        // A non printable character resets the attributes.
+        selected &= hl != HL_NONPRINT;
+        width += cwidth;
+        j += len;
+    }
+    drawSelection(ab, NULL, 0, &selected);
+    abAppend(ab, "\x1b[39m", 5);
+    return width;
+}
+
+// Draw the columns of the row from 'col_offset' on that fit in the view,
+// the columns [sel[0], sel[1]) selected if 'sel' is not NULL. Returns the
+// used columns.
+static int drawRow(struct abuf *ab, Eview *view, Erow *r, int col_offset,
+        const int *sel) {
+    int current_color = -1, selected = 0;
+    int j, width;
+
+    if (r->gap || r->lr)
+        return drawLazyRow(ab, view, r, col_offset, sel);
+
+    // A wide character may be cut by the left edge of the view.
+    j = rowOffsetAtCol(r, col_offset);
+    width = rowCol(r, j) - col_offset;
+    abPad(ab, width);
+    j = rowRender(r, j);
+
+    // Never start drawing in the middle of a UTF-8 sequence.
+    while (j < r->rsize && ((unsigned char)r->render[j] & 0xc0) == 0x80)
+        j++;
+    while (j < r->rsize) {
+        char *c = r->render + j;
+        int hl = r->hl[j];
+        int len = 1, cwidth = 1;
+
+        if ((unsigned char)*c >= 0x80 && hl != HL_NONPRINT) {
+            int cp;
+            len = utf8Decode(c, r->rsize - j, &cp);
+            if (cp < 0)
+                hl = HL_NONPRINT;
+            else
+                cwidth = utf8Width(cp);
+        }
+        if (width + cwidth > view->screencols)
+            break;
+        drawSelection(ab, sel, col_offset + width, &selected);
+        drawChar(ab, c, len, hl, &current_color);
+        // A non printable character resets the attributes.
+        selected &= hl != HL_NONPRINT;
+        width += cwidth;
+        j += len;
+    }
+    drawSelection(ab, NULL, 0, &selected);
+    abAppend(ab, "\x1b[39m", 5);
+    return width;
+}
 
-        r = &EC.row[filerow];
-        int len = r->rsize - EC.col_offset;
-        int current_color = -1;
-        if (len > 0) {
-            if (len > EC.screencols)
-                len = EC.screencols;
-
-            char *c = r->render + EC.col_offset;
-            unsigned char *hl = r->hl + EC.col_offset;
-            for (int j = 0; j < len; j++) {
-                if (hl[j] == HL_NONPRINT) {
-                    char sym;
-                    abAppend(&ab, "\x1b[7m", 4);
-                    if (c[j] <= 26)
-                        sym = '@' + c[j];
-                    else
-                        sym = '?';
-                    abAppend(&ab, &sym, 1);
-                    abAppend(&ab, "\x1b[0m", 4);
-                } else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        abAppend(&ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(&ab, c + j, 1);
-                } else {
-                    int color = syntaxToColor(hl[j]);
-                    if (color != current_color) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        current_color = color;
-                        abAppend(&ab, buf , clen);
-                    }
-                    abAppend(&ab, c + j, 1);
-                }
+// Draw the closed fold of the rows 'at' to 'end' on a line: the number of
+// rows and the text of the first one, without its indentation. Returns the
+// used columns.
+static int drawFold(struct abuf *ab, Eview *view, int at, int end) {
+    Erow *r = rowAt(view->buf, at);
+    char head[32];
+    int len = snprintf(head, sizeof(head), "+--%4d lines: ", end - at + 1);
+    int width = len < view->screencols ? len : view->screencols, j = 0;
+
+    abAppend(ab, "\x1b[36m", 5);
+    abAppend(ab, head, width);
+    while (j < r->size && (rowByte(r, j) == ' ' || rowByte(r, j) == TAB))
+        j++;
+    while (j < r->size) {
+        char c[4];
+        int cp, cwidth = 1, clen = rowDecode(r, j, &cp);
+
+        for (int k = 0; k < clen; k++)
+            c[k] = rowByte(r, j + k);
+        // TABs and control characters are a single blank.
+        if (cp < 0x20 || cp == 0x7f) {
+            c[0] = ' ';
+            clen = 1;
+        } else if (cp >= 0x80) {
+            cwidth = utf8Width(cp);
+        }
+        if (width + cwidth > view->screencols)
+            break;
+        abAppend(ab, c, clen);
+        width += cwidth;
+        j += clen;
+    }
+    while (width < view->screencols) {
+        abAppend(ab, "-", 1);
+        width++;
+    }
+    abAppend(ab, "\x1b[39m", 5);
+    return width;
+}
+
+// Draw the line number of the row 'filerow', or blanks if it is -1, on the
+// gutter of the view. 'line' is the line of the row past the closed folds,
+// and 'cursor' the one of the cursor row, for the relative numbers. The
+// digits are written from the end of a line of blanks, without printf, as
+// a frame draws a number on every line.
+static void drawGutter(struct abuf *ab, Eview *view, int filerow, int line,
+        int cursor) {
+    char s[32];
+    int j = view->gutter - 1, current = line == cursor;
+
+    memset(s, ' ', view->gutter);
+    if (filerow != -1) {
+        long long n = view->buf->above + filerow + 1;
+        if ((view->number & NUMBER_RELATIVE) &&
+                !(current && (view->number & NUMBER_ABSOLUTE)))
+            n = line > cursor ? line - cursor : cursor - line;
+        do {
+            s[--j] = '0' + n % 10;
+            n /= 10;
+        } while (n && j > 0);
+    }
+    abAppend(ab, current ? "\x1b[1;33m" : "\x1b[33m", current ? 7 : 5);
+    abAppend(ab, s, view->gutter);
+    abAppend(ab, "\x1b[0m", 4);
+}
+
+// Draw the rows of the view. In wrap mode a row goes on as many lines as
+// needed, every line shows the next screen width of its columns.
+static void drawRows(struct abuf *ab, Eview *view) {
+    Ebuf *buf = view->buf;
+    int filerow = view->row_offset;
+    int line = 0, height = 1;   /* Line of the row drawn, and its lines. */
+    int end;                    /* Last row of a closed fold. */
+    // Lines of the row drawn and of the cursor row past the closed folds,
+    // for the relative line numbers.
+    int fline = foldLine(view, filerow);
+    int cursor = foldLine(view, view->row_offset + view->cy);
+
+    if (view->wrap && filerow < buf->numrows) {
+        height = wrapHeight(view, rowAt(buf, filerow));
+        line = view->skip < height ? view->skip : height - 1;
+    }
+    for (int y = 0; y < view->screenrows; y++) {
+        int width = 0;
+
+        abMoveTo(ab, view->top + y, view->left - view->gutter);
+        // Only the first line of a wrapped row is numbered.
+        if (view->gutter)
+            drawGutter(ab, view, filerow < buf->numrows && line == 0 ?
+                    filerow : -1, fline, cursor);
+        // Open initialized editor home
+        if (filerow >= buf->numrows) {
+            if (buf->numrows == 0 && y == view->screenrows / 3) {
+                width = drawCentered(ab, view, "Welcome, Chibidit Editor");
+            } else if (buf->numrows == 0 && y == view->screenrows / 3 + 1) {
+                width = drawCentered(ab, view,
+                        "This is a Toy Text Editor written by C-language.");
+            } else {
+                abAppend(ab, "~", 1);
+                width = 1;
             }
+        } else if ((end = foldShut(view, filerow)) != -1) {
+            width = drawFold(ab, view, filerow, end);
+        } else {
+            int sel[2], *selp;
+            selp = visualColumns(view, filerow, &sel[0], &sel[1]) ? sel : NULL;
+            width = drawRow(ab, view, rowAt(buf, filerow),
+                    view->wrap ? line * view->screencols : view->col_offset, selp);
+        }
+
+        // A view on the right edge can just clear the line, otherwise we
+        // must not touch the views on its right.
+        if (view->left + view->screencols == EC.screencols)
+            abAppend(ab, "\x1b[0K", 4);
+        else
+            abPad(ab, view->screencols - width);
+
+        if (++line >= height) {
+            // Past the rows of a closed fold.
+            filerow = foldRow(view, ++fline);
+            line = 0;
+            if (view->wrap && filerow < buf->numrows)
+                height = wrapHeight(view, rowAt(buf, filerow));
         }
-        abAppend(&ab, "\x1b[39m", 5);
-        abAppend(&ab, "\x1b[0K", 4);
-        abAppend(&ab, "\r\n", 2);
     }
+}
 
-    // Create a two status rows, First row.
-    abAppend(&ab, "\x1b[0K", 4);
-    abAppend(&ab, "\x1b[7m", 4);
+// Append the formatted string to the 'len' chars of the status 's' of
+// 'size' bytes. Returns the new length, truncated to fit.
+static int statusAppend(char *s, int size, int len, const char *fmt, ...) {
+    va_list ap;
+
+    if (len >= size - 1)
+        return size - 1;
+    va_start(ap, fmt);
+    len += vsnprintf(s + len, size - len, fmt, ap);
+    va_end(ap);
+    return len < size - 1 ? len : size - 1;
+}
+
+static void drawStatusBar(struct abuf *ab, Eview *view) {
+    Ebuf *buf = view->buf;
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-            EC.filename, EC.numrows, EC.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus),
-            "%d/%d", EC.row_offset + EC.cy + 1, EC.numrows);
-
-    if (len > EC.screencols)
-        len = EC.screencols;
-    abAppend(&ab, status, len);
-    while (len < EC.screencols) {
-        if (EC.screencols - len == rlen) {
-            abAppend(&ab, rstatus, rlen);
+    int cols = view->gutter + view->screencols, size = sizeof(status);
+
+    // Under the line numbers as well.
+    abMoveTo(ab, view->top + view->screenrows, view->left - view->gutter);
+    abAppend(ab, "\x1b[7m", 4);
+    long long lines = buf->above + buf->numrows + buf->below;
+    int len = statusAppend(status, size, 0, "%.20s - %lld%s lines %s",
+            buf->filename ? buf->filename : buf->stream ? "[stdin]" : "[No Name]",
+            lines, buf->counting ? "+" : "", buf->dirty ? "(modified)" : "");
+    if (buf->follow)
+        len = statusAppend(status, size, len, " [follow]");
+    if (buf->changed)
+        len = statusAppend(status, size, len, " [changed on disk]");
+    if (view == EC.view && macroRecording())
+        len = statusAppend(status, size, len, " [recording @%c]",
+                macroRecording());
+    if (view == EC.view && EC.numbufs > 1)
+        len = statusAppend(status, size, len, " [%d/%d]",
+                EC.curbuf + 1, EC.numbufs);
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%lld/%lld",
+            buf->above + view->row_offset + view->cy + 1, lines);
+
+    if (len > cols)
+        len = cols;
+    abAppend(ab, status, len);
+    while (len < cols) {
+        if (cols - len == rlen) {
+            abAppend(ab, rstatus, rlen);
             break;
         } else {
-            abAppend(&ab, " ", 1);
+            abAppend(ab, " ", 1);
             len++;
         }
     }
-    abAppend(&ab, "\x1b[0m\r\n", 6);
+    abAppend(ab, "\x1b[0m", 4);
+}
+
+// Draw the views of the layout tree and the separators between the views
+// split side by side.
+static void drawLayout(struct abuf *ab, Elayout *node) {
+    if (node->type == LAYOUT_VIEW) {
+        drawRows(ab, node->view);
+        drawStatusBar(ab, node->view);
+        return;
+    }
+    drawLayout(ab, node->child[0]);
+    drawLayout(ab, node->child[1]);
+    if (node->type == LAYOUT_VSPLIT) {
+        abAppend(ab, "\x1b[7m", 4);
+        for (int y = 0; y < node->rows; y++) {
+            abMoveTo(ab, node->top + y, node->child[1]->left - 1);
+            abAppend(ab, "|", 1);
+        }
+        abAppend(ab, "\x1b[0m", 4);
+    }
+}
 
-    // Second row depends on EC.statusmsg and the status message update time.
+// Compose all the views in a single buffer, and flush them to the terminal
+// with a single write.
+void refreshScreen(void) {
+    struct abuf ab = ABUF_INIT;
+    char overlay[256];
+    int overlen;
+
+    // Replaying a macro, the screen is drawn once at the end.
+    if (EC.batch)
+        return;
+    PROF_START(start);
+
+    // Hide cursor
+    abAppend(&ab, "\x1b[?25l", 6);
+    updateGutters();
+    drawLayout(&ab, EC.layout);
+
+    // The last row depends on EC.statusmsg and the status message update time.
+    abMoveTo(&ab, EC.screenrows, 0);
     abAppend(&ab, "\x1b[0K", 4);
+    // The profiling overlay, when shown, takes the place of the message.
     int msglen = strlen(EC.statusmsg);
-    if (msglen && time(NULL) - EC.statusmsg_time < 5)
+    if ((overlen = profOverlay(overlay, sizeof(overlay))) != 0)
+        abAppend(&ab, overlay, overlen <= EC.screencols ? overlen : EC.screencols);
+    else if (msglen && time(NULL) - EC.statusmsg_time < 5)
         abAppend(&ab, EC.statusmsg, msglen <= EC.screencols ? msglen : EC.screencols);
 
     // Display cursor at its current position.
-    int cx = 1;
-    int filerow = EC.row_offset + EC.cy;
-    Erow *row = (filerow >= EC.numrows) ? NULL : &EC.row[filerow];
-    if (row) {
-        for (int j = EC.col_offset; j < (EC.cx + EC.col_offset); j++) {
-            if (j < row->size && row->chars[j] == TAB)
-                cx += 7 - ((cx) % 8);
-            cx++;
-        }
-    }
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", EC.cy + 1, cx);
-    abAppend(&ab, buf, strlen(buf));
+    Eview *view = EC.view;
+    int filerow = view->row_offset + view->cy;
+    Erow *row = (filerow >= EC.buf->numrows) ? NULL : rowAt(EC.buf, filerow);
+    int cx = (row ? rowCol(row, view->cx) : view->cx) - view->col_offset;
+    int cy = foldLine(view, filerow) - foldLine(view, view->row_offset);
+    if (view->wrap)
+        wrapCursor(view, &cy, &cx);
+    abMoveTo(&ab, view->top + cy, view->left + cx);
     abAppend(&ab, "\x1b[?25h", 6);
-    write(STDOUT_FILENO, ab.b, ab.len);
+    PROF_STOP(PROF_RENDER, start);
+
+    PROF_START(wstart);
+    if (EC.screen_sink)
+        EC.screen_sink(ab.b, ab.len);
+    else
+        write(STDOUT_FILENO, ab.b, ab.len);
+    PROF_STOP(PROF_WRITE, wstart);
+    PROF_COUNT(PROF_BYTES, ab.len);
     abFree(&ab);
+    if (EC.profiling)
+        profFrameEnd();
 }
@@ -0,0 +1,241 @@
+#include "chibidit.h"
+#include <poll.h>
+#include <sys/mman.h>
+
+/* ============================ Reading a stream ============================
+ *
+ * 'chibidit -' reads the document from its standard input, the output of a
+ * command most of the time, while the keys are read from the terminal. The
+ * bytes are read in chunks as they arrive, while waiting for a key (see
+ * readKey()), and appended as rows as in follow mode: the screen is drawn
+ * again every STREAM_SLICE seconds of reading.
+ *
+ * The memory of the rows is bounded to about STREAM_LIMIT bytes, past it the
+ * oldest rows are dropped: the rows are not packed in an arena, that would
+ * keep the memory of the rows dropped. With -S the stream is also spilled to
+ * a temporary file, mapped in memory, and the rows are a window over it
+ * that slides when the cursor gets near its top or its bottom: the rows
+ * dropped are read again from the map when needed. The window is tracked
+ * with the size of its rows, so the rows of a stream are read only. */
+
+#define STREAM_LIMIT (256 * 1024 * 1024)    /* Memory of the rows kept. */
+#define STREAM_CHUNK (1024 * 1024)          /* Bytes read at once. */
+#define STREAM_SLICE 0.05                   /* Seconds of reading between
+                                               two draws. */
+
+static struct {
+    Ebuf *buf;          /* Buffer of the stream, NULL if none. */
+    int fd;             /* The stream, -1 once at its end. */
+    int spill;          /* Temporary file with all the stream, or -1. */
+    char *map;          /* The spill file mapped in memory, */
+    size_t maplen;      /* and the bytes mapped. */
+    off_t total;        /* Bytes read from the stream. */
+    off_t start, end;   /* Bytes of the stream in the rows. */
+    long long newlines; /* Newlines read from the stream, */
+    char last;          /* and the last byte read. */
+} stream = {NULL, -1, -1, NULL, 0, 0, 0, 0, 0, '\n'};
+
+// Memory taken by 'rows' rows of 'bytes' bytes: the chars, render and hl
+// of the rows, and the row and the headers of its blocks.
+static off_t rowsCost(off_t bytes, off_t rows) {
+    return bytes * 3 + rows * (off_t)(sizeof(Erow) + 64);
+}
+
+// Take the document from the standard input, and read the keys from the
+// terminal instead. Called before the terminal is set up.
+void streamOpen(int spill) {
+    int fd = dup(STDIN_FILENO), tty = open("/dev/tty", O_RDWR);
+
+    if (fd == -1 || tty == -1 || dup2(tty, STDIN_FILENO) == -1) {
+        perror("Opening the terminal");
+        exit(1);
+    }
+    close(tty);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    stream.fd = fd;
+    if (spill) {
+        char path[] = "/tmp/chibidit-XXXXXX";
+        if ((stream.spill = mkstemp(path)) == -1) {
+            perror("Creating the spill file");
+            exit(1);
+        }
+        unlink(path);
+    }
+}
+
+// Open the buffer the stream is read into.
+void streamBuffer(void) {
+    openBuffer(NULL);
+    stream.buf = EC.buf;
+    EC.buf->stream = 1;
+    EC.buf->window = 1;
+    EC.buf->counting = 1;
+}
+
+// Count the lines of the stream out of the rows.
+static void countLines(void) {
+    Ebuf *buf = stream.buf;
+
+    buf->below = stream.newlines + (stream.last != '\n') - buf->above - buf->numrows;
+    if (buf->below < 0)
+        buf->below = 0;
+    buf->counting = stream.fd != -1;
+}
+
+// Bytes of the stream in the row 'at', with its newline.
+static off_t rowBytes(int at) {
+    Ebuf *buf = stream.buf;
+    int last = at == buf->numrows - 1 && stream.end == stream.total;
+
+    return buf->row[at].size + (last && buf->partial ? 0 : 1);
+}
+
+// Drop the rows at the top, or at the bottom, until the rows take at most
+// 'limit' bytes.
+static void dropRows(off_t limit, int top) {
+    Ebuf *buf = stream.buf, *cur = EC.buf;
+    off_t bytes = 0;
+    int n = 0, dirty = buf->dirty;
+
+    // The last row is kept, it may still grow.
+    while (rowsCost(stream.end - stream.start - bytes, buf->numrows - n) > limit &&
+            n < buf->numrows - 1) {
+        bytes += rowBytes(top ? n : buf->numrows - 1 - n);
+        n++;
+    }
+    if (n == 0)
+        return;
+    EC.buf = buf;
+    delRows(top ? 0 : buf->numrows - n, n);
+    buf->dirty = dirty;
+    EC.buf = cur;
+    if (top) {
+        stream.start += bytes;
+        buf->above += n;
+        shiftViews(buf, -n);
+    } else {
+        stream.end -= bytes;
+        buf->partial = 0;
+    }
+}
+
+// Map the spill file up to the end of the stream.
+static int mapSpill(void) {
+    if (stream.maplen == (size_t)stream.total)
+        return 0;
+    if (stream.map)
+        munmap(stream.map, stream.maplen);
+    stream.map = mmap(NULL, stream.total, PROT_READ, MAP_SHARED, stream.spill, 0);
+    if (stream.map == MAP_FAILED) {
+        stream.map = NULL;
+        stream.maplen = 0;
+        return -1;
+    }
+    stream.maplen = stream.total;
+    return 0;
+}
+
+// Insert at 'at' the rows of the spilled bytes [from, to), that start and
+// end at a line boundary. Returns the number of rows.
+static int loadRows(off_t from, off_t to, int at) {
+    Ebuf *cur = EC.buf;
+
+    EC.buf = stream.buf;
+    int n = insertLines(at, stream.map + from, to - from);
+    EC.buf = cur;
+    return n;
+}
+
+// Slide the window of rows over the spill file when the cursor gets near
+// its top or its bottom, by a quarter of the limit.
+void streamScroll(void) {
+    Eview *view = EC.view;
+    int filerow = view->row_offset + view->cy;
+    off_t lines = 0;
+
+    if (stream.spill == -1 || view->buf != stream.buf || mapSpill() == -1)
+        return;
+    if (filerow < view->screenrows && stream.start > 0) {
+        // Start at the line where the rows above take a quarter of the limit.
+        off_t from = stream.start - 1;
+        while (from > 0 && (stream.map[from - 1] != '\n' ||
+                    rowsCost(stream.start - from, ++lines) < STREAM_LIMIT / 4))
+            from--;
+        int n = loadRows(from, stream.start, 0);
+        stream.start = from;
+        view->buf->above -= n;
+        shiftViews(view->buf, n);
+        dropRows(STREAM_LIMIT, 0);
+    } else if (filerow >= view->buf->numrows - view->screenrows &&
+            stream.end < stream.total) {
+        off_t to = stream.end + 1;
+        while (to < stream.total && (stream.map[to - 1] != '\n' ||
+                    rowsCost(to - stream.end, ++lines) < STREAM_LIMIT / 4))
+            to++;
+        loadRows(stream.end, to, view->buf->numrows);
+        stream.end = to;
+        view->buf->partial = stream.map[to - 1] != '\n';
+        dropRows(STREAM_LIMIT, 1);
+    }
+    countLines();
+}
+
+// Read the stream for at most STREAM_SLICE seconds, or until nothing is
+// left to read now.
+static void streamRead(void) {
+    static char *chunk;
+    double start = profNow();
+    ssize_t n;
+
+    if (chunk == NULL && (chunk = malloc(STREAM_CHUNK + 1)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    do {
+        n = read(stream.fd, chunk, STREAM_CHUNK);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            break;
+        if (n <= 0) {
+            close(stream.fd);
+            stream.fd = -1;
+            countLines();
+            setStatusMsg("End of the input, %lld lines",
+                    stream.buf->above + stream.buf->numrows + stream.buf->below);
+            break;
+        }
+        for (char *nl = chunk; (nl = memchr(nl, '\n', chunk + n - nl)); nl++)
+            stream.newlines++;
+        stream.last = chunk[n - 1];
+        if (stream.spill != -1 && write(stream.spill, chunk, n) != n) {
+            setStatusMsg("Can't spill the input! I/O error: %s", strerror(errno));
+            close(stream.spill);
+            stream.spill = -1;
+        }
+        // The rows may be a window before the end of the spilled stream.
+        if (stream.end == stream.total) {
+            followAppend(stream.buf, chunk, n);
+            stream.end += n;
+        }
+        stream.total += n;
+        if (rowsCost(stream.end - stream.start, stream.buf->numrows) > STREAM_LIMIT)
+            dropRows(STREAM_LIMIT / 4 * 3, 1);
+        countLines();
+    } while (profNow() - start < STREAM_SLICE);
+}
+
+// Read the stream until a key can be read from 'fd', drawing the screen as
+// rows arrive. Returns after a while if nothing comes.
+void streamPoll(int fd) {
+    struct pollfd fds[2];
+
+    while (stream.fd != -1) {
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stream.fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, 100) <= 0 || (fds[0].revents & POLLIN))
+            return;
+        streamRead();
+        refreshScreen();
+    }
+}
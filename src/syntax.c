@@ -57,12 +57,22 @@ struct editorSyntax HLDB[] = {
 
 #define HLDB_ENTRIES (sizeof(HLDB)/sizeof(HLDB[0]))
 
+#define LINE_SEGMENT 65536  /* Bytes lexed at once by lineOpenComment(), */
+#define LINE_MARGIN 256     /* and longer than any token. */
+
 
 int is_separator(int c) {
     return c == '\0' || isspace(c) || strchr(",.()+-/*=~%[];", c) != NULL;
 }
 
 int rowHasOpenComment(Erow *row) {
+    if (row->gap)
+        return rowGapOpenComment(row);
+    if (row->lr)
+        return rowLongOpenComment(row);
+    // A frozen row has no highlight, its state is kept.
+    if (row->chars == NULL)
+        return row->hl_oc;
     if (row->hl && row->rsize && row->hl[row->rsize - 1] == HL_MLCOMMENT &&
             (row->rsize < 2 || (row->render[row->rsize - 2] != '*' ||
                                 row->render[row->rsize - 1] != '/')))
@@ -70,150 +80,271 @@ int rowHasOpenComment(Erow *row) {
     return 0;
 }
 
-void updateSyntaxHighLight(Erow *row) {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
-
-    if (EC.syntax == NULL) return; // No syntax, everything is HL_NORMAL.
-
-    int i, prev_sep, in_string, in_comment;
-    char *p;
-    char **keywords = EC.syntax->keywords;
-    char *scs = EC.syntax->singleline_comment_start;
-    char *mcs = EC.syntax->multiline_comment_start;
-    char *mce = EC.syntax->multiline_comment_end;
-
-    // Point to the first non-space char.
-    p = row->render;
-    i = 0; // Current char offset.
-    while(*p && isspace(*p)) {
-        i++;
-        p++;
-    }
-    prev_sep = 1; // Tell the parser if 'i' points to start of word.
-    in_string = 0; // Are we inside "" or '' ?
-    in_comment = 0; // Are we inside multi-line comment?
+// Is the byte 'at' of the row code, not in a comment nor in a string ? The
+// rows with no highlight yet are all code.
+int rowIsCode(Erow *row, int at) {
+    int hl;
 
-    // If the previous line has an open comment, this line starts
-    // with an open comment state.
-    if (row->idx > 0 && rowHasOpenComment(&EC.row[row->idx - 1]))
-        in_comment = 1;
-
-    while(*p) {
-        // Handle `//` comments
-        if (prev_sep && *p == scs[0] && *(p+1) == scs[1]) {
-            memset(row->hl + i, HL_COMMENT, row->size - i);
-            return;
+    if (row->gap)
+        hl = rowGapHl(row, at);
+    else if (row->lr || row->hl == NULL || row->hl_oc == HL_OC_DEFERRED)
+        return 1;
+    else
+        hl = row->hl[rowRender(row, at)];
+    return hl != HL_COMMENT && hl != HL_MLCOMMENT && hl != HL_STRING;
+}
+
+// Highlight the bytes of 's' from 'i' to 'len', starting with the lexer in
+// 'state' (see the HLS_* flags). 's' must be null terminated.
+//
+// When 'st' is not NULL the state before every byte is stored in it, so that
+// the highlight can be resumed later from there, and we stop at the first
+// byte at or after 'converge' where the state is the one already stored:
+// the text from there on did not change, and neither does its highlight.
+// Returns the offset where the highlight stopped.
+int highlightSpan(struct editorSyntax *syntax, const char *s, int i, int len,
+        unsigned char *hl, unsigned char *st, int state, int converge) {
+    char **keywords = syntax->keywords;
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+    int in_string = state & HLS_DQUOTE ? '"' : state & HLS_SQUOTE ? '\'' : 0;
+    int in_comment = (state & HLS_COMMENT) != 0;
+    int line_comment = (state & HLS_LINE_COMMENT) != 0;
+    int prev_sep = (state & HLS_SEP) != 0;  // Is 'i' at the start of a word ?
+    int prev_num = (state & HLS_NUMBER) != 0;
+
+    while (i < len) {
+        const char *p = s + i;
+        int n = 1;  // Bytes of this token.
+
+        if (st) {
+            int cur = (in_string == '"' ? HLS_DQUOTE : 0) |
+                (in_string == '\'' ? HLS_SQUOTE : 0) |
+                (in_comment ? HLS_COMMENT : 0) |
+                (line_comment ? HLS_LINE_COMMENT : 0) |
+                (prev_sep ? HLS_SEP : 0) | (prev_num ? HLS_NUMBER : 0);
+            if (i >= converge && st[i] == cur)
+                return i;
+            st[i] = cur;
+        }
+
+        // Handle `//` comments, up to the end of the row.
+        if (line_comment) {
+            if (st == NULL) {
+                memset(hl + i, HL_COMMENT, len - i);
+                return len;
+            }
+            hl[i++] = HL_COMMENT;
+            continue;
+        }
+        if (prev_sep && p[0] == scs[0] && p[1] == scs[1]) {
+            hl[i++] = HL_COMMENT;
+            line_comment = 1;
+            continue;
         }
 
-        // Handle multi-line comments
         if (in_comment) {
-            row->hl[i] = HL_MLCOMMENT;
-            if (*p == mce[0] && *(p+1) == mce[1]) {
-                row->hl[i+1] = HL_MLCOMMENT;
-                p += 2;
-                i += 2;
+            // Handle multi-line comments
+            hl[i] = HL_MLCOMMENT;
+            if (p[0] == mce[0] && p[1] == mce[1]) {
+                hl[i+1] = HL_MLCOMMENT;
+                n = 2;
                 in_comment = 0;
                 prev_sep = 1;
-                continue;
             } else {
                 prev_sep = 0;
-                p++;
-                i++;
-                continue;
             }
-        } else if (*p == mcs[0] && *(p+1) == mcs[1]) {
-            row->hl[i] = HL_MLCOMMENT;
-            row->hl[i+1] = HL_MLCOMMENT;
-            p += 2;
-            i += 2;
+            prev_num = 0;
+        } else if (p[0] == mcs[0] && p[1] == mcs[1]) {
+            hl[i] = HL_MLCOMMENT;
+            hl[i+1] = HL_MLCOMMENT;
+            n = 2;
             in_comment = 1;
             prev_sep = 0;
-            continue;
-        }
-
-        // Handle "" and '' string
-        if (in_string) {
-            row->hl[i] = HL_STRING;
-            if (*p == '\\') {
-                row->hl[i+1] = HL_STRING;
-                p += 2;
-                i += 2;
+            prev_num = 0;
+        } else if (in_string) {
+            // Handle "" and '' string
+            hl[i] = HL_STRING;
+            if (*p == '\\' && i + 1 < len) {
+                hl[i+1] = HL_STRING;
+                n = 2;
                 prev_sep = 0;
-                continue;
-            }
-            if (*p == in_string)
+            } else if (*p == in_string) {
                 in_string = 0;
-            p++;
-            i++;
-            continue;
-        } else {
-            if (*p == '"' || *p == '\'') {
-                in_string = *p;
-                row->hl[i] = HL_STRING;
-                p++;
-                i++;
-                prev_sep = 0;
-                continue;
             }
-        }
-
-        // Handle non printable chars
-        if (!isprint(*p)) {
-            row->hl[i] = HL_NONPRINT;
-            p++;
-            i++;
+            prev_num = 0;
+        } else if (*p == '"' || *p == '\'') {
+            in_string = *p;
+            hl[i] = HL_STRING;
             prev_sep = 0;
-            continue;
-        }
-
-        // Handle numbers
-        if ((isdigit(*p) && (prev_sep || row->hl[i-1] == HL_NUMBER)) ||
-                (*p == '.' && i > 0 && row->hl[i-1] == HL_NUMBER)) {
-            row->hl[i] = HL_NUMBER;
-            p++;
-            i++;
+            prev_num = 0;
+        } else if ((unsigned char)*p >= 0x80) {
+            // Handle UTF-8 sequences, only the invalid ones are non printable.
+            int cp;
+            n = utf8Decode(p, len - i, &cp);
+            memset(hl + i, cp < 0 ? HL_NONPRINT : HL_NORMAL, n);
             prev_sep = 0;
-            continue;
-        }
+            prev_num = 0;
+        } else if (!isprint(*p) && *p != TAB) {
+            // Handle non printable chars
+            hl[i] = HL_NONPRINT;
+            prev_sep = 0;
+            prev_num = 0;
+        } else if ((isdigit(*p) && (prev_sep || prev_num)) ||
+                (*p == '.' && prev_num)) {
+            // Handle numbers
+            hl[i] = HL_NUMBER;
+            prev_sep = 0;
+            prev_num = 1;
+        } else {
+            // Handle keywords and lib calls
+            int j = 0;
+            if (prev_sep) {
+                for (j = 0; keywords[j]; j++) {
+                    if (keywords[j][0] != *p)
+                        continue;
+                    int klen = strlen(keywords[j]);
+                    int kw2 = keywords[j][klen-1] == '|';
+                    if (kw2)
+                        klen--;
 
-        // Handle keywords and lib calls
-        if (prev_sep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen-1] == '|';
-                if (kw2)
-                    klen--;
-
-                if (!memcmp(p, keywords[j], klen) &&
-                        is_separator(*(p+klen))) {
-                    // Keyword
-                    memset(row->hl+i, kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    p += klen;
-                    i += klen;
-                    break;
+                    if (klen <= len - i && !memcmp(p, keywords[j], klen) &&
+                            is_separator(p[klen])) {
+                        // Keyword
+                        memset(hl + i, kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                        n = klen;
+                        break;
+                    }
                 }
             }
-            if (keywords[j] != NULL) {
+            if (prev_sep && keywords[j] != NULL) {
                 prev_sep = 0;
-                continue; // We had a keyword match
+            } else {
+                // Not special chars
+                hl[i] = HL_NORMAL;
+                prev_sep = is_separator(*p);
             }
+            prev_num = 0;
         }
 
-        // Not special chars
-        prev_sep = is_separator(*p);
-        p++;
-        i++;
+        if (st && n > 1)
+            memset(st + i + 1, HLS_NONE, n - 1);
+        i += n;
+    }
+    return len;
+}
+
+// Open comment state at the end of the 'len' bytes of the line 's', after a
+// line in the state 'oc', as rowHasOpenComment() finds it once the line is
+// a highlighted row. s[len] must be readable. A long line is lexed by
+// segments, each one resumed from a token start well before its end.
+int lineOpenComment(struct editorSyntax *syntax, const char *s, int len,
+        int oc) {
+    static unsigned char *hl, *st;
+    int state = HLS_SEP | (oc ? HLS_COMMENT : 0), from = 0;
+
+    if (hl == NULL && ((hl = malloc(LINE_SEGMENT + 2)) == NULL ||
+                (st = malloc(LINE_SEGMENT + 2)) == NULL)) {
+        perror("Out of memory");
+        exit(1);
+    }
+    if (len == 0)
+        return 0;
+    // Without the first byte of a delimiter the line is all in the state
+    // it starts in.
+    if (memchr(s, syntax->multiline_comment_start[0], len) == NULL &&
+            memchr(s, syntax->multiline_comment_end[0], len) == NULL &&
+            memchr(s, syntax->singleline_comment_start[0], len) == NULL)
+        return oc;
+    while (len - from > LINE_SEGMENT) {
+        // Tokens near the end may be cut, resume before them.
+        int k = LINE_SEGMENT - LINE_MARGIN;
+        highlightSpan(syntax, s + from, 0, LINE_SEGMENT, hl, st, state,
+                LINE_SEGMENT);
+        while (st[k] == HLS_NONE)
+            k--;
+        state = st[k];
+        from += k;
+    }
+    highlightSpan(syntax, s + from, 0, len - from, hl, NULL, state, 0);
+    return hl[len - from - 1] == HL_MLCOMMENT &&
+        (len < 2 || s[len - 2] != '*' || s[len - 1] != '/');
+}
+
+void highlightRow(Erow *row) {
+    PROF_COUNT(PROF_ROWS, 1);
+    if (row->gap) {
+        rowGapHighlight(row);
+        return;
     }
+    // Long rows are highlighted when drawn.
+    if (row->lr)
+        return;
 
-    // Propagate syntax change to the next row if the open comment
-    // state changed. This may recursively affect all the following rows
-    // in the file.
-    int oc = rowHasOpenComment(row);
-    if (row->hl_oc != oc && row->idx+1 < EC.numrows)
-        updateSyntaxHighLight(&EC.row[row->idx+1]);
-    row->hl_oc = oc;
+    row->hl = rowRealloc(row->hl, row->rsize);
+    if (EC.buf->syntax == NULL) {
+        // No syntax, everything is HL_NORMAL.
+        memset(row->hl, HL_NORMAL, row->rsize);
+        return;
+    }
+
+    // If the previous line has an open comment, this line starts
+    // with an open comment state.
+    int state = HLS_SEP;
+    if (row->idx > 0 ? rowHasOpenComment(&EC.buf->row[row->idx - 1]) :
+            EC.buf->above_oc)
+        state |= HLS_COMMENT;
+    highlightSpan(EC.buf->syntax, row->render, 0, row->rsize, row->hl, NULL,
+            state, 0);
+}
+
+void updateSyntaxHighLight(Erow *row) {
+    // In batch the row is just marked, see syntaxFlush(). Its highlight
+    // must keep the size of its render anyway.
+    motionRowChanged(row);
+    // A frozen row is highlighted from its chars.
+    rowAt(EC.buf, row->idx);
+    if (EC.batch) {
+        if (row->gap == NULL && row->lr == NULL)
+            row->hl = rowRealloc(row->hl, row->rsize);
+        row->hl_oc = HL_OC_DEFERRED;
+        return;
+    }
+
+    PROF_START(start);
+    while (1) {
+        highlightRow(row);
+
+        // Propagate syntax change to the next row if the open comment
+        // state changed. This may affect all the following rows in the
+        // file.
+        int oc = rowHasOpenComment(row);
+        int changed = row->hl_oc != oc;
+        row->hl_oc = oc;
+        if (!changed || row->idx + 1 >= EC.buf->numrows)
+            break;
+        row = rowAt(EC.buf, row->idx + 1);
+        motionRowChanged(row);
+    }
+    PROF_STOP(PROF_HIGHLIGHT, start);
+}
+
+// Highlight the rows marked in batch, in all the buffers. Every one is
+// highlighted from the top as if it was just changed, so the rows after it
+// are highlighted again as long as its open comment state changes.
+void syntaxFlush(void) {
+    Ebuf *cur = EC.buf;
+
+    rowCommit();
+    for (int b = 0; b < EC.numbufs; b++) {
+        // updateSyntaxHighLight() works on the current buffer.
+        EC.buf = EC.bufs[b];
+        for (int j = 0; j < EC.buf->numrows; j++)
+            if (EC.buf->row[j].hl_oc == HL_OC_DEFERRED)
+                updateSyntaxHighLight(&EC.buf->row[j]);
+    }
+    EC.buf = cur;
 }
 
 int syntaxToColor(int hl) {
@@ -238,7 +369,7 @@ void selectSyntaxHighlight(char *filename) {
             int patlen = strlen(s->filematch[i]);
             if ((p = strstr(filename, s->filematch[i])) != NULL) {
                 if (s->filematch[i][0] != '.' || p[patlen] == '\0') {
-                    EC.syntax = s;
+                    EC.buf->syntax = s;
                     return;
                 }
             }
@@ -0,0 +1,172 @@
+#include "chibidit.h"
+
+/* ================================== Undo ==================================
+ *
+ * Changes made to many rows at once, as a global replace, are recorded as
+ * an undo group: a list of edits, each one the rows [at, at + m) that took
+ * the place of 'n' rows whose chars are kept in the group. The chars are
+ * moved there, not copied, so a group takes the memory of the rows it
+ * changed only. Undoing a group puts the old chars back and keeps the ones
+ * it removed, so that the same group redoes the change.
+ *
+ * Only the last group of a buffer is kept, and it applies only as long as
+ * nothing else changed the buffer: the edits of single characters are not
+ * recorded, and the dirty counter of the buffer tells if there were any.
+ * Saving or reloading the buffer resets the counter, and frees the group. */
+
+struct undoText {
+    char *chars;
+    int size;
+};
+
+struct undoEdit {
+    int at;             /* First row changed, */
+    int n, m;           /* 'n' rows that were replaced by 'm' rows. */
+    long long text;     /* Index in 'texts' of the chars of the 'n' rows. */
+};
+
+struct undoGroup {
+    struct undoEdit *edits;
+    long long nedits, capedits;
+    struct undoText *texts;
+    long long ntexts, captexts;
+    int dirty;          /* Dirty counter of the buffer after the group. */
+    int undone;         /* Was the group undone ? Then it redoes. */
+};
+
+static void *grow(void *p, long long *cap, long long n, size_t size) {
+    if (n < *cap)
+        return p;
+    *cap = *cap ? *cap * 2 : 64;
+    if ((p = realloc(p, size * *cap)) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+void undoFree(Ebuf *buf) {
+    struct undoGroup *g = buf->undo;
+
+    if (g == NULL)
+        return;
+    for (long long j = 0; j < g->ntexts; j++)
+        rowFree(g->texts[j].chars);
+    free(g->texts);
+    free(g->edits);
+    free(g);
+    buf->undo = NULL;
+}
+
+static int depth;   /* Groups open: the inner ones join the outer one. */
+
+// Start a new undo group for the current buffer, dropping the last one. A
+// group started while another one is open joins it, so that a command made
+// of other ones, as ':g', is undone at once.
+void undoBegin(void) {
+    if (depth++)
+        return;
+    undoFree(EC.buf);
+    if ((EC.buf->undo = calloc(1, sizeof(struct undoGroup))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+}
+
+// Record that the rows [at, at + m) of the current buffer replace the 'n'
+// rows of 'old'. Their chars now belong to the group.
+void undoSave(int at, int n, int m, Erow *old) {
+    struct undoGroup *g = EC.buf->undo;
+
+    g->edits = grow(g->edits, &g->capedits, g->nedits, sizeof(struct undoEdit));
+    g->edits[g->nedits++] = (struct undoEdit){at, n, m, g->ntexts};
+    for (int j = 0; j < n; j++) {
+        g->texts = grow(g->texts, &g->captexts, g->ntexts, sizeof(struct undoText));
+        g->texts[g->ntexts++] = (struct undoText){old[j].chars, old[j].size};
+    }
+}
+
+// Close the group, once the rows of the current buffer are updated.
+void undoEnd(void) {
+    if (--depth)
+        return;
+    EC.buf->undo->dirty = EC.buf->dirty;
+}
+
+// Undo the last group of the current buffer, or redo it if 'redo' is set.
+// Returns 0 on success, -1 if there is nothing to undo.
+int undo(int redo) {
+    Ebuf *buf = EC.buf;
+    struct undoGroup *g = buf->undo, *r;
+    int *rows = NULL, nrows = 0, first = INT_MAX;
+
+    if (g == NULL || g->undone != redo) {
+        setStatusMsg(redo ? "Nothing to redo" : "Nothing to undo");
+        return -1;
+    }
+    if (g->dirty != buf->dirty) {
+        setStatusMsg("Can't %s, the buffer changed since", redo ? "redo" : "undo");
+        return -1;
+    }
+    if ((r = calloc(1, sizeof(*r))) == NULL ||
+            (rows = malloc(sizeof(int) * (g->ntexts + 1))) == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    rowCommit();
+    buf->undo = r;
+    // The edits are undone from the last, the group that redoes them has
+    // them in the reverse order: it undoes them from the first.
+    for (long long e = g->nedits - 1; e >= 0; e--) {
+        struct undoEdit *ed = &g->edits[e];
+        struct undoText *t = g->texts + ed->text;
+
+        coldThaw(buf, ed->at, ed->at + ed->m);
+        undoSave(ed->at, ed->m, ed->n, buf->row + ed->at);
+        if (ed->at < first)
+            first = ed->at;
+        if (ed->n == ed->m) {
+            // Same rows: just swap their chars, the rest is updated.
+            for (int j = 0; j < ed->n; j++) {
+                buf->row[ed->at + j].chars = t[j].chars;
+                buf->row[ed->at + j].size = t[j].size;
+                rows[nrows++] = ed->at + j;
+            }
+            continue;
+        }
+        // Update the swapped rows before the other ones move.
+        updateRows(rows, nrows);
+        nrows = 0;
+        Erow *new = malloc(sizeof(Erow) * (ed->n + 1));
+        if (new == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        for (int j = 0; j < ed->n; j++)
+            rowInitChars(&new[j], ed->at + j, t[j].chars, t[j].size);
+        for (int j = 0; j < ed->m; j++) {
+            buf->row[ed->at + j].chars = NULL;
+            freeRow(&buf->row[ed->at + j]);
+        }
+        spliceRows(ed->at, ed->m, new, ed->n);
+        for (int j = 0; j < ed->n; j++)
+            updateRow(&buf->row[ed->at + j]);
+        // The row after them may start with another open comment state.
+        if (ed->at + ed->n < buf->numrows)
+            updateSyntaxHighLight(&buf->row[ed->at + ed->n]);
+        free(new);
+    }
+    updateRows(rows, nrows);
+    free(rows);
+    r->undone = !redo;
+    free(g->texts);
+    free(g->edits);
+    setStatusMsg("%lld %s %s", g->nedits, g->nedits == 1 ? "change" : "changes",
+            redo ? "redone" : "undone");
+    free(g);
+    buf->dirty++;
+    r->dirty = buf->dirty;
+    if (first != INT_MAX)
+        gotoRow(EC.view, first);
+    return 0;
+}
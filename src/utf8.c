@@ -0,0 +1,119 @@
+#include "chibidit.h"
+
+/* ============================ UTF-8 support ===============================
+ *
+ * Rows are kept as UTF-8 bytes, these functions are used to decode code
+ * points and to know how many columns they take on the terminal.
+ *
+ * The display width is looked up in two small sorted tables of code point
+ * ranges, one for the zero width (combining) characters and one for the
+ * double width (East Asian wide and fullwidth, emoji) ones. Everything
+ * else is one column wide. The code points below U+0300 never hit the
+ * tables at all. */
+
+struct utf8Range {
+    int first, last;
+};
+
+static const struct utf8Range zero_width[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0900, 0x0902}, {0x093A, 0x093A},
+    {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+    {0x20D0, 0x20FF}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF}, {0xE0001, 0xE007F},
+    {0xE0100, 0xE01EF},
+};
+
+static const struct utf8Range double_width[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x3029},
+    {0x302E, 0x303E}, {0x3041, 0x3098}, {0x309B, 0x33FF}, {0x3400, 0x4DBF},
+    {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60},
+    {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF},
+    {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+    {0x1F200, 0x1F251}, {0x1F300, 0x1F3FA}, {0x1F400, 0x1F64F}, {0x1F680, 0x1F6FF},
+    {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD},
+    {0x30000, 0x3FFFD},
+};
+
+static int inRanges(int cp, const struct utf8Range *r, int n) {
+    int lo = 0, hi = n - 1;
+
+    if (cp < r[0].first || cp > r[n - 1].last)
+        return 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < r[mid].first)
+            hi = mid - 1;
+        else if (cp > r[mid].last)
+            lo = mid + 1;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+// Number of columns used by the code point 'cp' on the terminal.
+int utf8Width(int cp) {
+    if (cp < 0x300)
+        return 1;
+    if (inRanges(cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0])))
+        return 0;
+    if (inRanges(cp, double_width, sizeof(double_width) / sizeof(double_width[0])))
+        return 2;
+    return 1;
+}
+
+// Decode the code point at 's', reading at most 'len' bytes. Returns the
+// length of the sequence and stores the code point in 'cp'. Invalid or
+// truncated sequences are consumed one byte at a time, with 'cp' set to -1.
+int utf8Decode(const char *s, int len, int *cp) {
+    const unsigned char *p = (const unsigned char *)s;
+    int n, c;
+
+    if (p[0] < 0x80) {
+        *cp = p[0];
+        return 1;
+    } else if ((p[0] & 0xe0) == 0xc0) {
+        n = 2;
+        c = p[0] & 0x1f;
+    } else if ((p[0] & 0xf0) == 0xe0) {
+        n = 3;
+        c = p[0] & 0x0f;
+    } else if ((p[0] & 0xf8) == 0xf0) {
+        n = 4;
+        c = p[0] & 0x07;
+    } else {
+        goto invalid;
+    }
+    if (n > len)
+        goto invalid;
+    for (int j = 1; j < n; j++) {
+        if ((p[j] & 0xc0) != 0x80)
+            goto invalid;
+        c = (c << 6) | (p[j] & 0x3f);
+    }
+    // Reject overlong forms, surrogates and out of range code points.
+    if ((n == 2 && c < 0x80) || (n == 3 && c < 0x800) ||
+            (n == 4 && c < 0x10000) || c > 0x10ffff ||
+            (c >= 0xd800 && c <= 0xdfff))
+        goto invalid;
+    *cp = c;
+    return n;
+
+invalid:
+    *cp = -1;
+    return 1;
+}
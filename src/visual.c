@@ -0,0 +1,443 @@
+#include "chibidit.h"
+
+/* ======================== Visual mode and registers =======================
+ *
+ * 'v', 'V' and Ctrl-V select the characters, the whole lines or the block
+ * of columns between the position where they were typed, the anchor, and
+ * the cursor. 'y' yanks the selection in a register, 'd' deletes it as
+ * well, and 'p' or 'P' put the register after or before the cursor. The
+ * register is the unnamed one, unless the command follows '"' and a letter:
+ * the unnamed register then stands for that one until the next yank.
+ *
+ * A register does not copy the rows it yanks whole: it shares the blocks of
+ * their chars, render and highlight (see rowShare() in src/alloc.c), so that
+ * it takes a few pointers by row, and putting them back in the same buffer
+ * shares the blocks again instead of rendering and highlighting the rows.
+ * Whoever changes a shared block first gets a copy of its own. The blocks
+ * of a file loaded in the arena of its buffer keep the arena alive as long
+ * as a register holds them, and are copied when put in another buffer.
+ *
+ * Deleting and putting is a single change for undo, see src/undo.c. */
+
+#define REGISTERS 27    /* The unnamed one, then 'a' to 'z'. */
+
+struct regLine {
+    char *chars;
+    int size;
+    char *render;       /* Blocks shared with the row yanked, NULL if it */
+    unsigned char *hl;  /* must be rendered again when put. */
+    int *cols;
+    int rsize;
+    int multibyte;      /* Do the render offsets follow the columns ? */
+    int hl_oc;
+};
+
+struct reg {
+    int type;           /* VISUAL, VISUAL_LINE or VISUAL_BLOCK. */
+    struct regLine *lines;
+    int n;
+    struct rowArena *arena;         /* Arena of the rows yanked, retained. */
+    struct editorSyntax *syntax;    /* Highlight of the lines, */
+    int oc;                         /* that starts with this open comment
+                                       state. */
+};
+
+static struct reg regs[REGISTERS];
+static int unnamed;     /* Register the unnamed one stands for. */
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+static void regClear(struct reg *r) {
+    for (int j = 0; j < r->n; j++) {
+        rowFree(r->lines[j].chars);
+        rowFree(r->lines[j].render);
+        rowFree(r->lines[j].hl);
+        rowFree(r->lines[j].cols);
+    }
+    free(r->lines);
+    rowArenaFree(r->arena);
+    memset(r, 0, sizeof(*r));
+}
+
+// Open comment state the row at 'at' starts with.
+static int ocBefore(int at) {
+    return at > 0 && rowHasOpenComment(&EC.buf->row[at - 1]);
+}
+
+// Enter the visual mode 'mode' with the anchor at the cursor, or change the
+// kind of selection. Typing the mode we are in leaves it.
+void visualMode(int mode) {
+    if (EC.mode == mode) {
+        EC.mode = NORMAL;
+        setStatusMsg("");
+        return;
+    }
+    if (EC.mode == NORMAL) {
+        EC.vrow = EC.view->row_offset + EC.view->cy;
+        EC.vcol = EC.view->cx;
+    }
+    EC.mode = mode;
+    setStatusMsg(mode == VISUAL ? "---VISUAL MODE---" :
+            mode == VISUAL_LINE ? "---VISUAL LINE---" : "---VISUAL BLOCK---");
+}
+
+// Screen columns [*c0, *c1) of the character at 'at' of the row.
+static void charColumns(int row, int at, int *c0, int *c1) {
+    Erow *r = row < EC.buf->numrows ? rowAt(EC.buf, row) : NULL;
+
+    *c0 = r ? rowCol(r, at) : at;
+    *c1 = r && at < r->size ? rowCol(r, rowNextChar(r, at)) : *c0 + 1;
+}
+
+// The selection from the anchor to the cursor: the rows [*r0, *r1], and the
+// chars from '*c0' of the first row to '*c1' (excluded) of the last one, or
+// in block mode the screen columns [*c0, *c1) of every row.
+void visualBounds(int *r0, int *c0, int *r1, int *c1) {
+    int row = EC.view->row_offset + EC.view->cy, col = EC.view->cx;
+
+    if (EC.mode == VISUAL_BLOCK) {
+        int a0, a1, b0, b1;
+        charColumns(EC.vrow, EC.vcol, &a0, &a1);
+        charColumns(row, col, &b0, &b1);
+        *r0 = EC.vrow < row ? EC.vrow : row;
+        *r1 = EC.vrow < row ? row : EC.vrow;
+        *c0 = a0 < b0 ? a0 : b0;
+        *c1 = a1 > b1 ? a1 : b1;
+        return;
+    }
+    if (EC.vrow < row || (EC.vrow == row && EC.vcol < col)) {
+        *r0 = EC.vrow;
+        *c0 = EC.vcol;
+        *r1 = row;
+        *c1 = col;
+    } else {
+        *r0 = row;
+        *c0 = col;
+        *r1 = EC.vrow;
+        *c1 = EC.vcol;
+    }
+    // The rows of a closed fold at the end are selected too.
+    if (EC.mode == VISUAL_LINE && foldShut(EC.view, *r1) != -1)
+        *r1 = foldShut(EC.view, *r1);
+    // The character under the end is selected too.
+    if (*r1 < EC.buf->numrows)
+        *c1 = rowNextChar(rowAt(EC.buf, *r1), *c1);
+}
+
+// Screen columns [*from, *to) of the row 'filerow' of the view that are
+// selected. Returns 0 if none.
+int visualColumns(Eview *view, int filerow, int *from, int *to) {
+    int r0, c0, r1, c1;
+
+    if (view != EC.view || (EC.mode != VISUAL && EC.mode != VISUAL_LINE &&
+                EC.mode != VISUAL_BLOCK))
+        return 0;
+    visualBounds(&r0, &c0, &r1, &c1);
+    if (filerow < r0 || filerow > r1 || filerow >= view->buf->numrows)
+        return 0;
+
+    Erow *row = rowAt(view->buf, filerow);
+    *from = 0;
+    *to = INT_MAX;
+    if (EC.mode == VISUAL_BLOCK) {
+        *from = c0;
+        *to = c1;
+    } else if (EC.mode == VISUAL) {
+        if (filerow == r0)
+            *from = rowCol(row, c0);
+        if (filerow == r1)
+            *to = rowCol(row, c1);
+    }
+    return 1;
+}
+
+// Keep the whole row in the register line.
+static void shareLine(struct regLine *l, Erow *row) {
+    l->chars = rowShare(row->chars);
+    l->size = row->size;
+    l->hl_oc = row->hl_oc;
+    // Long rows have no render, they are rendered again anyway, as the rows
+    // whose highlight is deferred.
+    if (row->lr || row->render == NULL || row->hl == NULL ||
+            row->hl_oc == HL_OC_DEFERRED)
+        return;
+    l->render = rowShare(row->render);
+    l->hl = rowShare(row->hl);
+    l->cols = rowShare(row->cols);
+    l->rsize = row->rsize;
+    l->multibyte = row->rx != row->cols;
+}
+
+// Keep a copy of the 'len' bytes at 's' in the register line.
+static void copyLine(struct regLine *l, const char *s, int len, int hl_oc) {
+    l->chars = rowAlloc(len + 1);
+    memcpy(l->chars, s, len);
+    l->chars[len] = '\0';
+    l->size = len;
+    l->hl_oc = hl_oc;
+}
+
+// Set up 'row' at 'idx' with the line 'l' of a register, sharing its chars
+// if 'share' and its render and highlight as well if 'render'. Returns 1 if
+// the row must be rendered and highlighted.
+static int regRow(Erow *row, int idx, struct regLine *l, int share, int render) {
+    char *chars = share ? rowShare(l->chars) : NULL;
+
+    if (chars == NULL) {
+        chars = rowAlloc(l->size + 1);
+        memcpy(chars, l->chars, l->size + 1);
+    }
+    rowInitChars(row, idx, chars, l->size);
+    // The rows following it were highlighted after this state.
+    row->hl_oc = l->hl_oc;
+    if (!share || !render || l->render == NULL)
+        return 1;
+    row->render = rowShare(l->render);
+    row->hl = rowShare(l->hl);
+    row->cols = rowShare(l->cols);
+    row->rsize = l->rsize;
+    row->rx = row->cols && l->multibyte ? row->cols + l->size + 1 : row->cols;
+    return 0;
+}
+
+// Set up 'row' at 'idx' with the bytes 'a' of 'alen' then 'b' of 'blen'.
+static void joinRow(Erow *row, int idx, const char *a, int alen,
+        const char *b, int blen) {
+    char *chars = rowAlloc(alen + blen + 1);
+
+    memcpy(chars, a, alen);
+    memcpy(chars + alen, b, blen);
+    chars[alen + blen] = '\0';
+    rowInitChars(row, idx, chars, alen + blen);
+}
+
+// Put the 'm' rows of 'rows' in place of the 'n' rows from 'at' of the
+// current buffer, as a single change that can be undone. The rows at the
+// indexes 'update' are rendered and highlighted, the other ones already
+// are, as if the first of them started with the open comment state 'oc'.
+static void changeRows(int at, int n, Erow *rows, int m, int *update,
+        int nupdate, int oc) {
+    Ebuf *buf = EC.buf;
+    int before = ocBefore(at), after = ocBefore(at + n);
+
+    undoBegin();
+    undoSave(at, n, m, &buf->row[at]);
+    for (int j = at; j < at + n; j++) {
+        buf->row[j].chars = NULL;
+        freeRow(&buf->row[j]);
+    }
+    spliceRows(at, n, rows, m);
+    updateRows(update, nupdate);
+    // The highlight of the shared rows and of the rows after the change
+    // depends on the comments opened before them.
+    if (m && before != oc)
+        updateSyntaxHighLight(&buf->row[at]);
+    if (at + m < buf->numrows && ocBefore(at + m) != after)
+        updateSyntaxHighLight(&buf->row[at + m]);
+    buf->dirty++;
+    undoEnd();
+}
+
+// Delete what yank() just took.
+static void deleteRows(int type, int r0, int c0, int r1, int c1) {
+    Ebuf *buf = EC.buf;
+    int n = r1 - r0 + 1, *update = xmalloc(sizeof(int) * n);
+    Erow *rows = xmalloc(sizeof(Erow) * n);
+
+    if (type == VISUAL_LINE) {
+        changeRows(r0, n, NULL, 0, NULL, 0, 0);
+    } else if (type == VISUAL) {
+        Erow *first = &buf->row[r0], *last = &buf->row[r1];
+        joinRow(&rows[0], r0, first->chars, c0, last->chars + c1, last->size - c1);
+        update[0] = r0;
+        changeRows(r0, n, rows, 1, update, 1, 0);
+    } else {
+        for (int j = 0; j < n; j++) {
+            Erow *row = &buf->row[r0 + j];
+            int from = rowOffsetAtCol(row, c0), to = rowOffsetAtCol(row, c1);
+            if (from > row->size)
+                from = row->size;
+            if (to > row->size)
+                to = row->size;
+            joinRow(&rows[j], r0 + j, row->chars, from,
+                    row->chars + to, row->size - to);
+            update[j] = r0 + j;
+        }
+        changeRows(r0, n, rows, n, update, n, 0);
+    }
+    free(rows);
+    free(update);
+}
+
+// Yank in the register 'name', a letter or 0 for the unnamed one, the rows
+// [r0, r1] of the current buffer as 'type': VISUAL_LINE takes them whole,
+// VISUAL the chars from 'c0' of the first row to 'c1' (excluded) of the
+// last one, and VISUAL_BLOCK the chars in the screen columns [c0, c1) of
+// every row. They are deleted as well if 'del' is set.
+void yank(int name, int type, int r0, int c0, int r1, int c1, int del) {
+    Ebuf *buf = EC.buf;
+    int idx = name ? name - 'a' + 1 : 0;
+    struct reg *r = &regs[idx];
+
+    if (r1 >= buf->numrows)
+        r1 = buf->numrows - 1;
+    if (r0 < 0 || r0 > r1)
+        return;
+    rowCommit();
+    coldThaw(buf, r0, r1 + 1);
+    if (type == VISUAL) {
+        if (c0 > buf->row[r0].size)
+            c0 = buf->row[r0].size;
+        if (c1 > buf->row[r1].size)
+            c1 = buf->row[r1].size;
+        if (r0 == r1 && c1 < c0)
+            c1 = c0;
+    }
+
+    int n = r1 - r0 + 1;
+    regClear(r);
+    r->type = type;
+    r->lines = xmalloc(sizeof(struct regLine) * n);
+    memset(r->lines, 0, sizeof(struct regLine) * n);
+    r->n = n;
+    r->arena = rowArenaRetain(buf->arena);
+    r->syntax = buf->syntax;
+    r->oc = ocBefore(r0);
+    for (int j = 0; j < n; j++) {
+        Erow *row = &buf->row[r0 + j];
+        int from = 0, to = row->size;
+
+        if (type == VISUAL_BLOCK) {
+            from = rowOffsetAtCol(row, c0);
+            to = rowOffsetAtCol(row, c1);
+            if (from > row->size)
+                from = row->size;
+            if (to > row->size)
+                to = row->size;
+        } else if (type == VISUAL) {
+            if (j == 0)
+                from = c0;
+            if (j == n - 1)
+                to = c1;
+        }
+        if (from == 0 && to == row->size)
+            shareLine(&r->lines[j], row);
+        else
+            copyLine(&r->lines[j], row->chars + from, to - from, row->hl_oc);
+    }
+    unnamed = idx;
+
+    if (del)
+        deleteRows(type, r0, c0, r1, c1);
+    if (n > 1)
+        setStatusMsg("%d lines %s", n, del ? "deleted" : "yanked");
+    else
+        setStatusMsg("");
+}
+
+// Put the register 'name', a letter or 0 for the unnamed one, after the
+// cursor, or before it if 'before' is set.
+void put(int name, int before) {
+    Ebuf *buf = EC.buf;
+    Eview *view = EC.view;
+    struct reg *r = &regs[name ? name - 'a' + 1 : unnamed];
+    int filerow = view->row_offset + view->cy, n = r->n, nupdate = 0;
+
+    if (n == 0) {
+        setStatusMsg("Nothing in register %c", name ? name : '"');
+        return;
+    }
+    rowCommit();
+    if (filerow > buf->numrows)
+        filerow = buf->numrows;
+    coldThaw(buf, filerow, filerow + n);
+
+    // The blocks of an arena can only be shared by the rows of its buffer.
+    int share = r->arena == NULL || r->arena == buf->arena;
+    int render = share && r->syntax == buf->syntax;
+    int *update = xmalloc(sizeof(int) * (n + 1));
+    Erow *rows = xmalloc(sizeof(Erow) * (n + 1));
+    Erow *row = filerow < buf->numrows ? &buf->row[filerow] : NULL;
+
+    if (r->type == VISUAL_LINE) {
+        int at = before || row == NULL ? filerow : filerow + 1;
+        for (int j = 0; j < n; j++)
+            if (regRow(&rows[j], at + j, &r->lines[j], share, render))
+                update[nupdate++] = at + j;
+        changeRows(at, 0, rows, n, update, nupdate, r->oc);
+        gotoRow(view, at);
+        view->cx = 0;
+    } else if (r->type == VISUAL) {
+        // The first line goes after the chars before the cursor, the last
+        // one before the chars after it.
+        const char *s = row ? row->chars : "";
+        int size = row ? row->size : 0, at = view->cx;
+        if (at > size)
+            at = size;
+        if (!before && at < size)
+            at = rowNextChar(row, at);
+
+        struct regLine *first = &r->lines[0], *last = &r->lines[n - 1];
+        if (n == 1) {
+            char *chars = rowAlloc(size + first->size + 1);
+            memcpy(chars, s, at);
+            memcpy(chars + at, first->chars, first->size);
+            memcpy(chars + at + first->size, s + at, size - at + 1);
+            rowInitChars(&rows[0], filerow, chars, size + first->size);
+        } else {
+            joinRow(&rows[0], filerow, s, at, first->chars, first->size);
+            for (int j = 1; j < n - 1; j++)
+                if (regRow(&rows[j], filerow + j, &r->lines[j], share, render))
+                    update[nupdate++] = filerow + j;
+            joinRow(&rows[n - 1], filerow + n - 1, last->chars, last->size,
+                    s + at, size - at);
+            update[nupdate++] = filerow + n - 1;
+        }
+        rows[0].hl_oc = first->hl_oc;
+        update[nupdate++] = filerow;
+        changeRows(filerow, row ? 1 : 0, rows, n, update, nupdate, 0);
+        view->cx = n == 1 && first->size ? at + first->size - 1 : at;
+        clampCursor(view);
+        scrollCursor(view);
+    } else {
+        // Every line goes in its row at the column of the cursor, the rows
+        // missing at the end are added.
+        int col = row ? rowCol(row, view->cx) : view->cx, old = 0;
+        if (!before && row && view->cx < row->size)
+            col = rowCol(row, rowNextChar(row, view->cx));
+
+        for (int j = 0; j < n; j++) {
+            struct regLine *l = &r->lines[j];
+            Erow *dst = filerow + j < buf->numrows ? &buf->row[filerow + j] : NULL;
+            const char *s = dst ? dst->chars : "";
+            int size = dst ? dst->size : 0, at = dst ? rowOffsetAtCol(dst, col) : col;
+            int pad = at > size ? at - size : 0;
+            char *chars = rowAlloc(size + pad + l->size + 1);
+
+            if (at > size)
+                at = size;
+            memcpy(chars, s, at);
+            memset(chars + at, ' ', pad);
+            memcpy(chars + at + pad, l->chars, l->size);
+            memcpy(chars + at + pad + l->size, s + at, size - at + 1);
+            rowInitChars(&rows[j], filerow + j, chars, size + pad + l->size);
+            update[nupdate++] = filerow + j;
+            old += dst != NULL;
+        }
+        changeRows(filerow, old, rows, n, update, nupdate, 0);
+        view->cx = rowOffsetAtCol(&buf->row[filerow], col);
+        clampCursor(view);
+        scrollCursor(view);
+    }
+    free(rows);
+    free(update);
+    if (r->type == VISUAL_LINE && n > 1)
+        setStatusMsg("%d more lines", n);
+}
@@ -0,0 +1,119 @@
+#include "chibidit.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/* ============================= Watching files =============================
+ *
+ * The files of the buffers are watched with inotify, and the events are
+ * collected when no key was typed for a while, see readKey(). A followed
+ * buffer reads what was appended to its file (src/follow.c), the others
+ * just note that the file changed on disk, so that it can be reloaded
+ * (src/reload.c). Our own saves modify the files as well: a file changed
+ * only if its size or modification time is not the one we read or wrote.
+ *
+ * Without inotify the files are checked with stat(2) every time instead. */
+
+static int watch_fd = -1;       /* inotify instance, -1 if not open yet. */
+
+// Watch the file of 'buf' for changes, if possible.
+void watchFile(Ebuf *buf) {
+#ifdef __linux__
+    if (buf->filename == NULL || buf->wd > 0)
+        return;
+    if (watch_fd == -1)
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd == -1)
+        return;
+    buf->wd = inotify_add_watch(watch_fd, buf->filename,
+            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (buf->wd == -1)
+        buf->wd = 0;
+#else
+    (void)buf;
+#endif
+}
+
+void unwatchFile(Ebuf *buf) {
+#ifdef __linux__
+    if (buf->wd > 0)
+        inotify_rm_watch(watch_fd, buf->wd);
+#endif
+    buf->wd = 0;
+}
+
+// Remember the size and modification time of the file read or written.
+void watchStat(Ebuf *buf, struct stat *st) {
+    buf->loaded = st->st_size;
+    buf->mtime = st->st_mtim;
+    buf->changed = 0;
+}
+
+// Did the file of 'buf' change since it was read or written ?
+static int fileChanged(Ebuf *buf) {
+    struct stat st;
+
+    if (buf->filename == NULL || stat(buf->filename, &st) == -1)
+        return 0;
+    return st.st_size != buf->loaded ||
+        st.st_mtim.tv_sec != buf->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != buf->mtime.tv_nsec;
+}
+
+// Collect the changes of the files, called while waiting for a key.
+// Returns non zero if the screen must be drawn again.
+int watchPoll(void) {
+    int changed = 0;
+
+#ifdef __linux__
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (watch_fd == -1)
+        return 0;
+    // A file written fast sends many events: just note the modified
+    // buffers, that are then checked once.
+    while ((len = read(watch_fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            for (int j = 0; j < EC.numbufs; j++) {
+                Ebuf *buf = EC.bufs[j];
+                if (buf->wd != ev->wd)
+                    continue;
+                // The file was renamed or deleted: watch the new file with
+                // the same name, once it exists.
+                if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+                    unwatchFile(buf);
+                buf->modified = 1;
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    for (int j = 0; j < EC.numbufs; j++) {
+        Ebuf *buf = EC.bufs[j];
+        if (buf->filename && buf->wd == 0 && !buf->window) {
+            watchFile(buf);
+            buf->modified |= buf->wd != 0;
+        }
+    }
+#else
+    for (int j = 0; j < EC.numbufs; j++)
+        EC.bufs[j]->modified = 1;
+#endif
+
+    for (int j = 0; j < EC.numbufs; j++) {
+        Ebuf *buf = EC.bufs[j];
+        if (!buf->modified)
+            continue;
+        buf->modified = 0;
+        if (buf->follow) {
+            changed |= followUpdate(buf);
+        } else if (!buf->changed && fileChanged(buf)) {
+            buf->changed = 1;
+            setStatusMsg("%.20s changed on disk, press R to reload",
+                    buf->filename);
+            changed = 1;
+        }
+    }
+    return changed;
+}
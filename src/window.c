@@ -0,0 +1,331 @@
+#include "chibidit.h"
+
+static Elayout *newLeaf(Eview *view) {
+    Elayout *node = malloc(sizeof(*node));
+    if (node == NULL) {
+        perror("Allocating view");
+        exit(1);
+    }
+    memset(node, 0, sizeof(*node));
+    node->type = LAYOUT_VIEW;
+    node->view = view;
+    return node;
+}
+
+static Eview *newView(Ebuf *buf) {
+    Eview *view = malloc(sizeof(*view));
+    if (view == NULL) {
+        perror("Allocating view");
+        exit(1);
+    }
+    memset(view, 0, sizeof(*view));
+    view->buf = buf;
+    return view;
+}
+
+void initViews(void) {
+    EC.view = newView(NULL);
+    EC.layout = newLeaf(EC.view);
+}
+
+static Elayout *findLeaf(Elayout *node, Eview *view) {
+    if (node->type == LAYOUT_VIEW)
+        return node->view == view ? node : NULL;
+    Elayout *leaf = findLeaf(node->child[0], view);
+    return leaf ? leaf : findLeaf(node->child[1], view);
+}
+
+// Keep the cursor of a view inside its area and its buffer after the view
+// was resized or the buffer was edited from another view.
+static void clampView(Eview *view) {
+    if (view->buf && view->row_offset > view->buf->numrows)
+        view->row_offset = view->buf->numrows;
+    if (view->cy >= view->screenrows && !foldActive(view)) {
+        view->row_offset += view->cy - view->screenrows + 1;
+        view->cy = view->screenrows - 1;
+    }
+    if (view->cy < 0)
+        view->cy = 0;
+    if (view->buf)
+        clampCursor(view);
+    scrollCursor(view);
+}
+
+// Scroll the view horizontally so that the cursor is visible. The cursor
+// is an offset in the row chars while col_offset is a screen column, the
+// columns index of the row converts between the two in constant time.
+// A view in wrap mode scrolls vertically instead, and a view with closed
+// folds scrolls vertically as well, the rows and the lines differ.
+void scrollCursor(Eview *view) {
+    if (view->cx < 0)
+        view->cx = 0;
+    if (view->wrap && view->buf) {
+        wrapScroll(view);
+        return;
+    }
+    if (foldActive(view))
+        foldScroll(view);
+
+    int filerow = view->row_offset + view->cy;
+    Erow *row = (view->buf == NULL || filerow >= view->buf->numrows) ?
+        NULL : rowAt(view->buf, filerow);
+    int col = row ? rowCol(row, view->cx) : view->cx;
+    // The last column of the character, for wide ones.
+    int end = (row && view->cx < row->size) ?
+        rowCol(row, rowNextChar(row, view->cx)) - 1 : col;
+    if (col < view->col_offset)
+        view->col_offset = col;
+    else if (end >= view->col_offset + view->screencols)
+        view->col_offset = end - view->screencols + 1;
+    coldView(view);
+}
+
+// Move the cursor to the end of its row if it is past it, or to the first
+// byte of the character it is in the middle of.
+void clampCursor(Eview *view) {
+    int filerow = view->row_offset + view->cy;
+    Erow *row = filerow < view->buf->numrows ? rowAt(view->buf, filerow) : NULL;
+    int rowlen = row ? row->size : 0;
+
+    if (view->cx > rowlen) {
+        view->cx = rowlen;
+    } else if (row && view->cx > 0 && view->cx < rowlen &&
+            rowNextChar(row, rowPrevChar(row, view->cx)) != view->cx) {
+        view->cx = rowPrevChar(row, view->cx);
+    }
+}
+
+// Move the cursor to the row 'at', clamped to the buffer, or to the first
+// row of the closed fold it is in. The view scrolls only if the row is not
+// visible, and then the row goes to its middle, or as low as the last page
+// allows.
+void gotoRow(Eview *view, int at) {
+    if (at >= view->buf->numrows)
+        at = view->buf->numrows - 1;
+    if (at < 0)
+        at = 0;
+    int line = foldLine(view, at), top = foldLine(view, view->row_offset);
+    at = foldRow(view, line);
+    if (line < top || line >= top + view->screenrows) {
+        int last = foldLine(view, view->buf->numrows) - view->screenrows;
+        top = line - view->screenrows / 2;
+        if (top > last)
+            top = last;
+        if (top < 0)
+            top = 0;
+        view->row_offset = foldRow(view, top);
+        view->skip = 0;
+    }
+    view->cy = at - view->row_offset;
+    clampCursor(view);
+    scrollCursor(view);
+}
+
+// Go to the line 'at' of the document of the view. The rows of a buffer
+// may be a window over a larger document, see src/pager.c.
+void gotoLine(Eview *view, long long at) {
+    Ebuf *buf = view->buf;
+
+    if (buf->pager)
+        pagerLoad(buf, at);
+    at -= buf->above;
+    gotoRow(view, at < 0 ? 0 : at > INT_MAX ? INT_MAX : at);
+}
+
+static void shiftView(Elayout *node, Ebuf *buf, int delta) {
+    if (node->type != LAYOUT_VIEW) {
+        shiftView(node->child[0], buf, delta);
+        shiftView(node->child[1], buf, delta);
+        return;
+    }
+    Eview *view = node->view;
+    if (view->buf != buf)
+        return;
+    int filerow = view->row_offset + view->cy + delta;
+    view->row_offset += delta;
+    if (view->row_offset < 0)
+        view->row_offset = 0;
+    view->skip = 0;
+    gotoRow(view, filerow);
+}
+
+// Keep the views of 'buf' on their lines after 'delta' rows were inserted
+// at its top, or removed if negative, as when a window over a document
+// slides.
+void shiftViews(Ebuf *buf, int delta) {
+    shiftView(EC.layout, buf, delta);
+    if (EC.view->buf != buf) {
+        int filerow = buf->row_offset + buf->cy + delta;
+        buf->row_offset += delta;
+        if (buf->row_offset < 0)
+            buf->row_offset = 0;
+        if (filerow < buf->row_offset)
+            filerow = buf->row_offset;
+        buf->cy = filerow - buf->row_offset;
+    }
+}
+
+// Scroll the view by 'rows' rows, up if negative, a closed fold counts as
+// one. The cursor goes to the top of the view if 'top' is set, or else moves
+// by as many rows. When wrapping, the view scrolls by screen lines and the
+// cursor goes to the top.
+void scrollRows(Eview *view, int rows, int top) {
+    int line = foldLine(view, view->row_offset) + rows;
+    int filerow = foldRow(view, foldLine(view, view->row_offset + view->cy) + rows);
+    // The last page is kept full.
+    int last = foldLine(view, view->buf->numrows) - view->screenrows;
+
+    if (view->wrap) {
+        wrapPage(view, rows);
+        return;
+    }
+    if (line > last)
+        line = last;
+    if (line < 0)
+        line = 0;
+    view->row_offset = foldRow(view, line);
+    gotoRow(view, top ? view->row_offset : filerow);
+}
+
+// Columns of the line numbers of a view 'cols' wide, with the blank after
+// them: as many as the digits of the last line, three at least. A view too
+// narrow has none.
+static int gutterWidth(Eview *view, int cols) {
+    Ebuf *buf = view->buf;
+    long long lines = buf ? buf->above + buf->numrows + buf->below : 0;
+    int digits = 3;
+
+    if (!view->number)
+        return 0;
+    for (long long n = 1000; n <= lines; n *= 10)
+        digits++;
+    return digits + 1 < cols ? digits + 1 : 0;
+}
+
+static void layoutNode(Elayout *node, int top, int left, int rows, int cols) {
+    node->top = top;
+    node->left = left;
+    node->rows = rows;
+    node->cols = cols;
+
+    if (node->type == LAYOUT_VIEW) {
+        // The last row of every view is its status bar. The text starts
+        // after the line numbers, so that the columns of the view are the
+        // ones of the text.
+        Eview *view = node->view;
+        view->gutter = gutterWidth(view, cols);
+        view->top = top;
+        view->left = left + view->gutter;
+        view->screenrows = rows - 1;
+        view->screencols = cols - view->gutter;
+        clampView(view);
+    } else if (node->type == LAYOUT_HSPLIT) {
+        int first = rows / 2;
+        layoutNode(node->child[0], top, left, first, cols);
+        layoutNode(node->child[1], top + first, left, rows - first, cols);
+    } else {
+        // One column is taken by the vertical separator.
+        int first = (cols - 1) / 2;
+        layoutNode(node->child[0], top, left, rows, first);
+        layoutNode(node->child[1], top, left + first + 1, rows, cols - first - 1);
+    }
+}
+
+void layoutViews(void) {
+    layoutNode(EC.layout, 0, 0, EC.screenrows, EC.screencols);
+}
+
+static int gutterChanged(Elayout *node) {
+    if (node->type == LAYOUT_VIEW)
+        return gutterWidth(node->view, node->cols) != node->view->gutter;
+    return gutterChanged(node->child[0]) || gutterChanged(node->child[1]);
+}
+
+// Lay the views out again if the line numbers of one of them need another
+// width, as its lines went past a power of ten. Checked once a frame.
+void updateGutters(void) {
+    if (gutterChanged(EC.layout))
+        layoutViews();
+}
+
+static void focusView(Eview *view) {
+    EC.view = view;
+    EC.buf = view->buf;
+    for (int j = 0; j < EC.numbufs; j++)
+        if (EC.bufs[j] == EC.buf)
+            EC.curbuf = j;
+    clampView(view);
+}
+
+// Split the current view in two, the new view shows the same buffer at the
+// same position and becomes the current one.
+void splitView(int type) {
+    Elayout *leaf = findLeaf(EC.layout, EC.view);
+    Eview *view = newView(EC.buf);
+
+    if ((type == LAYOUT_HSPLIT && leaf->rows < 4) ||
+            (type == LAYOUT_VSPLIT && leaf->cols < 3)) {
+        setStatusMsg("Not enough room to split");
+        free(view);
+        return;
+    }
+    view->cx = EC.view->cx;
+    view->cy = EC.view->cy;
+    view->row_offset = EC.view->row_offset;
+    view->col_offset = EC.view->col_offset;
+    view->wrap = EC.view->wrap;
+    view->skip = EC.view->skip;
+    view->number = EC.view->number;
+
+    // The leaf becomes an inner node with the old and the new view as
+    // children.
+    Elayout *old = newLeaf(EC.view);
+    Elayout *new = newLeaf(view);
+    leaf->type = type;
+    leaf->view = NULL;
+    leaf->child[0] = new;
+    leaf->child[1] = old;
+    old->parent = new->parent = leaf;
+    layoutViews();
+    focusView(view);
+}
+
+// Close the current view, its sibling takes the place of the parent split.
+void closeView(void) {
+    Elayout *leaf = findLeaf(EC.layout, EC.view);
+    Elayout *parent = leaf->parent;
+
+    if (parent == NULL) {
+        setStatusMsg("Cannot close the last view");
+        return;
+    }
+    Elayout *sibling = parent->child[parent->child[0] == leaf];
+    Elayout *grand = parent->parent;
+    *parent = *sibling;
+    parent->parent = grand;
+    if (parent->type != LAYOUT_VIEW) {
+        parent->child[0]->parent = parent;
+        parent->child[1]->parent = parent;
+    }
+    free(leaf->view);
+    free(leaf);
+    free(sibling);
+    layoutViews();
+
+    // Move to the first view of the area that was freed.
+    while (parent->type != LAYOUT_VIEW)
+        parent = parent->child[0];
+    focusView(parent->view);
+}
+
+// Move to the next view, in screen order.
+void nextView(void) {
+    Elayout *node = findLeaf(EC.layout, EC.view);
+
+    while (node->parent && node->parent->child[1] == node)
+        node = node->parent;
+    node = node->parent ? node->parent->child[1] : EC.layout;
+    while (node->type != LAYOUT_VIEW)
+        node = node->child[0];
+    focusView(node->view);
+}
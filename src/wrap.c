@@ -0,0 +1,230 @@
+#include "chibidit.h"
+
+/* =============================== Soft wrap ================================
+ *
+ * A view in wrap mode shows every row on as many screen lines as needed
+ * instead of scrolling horizontally. The top of the view is then the row
+ * 'row_offset' with its first 'skip' lines scrolled away, and the cursor row
+ * is still row_offset + cy.
+ *
+ * Scrolling needs the number of screen lines above a row. Every buffer
+ * keeps for this a Fenwick tree of the heights of its rows, so that both
+ * the line of a row and the row at a line are found in O(log n). The index
+ * is built for the width of the current view, and keeps the width in columns
+ * of every row: editing a row just updates its height in the tree, inserted
+ * or deleted rows move the widths of the rows after them, only the inserted
+ * ones are measured, and the tree is built again from the widths. When the
+ * width changes (a resize, or a view of another width) the heights are
+ * computed again from the widths too, without looking at the rows at all.
+ * All this is done lazily, when the current view scrolls. */
+
+#define WRAP_UNMEASURED -1  /* Width of a row not measured yet. */
+
+struct wrapIndex {
+    int width;      /* Screen width the tree is built for, 0 if none. */
+    int numrows;    /* Rows of the buffer in 'cols'. */
+    int cap;        /* Rows the arrays can hold. */
+    int changed;    /* Rows were inserted or deleted since the build. */
+    int *cols;      /* Width in columns of every row. */
+    int *tree;      /* Fenwick tree of the heights, indexed from 1. */
+};
+
+// Make room in the arrays of 'w' for 'n' rows.
+static void wrapGrow(struct wrapIndex *w, int n) {
+    if (n + 1 <= w->cap)
+        return;
+    w->cap = (n + 1) * 2;
+    w->cols = realloc(w->cols, sizeof(int) * w->cap);
+    w->tree = realloc(w->tree, sizeof(int) * w->cap);
+    if (w->cols == NULL || w->tree == NULL) {
+        perror("Out of memory");
+        exit(1);
+    }
+}
+
+// Screen lines taken by a row 'cols' wide, one more when the row fills the
+// last one, so that the cursor after the end is on a line of its own.
+static int heightOf(int cols, int width) {
+    return cols / width + 1;
+}
+
+int wrapHeight(Eview *view, Erow *row) {
+    return heightOf(rowCol(row, row->size), view->screencols);
+}
+
+// Measure the rows inserted since the last call, and build the tree again
+// if needed, for the width of 'view'.
+static struct wrapIndex *validate(Eview *view) {
+    Ebuf *buf = view->buf;
+    struct wrapIndex *w = buf->wrap;
+    int n = buf->numrows;
+
+    if (w == NULL) {
+        w = buf->wrap = malloc(sizeof(*w));
+        if (w == NULL) {
+            perror("Out of memory");
+            exit(1);
+        }
+        memset(w, 0, sizeof(*w));
+    }
+    if (!w->changed && w->numrows == n && w->width == view->screencols)
+        return w;
+
+    // The rows the index does not know of yet, when it was just created.
+    wrapGrow(w, n);
+    for (int j = w->numrows; j < n; j++)
+        w->cols[j] = WRAP_UNMEASURED;
+    for (int j = 0; j < n; j++)
+        if (w->cols[j] == WRAP_UNMEASURED)
+            w->cols[j] = rowCol(rowAt(buf, j), buf->row[j].size);
+    w->numrows = n;
+    w->changed = 0;
+    w->width = view->screencols;
+
+    // Linear time build: every node adds its sum to its parent.
+    for (int j = 1; j <= n; j++)
+        w->tree[j] = heightOf(w->cols[j - 1], w->width);
+    for (int j = 1; j <= n; j++) {
+        int parent = j + (j & -j);
+        if (parent <= n)
+            w->tree[parent] += w->tree[j];
+    }
+    return w;
+}
+
+// Screen lines above the row 'at' of the buffer of the view. The rows past
+// the end of the buffer are one line each.
+int wrapLine(Eview *view, int at) {
+    struct wrapIndex *w = validate(view);
+    int line = 0;
+
+    if (at > w->numrows) {
+        line = at - w->numrows;
+        at = w->numrows;
+    }
+    for (; at > 0; at -= at & -at)
+        line += w->tree[at];
+    return line;
+}
+
+// Row shown at the screen line 'line', and the lines of it above 'line'.
+static void wrapFind(Eview *view, int line, int *row, int *skip) {
+    struct wrapIndex *w = validate(view);
+    int pos = 0, step = 1;
+
+    while (step * 2 <= w->numrows)
+        step *= 2;
+    for (; step; step /= 2) {
+        if (pos + step <= w->numrows && w->tree[pos + step] <= line) {
+            pos += step;
+            line -= w->tree[pos];
+        }
+    }
+    *row = pos;
+    *skip = line;
+    if (pos == w->numrows) {
+        *row += line;
+        *skip = 0;
+    }
+}
+
+// The row 'row' of the current buffer was edited.
+void wrapRowChanged(Erow *row) {
+    struct wrapIndex *w = EC.buf->wrap;
+
+    if (w == NULL || row->idx >= w->numrows ||
+            w->cols[row->idx] == WRAP_UNMEASURED)
+        return;
+    int cols = rowCol(row, row->size);
+    int delta = heightOf(cols, w->width) - heightOf(w->cols[row->idx], w->width);
+    w->cols[row->idx] = cols;
+    // The tree is built again anyway.
+    if (w->changed)
+        return;
+    for (int j = row->idx + 1; delta && j <= w->numrows; j += j & -j)
+        w->tree[j] += delta;
+}
+
+// The 'n' rows at 'at' of 'buf' were replaced by 'm' rows: the widths of the
+// rows after them move, the new ones are measured on the next scroll.
+void wrapRowsChanged(Ebuf *buf, int at, int n, int m) {
+    struct wrapIndex *w = buf->wrap;
+
+    if (w == NULL || at > w->numrows)
+        return;
+    if (at + n > w->numrows)
+        n = w->numrows - at;
+    wrapGrow(w, w->numrows - n + m);
+    memmove(w->cols + at + m, w->cols + at + n,
+            sizeof(int) * (w->numrows - at - n));
+    for (int j = at; j < at + m; j++)
+        w->cols[j] = WRAP_UNMEASURED;
+    w->numrows += m - n;
+    w->changed = 1;
+}
+
+void wrapFree(Ebuf *buf) {
+    if (buf->wrap == NULL)
+        return;
+    free(buf->wrap->cols);
+    free(buf->wrap->tree);
+    free(buf->wrap);
+    buf->wrap = NULL;
+}
+
+// Screen line of the cursor in the view, and screen column on that line.
+void wrapCursor(Eview *view, int *y, int *x) {
+    int filerow = view->row_offset + view->cy;
+    Erow *row = filerow < view->buf->numrows ? rowAt(view->buf, filerow) : NULL;
+    int col = row ? rowCol(row, view->cx) : view->cx;
+
+    *y = wrapLine(view, filerow) + col / view->screencols -
+        wrapLine(view, view->row_offset) - view->skip;
+    *x = col % view->screencols;
+}
+
+// Scroll the view by the least number of lines that shows the cursor.
+void wrapScroll(Eview *view) {
+    int filerow = view->row_offset + view->cy;
+    Erow *row = filerow < view->buf->numrows ? rowAt(view->buf, filerow) : NULL;
+    int col = row ? rowCol(row, view->cx) : view->cx;
+    int cursor = wrapLine(view, filerow) + col / view->screencols;
+    int top = wrapLine(view, view->row_offset) + view->skip;
+
+    if (cursor < top)
+        top = cursor;
+    else if (cursor >= top + view->screenrows)
+        top = cursor - view->screenrows + 1;
+    wrapFind(view, top, &view->row_offset, &view->skip);
+    view->cy = filerow - view->row_offset;
+    view->col_offset = 0;
+}
+
+// Scroll the view by 'lines' screen lines, up if negative, the cursor goes
+// to the top of the view.
+void wrapPage(Eview *view, int lines) {
+    int top = wrapLine(view, view->row_offset) + view->skip;
+    int total = wrapLine(view, view->buf->numrows);
+
+    top += lines;
+    if (top > total)
+        top = total;
+    if (top < 0)
+        top = 0;
+    wrapFind(view, top, &view->row_offset, &view->skip);
+    view->cy = 0;
+    view->cx = 0;
+    if (view->row_offset < view->buf->numrows)
+        view->cx = rowOffsetAtCol(rowAt(view->buf, view->row_offset),
+                view->skip * view->screencols);
+}
+
+void wrapToggle(void) {
+    Eview *view = EC.view;
+
+    view->wrap = !view->wrap;
+    view->skip = 0;
+    view->col_offset = 0;
+    scrollCursor(view);
+    setStatusMsg("Wrap %s", view->wrap ? "on" : "off");
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Run the : commands of scripts with 'chibidit -s' on small files, and check
+# the files they write and the errors they report. Run by 'make test'.
+
+CHIBIDIT=${CHIBIDIT:-./chibidit}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+# check NAME LINES EXPECTED ERROR COMMAND...: run the commands, one by line
+# of the script, on a file made of LINES, then compare the file with
+# EXPECTED. The script must fail telling ERROR if it is not empty, and
+# succeed otherwise.
+check() {
+    name=$1 error=$4
+    printf '%s\n' $2 > "$TMP/file"
+    printf '%s\n' $3 > "$TMP/expected"
+    shift 4
+    printf '%s\n' "$@" | "$CHIBIDIT" -s - "$TMP/file" 2> "$TMP/err"
+    status=$?
+    if ! cmp -s "$TMP/file" "$TMP/expected"; then
+        echo "FAIL $name: the file differs"
+        diff "$TMP/expected" "$TMP/file"
+        failed=1
+    elif [ -z "$error" ] && [ $status -ne 0 ]; then
+        echo "FAIL $name: $(cat "$TMP/err")"
+        failed=1
+    elif [ -n "$error" ] && ! grep -q "$error" "$TMP/err"; then
+        echo "FAIL $name: expected '$error', got '$(cat "$TMP/err")'"
+        failed=1
+    else
+        echo "ok   $name"
+    fi
+}
+
+check "substitute" "aaa bbb ccc" "aaa XXX ccc" "" '%s/bbb/XXX/' w
+check "undo" "aaa bbb ccc" "aaa bbb ccc" "" '%s/bbb/XXX/' undo w
+check "redo" "aaa bbb ccc" "aaa XXX ccc" "" '%s/bbb/XXX/' u redo w
+check "undo delete" "aaa bbb ccc ddd" "aaa bbb ccc ddd" "" 2,3d u w
+check "undo twice" "aaa bbb ccc" "aaa bbb ccc" "Nothing to undo" \
+    '%s/bbb/XXX/' u u
+# Writing the file starts the dirty counter again: the change before it
+# can't be undone, the rows it recorded may have moved since.
+check "undo after write" "aaa bbb ccc ddd" "aaa XXX ccc ddd" "Nothing to undo" \
+    '%s/bbb/XXX/' w u w
+# Writing a copy leaves the buffer modified, the change can be undone.
+check "undo after write copy" "aaa bbb ccc ddd" "aaa bbb ccc ddd" "" \
+    '%s/bbb/XXX/' "w $TMP/copy" u w
+# Deleting the last lines moves the cursor to the new last line.
+check "delete at the end" "aaa bbb ccc ddd eee" "aaa" "" 5 3,5d d w
+check "global delete at the end" "aaa bbb xc xd" "aaa" "" 4 g/x/d d w
+check "uniq at the end" "aaa bbb ccc ccc ccc" "bbb ccc" "" 5 uniq d w
+check "sort unique at the end" "ccc bbb aaa aaa aaa" "bbb ccc" "" 5 "sort u" d w
+# The line 0 is before the first one for :r only.
+printf '%s\n' X Y > "$TMP/read"
+check "read" "a b c" "a X Y b c" "" "r $TMP/read" w
+check "read at the top" "a b c" "X Y a b c" "" "0r $TMP/read" w
+check "delete line 0" "a b c" "b c" "" 0d w
+# A range past the end fails, and the script stops.
+check "delete past the end" "a b c" "a b c" "Invalid range" 5d w
+check "sort past the end" "c b a" "c b a" "Invalid range" 4,5sort w
+check "uniq past the end" "a a a" "a a a" "Invalid range" 4,5uniq w
+
+exit $failed